@@ -0,0 +1,96 @@
+/*
+ * antlog: query binary packet logs written by shockburst -w or the Pothos
+ * "Packet Log Sink" block.
+ *
+ * Packets are printed in the same format shockburst uses (address and payload
+ * as hex pairs), so the output can be piped into anteater.py. The log and its
+ * index are memory mapped, so seeking to a sample or filtering for an address
+ * does not touch the parts of the file that cannot match.
+ *
+ *   $ clang antlog.c -o antlog
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <unistd.h>    /* for getopt */
+
+#include "antsniff/packetlog.h"
+
+void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-v] [-n] [-s sample] [-e sample] [-a address] "
+			"logfile\n"
+			"  -v         prefix packets with sample, channel and CRC\n"
+			"  -n         only print the number of matching packets\n"
+			"  -s sample  start at this sample\n"
+			"  -e sample  stop before this sample\n"
+			"  -a address only packets with this address (hex)\n",
+			name);
+}
+
+void PrintRecord(const PacketLogRecord *rec, bool verbose)
+{
+	int i;
+
+	if (verbose) {
+		printf("%"PRIu64" %u %04X ", rec->sample, rec->channel, rec->crc);
+	}
+	for (i = rec->address_length - 1; i >= 0; --i) {
+		printf("%02X ", (unsigned)(rec->address >> (8 * i)) & 0xff);
+	}
+	for (i = 0; i < rec->payload_length; ++i) {
+		printf("%02X ", rec->payload[i]);
+	}
+	printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+	PacketLogReader reader;
+	PacketLogRecord rec;
+	uint64_t start = 0, end = UINT64_MAX, address = 0, count = 0;
+	bool verbose = false, count_only = false, by_address = false;
+	bool optfail = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "vns:e:a:")) != -1) {
+		switch (opt) {
+			case 'v': verbose = true; break;
+			case 'n': count_only = true; break;
+			case 's': start = strtoull(optarg, NULL, 0); break;
+			case 'e': end = strtoull(optarg, NULL, 0); break;
+			case 'a':
+				address = strtoull(optarg, NULL, 16);
+				by_address = true;
+				break;
+			default: optfail = true; break;
+		}
+	}
+	if (optfail || optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (plog_reader_open(&reader, argv[optind]) < 0) {
+		fprintf(stderr, "Could not open packet log %s\n", argv[optind]);
+		return 1;
+	}
+
+	if (start > 0) plog_seek_sample(&reader, start);
+
+	while (by_address ? plog_next_address(&reader, address, &rec) :
+			plog_next(&reader, &rec)) {
+		if (rec.sample >= end) break;
+		++count;
+		if (!count_only) PrintRecord(&rec, verbose);
+	}
+
+	if (count_only) printf("%"PRIu64"\n", count);
+
+	plog_reader_close(&reader);
+
+	return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * antshm: follow the shared memory packet feed published by shockburst -m or
+ * the Pothos "Shared Memory Sink" block.
+ *
+ * Packets are printed in the same format shockburst uses (address and payload
+ * as hex pairs), so the output can be piped into anteater.py. It's also the
+ * reference consumer of shmring.h: a reader maps the feed and copies records
+ * out of it, and never slows down the decoder.
+ *
+ *   $ clang antshm.c -o antshm
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <unistd.h>    /* for getopt */
+
+#include "antsniff/shmring.h"
+
+void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-v] [-f] shmname\n"
+			"  -v  prefix packets with sample, channel, CRC and margin\n"
+			"  -f  start with the next packet, not the oldest one in the ring\n",
+			name);
+}
+
+void PrintRecord(const ShmRingRecord *rec, bool verbose)
+{
+	int i;
+
+	if (verbose) {
+		printf("%"PRIu64" %u %04X %"PRId32" ", rec->sample, rec->channel,
+				rec->crc, rec->margin);
+	}
+	for (i = rec->address_length - 1; i >= 0; --i) {
+		printf("%02X ", (unsigned)(rec->address >> (8 * i)) & 0xff);
+	}
+	for (i = 0; i < rec->payload_length; ++i) {
+		printf("%02X ", rec->payload[i]);
+	}
+	printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+	ShmRingReader reader;
+	ShmRingRecord rec;
+	bool verbose = false, from_now = false;
+	bool optfail = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "vf")) != -1) {
+		switch (opt) {
+			case 'v': verbose = true; break;
+			case 'f': from_now = true; break;
+			default: optfail = true; break;
+		}
+	}
+	if (optfail || optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (shmring_reader_open(&reader, argv[optind], from_now) < 0) {
+		fprintf(stderr, "Could not open shared memory feed %s\n", argv[optind]);
+		return 1;
+	}
+
+	for (;;) {
+		if (shmring_read(&reader, &rec)) {
+			PrintRecord(&rec, verbose);
+			continue;
+		}
+
+		// caught up: the writer may have closed the feed after the last read
+		if (shmring_closed(&reader)) {
+			if (shmring_read(&reader, &rec)) {
+				PrintRecord(&rec, verbose);
+				continue;
+			}
+			break;
+		}
+
+		fflush(stdout);
+		usleep(1000);
+	}
+
+	if (reader.lost) {
+		fprintf(stderr, "%"PRIu64" packets were overwritten before they "
+				"were read\n", reader.lost);
+	}
+
+	shmring_reader_close(&reader);
+	return 0;
+}
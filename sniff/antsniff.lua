@@ -0,0 +1,61 @@
+-- Wireshark dissector for the PCAPNG files written by shockburst -p and the
+-- Pothos "PCAPNG Sink" block (see pcapng.h for the format).
+--
+-- Copy to ~/.local/lib/wireshark/plugins/ (or run wireshark -X lua_script:...)
+
+local p_sb = Proto("shockburst", "ShockBurst")
+
+local f = p_sb.fields
+f.version = ProtoField.uint8("shockburst.version", "Header version")
+f.channel = ProtoField.uint8("shockburst.channel", "Channel")
+f.addrlen = ProtoField.uint8("shockburst.address_length", "Address length")
+f.paylen = ProtoField.uint8("shockburst.payload_length", "Payload length")
+f.threshold = ProtoField.int32("shockburst.threshold", "Threshold")
+f.sample = ProtoField.uint64("shockburst.sample", "Sample")
+f.address = ProtoField.bytes("shockburst.address", "Address")
+f.payload = ProtoField.bytes("shockburst.payload", "Payload")
+f.crc = ProtoField.uint16("shockburst.crc", "CRC", base.HEX)
+f.msgid = ProtoField.uint8("shockburst.antfs.id", "ANT-FS message", base.HEX, {
+	[0x43] = "Client beacon",
+	[0x44] = "Command/response",
+})
+f.cmd = ProtoField.uint8("shockburst.antfs.command", "ANT-FS command", base.HEX, {
+	[0x02] = "Link", [0x03] = "Disconnect", [0x04] = "Auth", [0x05] = "Ping",
+	[0x09] = "Download request", [0x0a] = "Upload request",
+	[0x0b] = "Erase request", [0x0c] = "Upload data",
+	[0x84] = "Auth response", [0x89] = "Download response",
+	[0x8a] = "Upload response", [0x8b] = "Erase response",
+	[0x8c] = "Upload data response",
+})
+
+function p_sb.dissector(buf, pinfo, tree)
+	pinfo.cols.protocol = "ShockBurst"
+
+	local addrlen = buf(2, 1):uint()
+	local paylen = buf(3, 1):uint()
+	local t = tree:add(p_sb, buf())
+
+	t:add(f.version, buf(0, 1))
+	t:add(f.channel, buf(1, 1))
+	t:add(f.addrlen, buf(2, 1))
+	t:add(f.paylen, buf(3, 1))
+	t:add_le(f.threshold, buf(4, 4))
+	t:add_le(f.sample, buf(8, 8))
+	t:add(f.address, buf(16, addrlen))
+	local payload = buf(16 + addrlen, paylen)
+	t:add(f.payload, payload)
+	t:add(f.crc, buf(16 + addrlen + paylen, 2))
+
+	pinfo.cols.src = tostring(buf(16, addrlen):bytes())
+	pinfo.cols.info = "ch " .. buf(1, 1):uint()
+	if paylen >= 4 then
+		local id = payload(2, 1):uint()
+		t:add(f.msgid, payload(2, 1))
+		if id == 0x44 then
+			t:add(f.cmd, payload(3, 1))
+		end
+	end
+end
+
+local wtap_encap = DissectorTable.get("wtap_encap")
+wtap_encap:add(wtap.USER0, p_sb)
@@ -0,0 +1,410 @@
+/*
+ * antsweep: measure the decoder's detection settings on a capture.
+ *
+ * The decoder's settings (see antsniff_decoder_params in antsniff.h) are
+ * hand-picked. antsweep decodes a recorded capture, or a synthetic one, with
+ * every combination of the values given for them, in parallel on all cores,
+ * and prints a CSV line per combination: the packets decoded (and of those,
+ * the ones reacquired at a known device's level), the preambles that failed
+ * the CRC check (in total and per million samples), and the CPU time the
+ * decoder took per sample.
+ *
+ *   $ antsweep -w 8,16,32 -t 3,4,5 -r 300,1000 capture.cs16 > sweep.csv
+ *
+ * I/Q captures are demodulated once, into memory, before the sweep, so the
+ * times are the decoder's alone. A synthetic capture has packets of random
+ * payloads from a number of devices, each with its own DC (frequency)
+ * offset, at a given noise level, with FM demodulated noise (uniform over
+ * the sample range) between them.
+ */
+
+#define _GNU_SOURCE	// for CLOCK_THREAD_CPUTIME_ID
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>    /* for getopt */
+
+#include "antsniff/antsniff.h"
+#include "antsniff/capture.h"
+
+#define ADDRESS_LENGTH 5
+#define PAYLOAD_LENGTH 10
+
+/* Samples fed to the decoder at a time */
+#define CHUNK_SIZE 65536
+
+/* Values given per setting, at most */
+#define MAX_VALUES 64
+
+/* The settings swept: threshold window, saturation, transitions, initial and
+ * packet skip, ring size and known devices */
+#define SETTINGS 7
+
+typedef struct {
+	antsniff_decoder_params params;
+	uint64_t packets;
+	uint64_t reacquired;
+	uint64_t false_preambles;
+	double ns_per_sample;
+	bool valid;
+} SweepResult;
+
+/* The settings to sweep, and the work shared by the threads */
+typedef struct {
+	const int16_t *samples;
+	uint64_t count;
+	SweepResult *results;
+	size_t total;
+	size_t next;	// the next result to work out
+	pthread_mutex_t lock;
+} Sweep;
+
+void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-j threads] [-w windows] [-s saturations] "
+			"[-t transitions]\n"
+			"       [-k skips] [-K skips] [-r sizes] [-d devices]\n"
+			"       (-f format capture | -S packets [-A devices] [-N noise] "
+			"[-D offset])\n"
+			"  -j threads     decode on this many threads (default: one per "
+			"core)\n"
+			"  -w windows     threshold window, samples (default: 16)\n"
+			"  -s saturations saturation guard, int16 units (default: 15500)\n"
+			"  -t transitions preamble transitions (default: 4)\n"
+			"  -k skips       samples skipped at the start (default: 1000)\n"
+			"  -K skips       samples skipped after a packet (default: 20)\n"
+			"  -r sizes       ring buffer size, samples (default: 1000)\n"
+			"  -d devices     known devices cached (default: 0)\n"
+			"  -f format      capture format: s16, cs16, cs8, cu8 or cf32 "
+			"(default: by\n"
+			"                 extension)\n"
+			"  -S packets     sweep a synthetic capture of this many packets\n"
+			"  -A devices     from this many devices (default: 8)\n"
+			"  -N noise       its noise, standard deviation (default: 2000)\n"
+			"  -D offset      its devices' largest DC offset (default: 4000)\n"
+			"Settings take a comma separated list of values, e.g. -w 8,16,32; "
+			"every\ncombination is decoded.\n",
+			name);
+}
+
+/* Parse a comma separated list into values; returns the count, 0 on error */
+size_t ParseList(const char *list, uint32_t *values)
+{
+	size_t count = 0;
+	char *end;
+
+	while (count < MAX_VALUES) {
+		long value = strtol(list, &end, 0);
+		if (end == list || value < 0) return 0;
+		values[count++] = (uint32_t)value;
+		if (*end == '\0') return count;
+		if (*end != ',') return 0;
+		list = end + 1;
+	}
+
+	return 0;
+}
+
+uint64_t g_rng = 0x9e3779b97f4a7c15ULL;
+
+/* xorshift64*, so synthetic captures are the same on every run */
+uint64_t Random(void)
+{
+	g_rng ^= g_rng >> 12;
+	g_rng ^= g_rng << 25;
+	g_rng ^= g_rng >> 27;
+	return g_rng * 0x2545f4914f6cdd1dULL;
+}
+
+/* Standard normal, by Box-Muller */
+double Gaussian(void)
+{
+	double u = ((Random() >> 11) + 1.0) / 9007199254740993.0;
+	double v = (Random() >> 11) / 9007199254740992.0;
+	return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+int16_t Clip(double value)
+{
+	if (value > 32767.0) return 32767;
+	if (value < -32768.0) return -32768;
+	return (int16_t)lrint(value);
+}
+
+/*
+ * A capture of count packets, each after a gap of 2000-6000 samples of noise,
+ * at 2 samples per symbol and a deviation of 8000, from devices with DC
+ * offsets up to offset. Returns NULL if it can't be allocated.
+ */
+int16_t *Synthesize(uint64_t packets, unsigned devices, double noise,
+		double offset, uint64_t *count)
+{
+	const int length = ADDRESS_LENGTH + PAYLOAD_LENGTH;
+	const uint64_t max_packet = (1 + length + 2) * 16;
+	int16_t *samples = malloc((6000 + max_packet) * packets * sizeof(int16_t) +
+			6000 * sizeof(int16_t));
+	uint64_t n = 0, p;
+	uint8_t bytes[1 + ADDRESS_LENGTH + PAYLOAD_LENGTH + 2];
+	uint8_t addresses[256][ADDRESS_LENGTH];
+	double offsets[256];
+	uint16_t crc;
+	unsigned device;
+	int i, b, gap;
+
+	if (!samples) return NULL;
+
+	for (device = 0; device < devices; ++device) {
+		for (i = 0; i < ADDRESS_LENGTH; ++i) {
+			addresses[device][i] = (uint8_t)Random();
+		}
+		offsets[device] = offset * ((Random() >> 11) / 4503599627370496.0 - 1.0);
+	}
+
+	for (p = 0; p <= packets; ++p) {
+		for (gap = 2000 + (int)(Random() % 4000); gap > 0; --gap) {
+			samples[n++] = (int16_t)Random();
+		}
+		if (p == packets) break;
+
+		device = (unsigned)(Random() % devices);
+		memcpy(bytes + 1, addresses[device], ADDRESS_LENGTH);
+		for (i = 1 + ADDRESS_LENGTH; i <= length; ++i) {
+			bytes[i] = (uint8_t)Random();
+		}
+		// the preamble continues the alternation into the address
+		bytes[0] = bytes[1] & 0x80 ? 0xaa : 0x55;
+		crc = antsniff_crc16(bytes + 1, length);
+		bytes[length + 1] = crc >> 8;
+		bytes[length + 2] = crc & 0xff;
+
+		for (i = 0; i < length + 3; ++i) {
+			for (b = 7; b >= 0; --b) {
+				double level = (bytes[i] >> b & 1 ? 8000.0 : -8000.0) +
+					offsets[device];
+				samples[n++] = Clip(level + noise * Gaussian());
+				samples[n++] = Clip(level + noise * Gaussian());
+			}
+		}
+	}
+
+	*count = n;
+	return samples;
+}
+
+/* The samples of a capture, demodulated; NULL if it can't be read */
+const int16_t *LoadCapture(const char *path, const char *format,
+		uint64_t *count)
+{
+	static CaptureFile capture;
+	CaptureFormat f = format ? capture_format(format) : CAPTURE_UNKNOWN;
+	int16_t *samples;
+	uint64_t pos;
+
+	if (format && f == CAPTURE_UNKNOWN) return NULL;
+	if (capture_open(&capture, path, f) < 0) return NULL;
+
+	*count = capture.samples;
+	if (capture.format == CAPTURE_S16) {
+		return (const int16_t *)capture_at(&capture, 0);
+	}
+
+	samples = malloc(capture.samples * sizeof(int16_t));
+	if (!samples) return NULL;
+	for (pos = 0; pos < capture.samples; pos += CHUNK_SIZE) {
+		size_t n = capture.samples - pos < CHUNK_SIZE ?
+			(size_t)(capture.samples - pos) : CHUNK_SIZE;
+		capture_demod(&capture, pos, n, samples + pos);
+	}
+	capture_close(&capture);
+	return samples;
+}
+
+uint64_t ThreadCpuNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Decode the whole capture with the settings of r */
+void Decode(const Sweep *sweep, SweepResult *r)
+{
+	antsniff_decoder *decoder = antsniff_decoder_new_params(ADDRESS_LENGTH,
+			PAYLOAD_LENGTH, &r->params);
+	uint64_t pos, start;
+
+	if (!decoder) return;
+
+	start = ThreadCpuNs();
+	for (pos = 0; pos < sweep->count; pos += CHUNK_SIZE) {
+		size_t n = sweep->count - pos < CHUNK_SIZE ?
+			(size_t)(sweep->count - pos) : CHUNK_SIZE;
+		r->packets += antsniff_decoder_feed(decoder, sweep->samples + pos, n,
+				NULL, NULL);
+	}
+	r->ns_per_sample = (double)(ThreadCpuNs() - start) / sweep->count;
+	r->reacquired = antsniff_decoder_reacquired(decoder);
+	r->false_preambles = antsniff_decoder_false_preambles(decoder);
+	r->valid = true;
+
+	antsniff_decoder_free(decoder);
+}
+
+void *Worker(void *arg)
+{
+	Sweep *sweep = arg;
+	size_t i;
+
+	for (;;) {
+		pthread_mutex_lock(&sweep->lock);
+		i = sweep->next++;
+		pthread_mutex_unlock(&sweep->lock);
+		if (i >= sweep->total) return NULL;
+
+		Decode(sweep, &sweep->results[i]);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t values[SETTINGS][MAX_VALUES];
+	size_t counts[SETTINGS], index[SETTINGS];
+	const char *options = "wstkKrd";
+	antsniff_decoder_params defaults;
+	Sweep sweep;
+	pthread_t *threads;
+	long threads_count = sysconf(_SC_NPROCESSORS_ONLN);
+	const char *format = NULL;
+	uint64_t synthetic = 0;
+	unsigned devices = 8;
+	double noise = 2000.0, offset = 4000.0;
+	bool optfail = false;
+	size_t i, j;
+	int opt;
+
+	antsniff_decoder_params_init(&defaults);
+	values[0][0] = defaults.threshold_window;
+	values[1][0] = (uint32_t)defaults.saturation;
+	values[2][0] = defaults.transitions;
+	values[3][0] = defaults.initial_skip;
+	values[4][0] = defaults.packet_skip;
+	values[5][0] = defaults.ring_size;
+	values[6][0] = defaults.known_devices;
+	for (i = 0; i < SETTINGS; ++i) counts[i] = 1;
+
+	while ((opt = getopt(argc, argv, "j:w:s:t:k:K:r:d:f:S:A:N:D:")) != -1) {
+		const char *setting = strchr(options, opt);
+		if (setting) {
+			i = (size_t)(setting - options);
+			counts[i] = ParseList(optarg, values[i]);
+			if (counts[i] == 0) optfail = true;
+			continue;
+		}
+		switch (opt) {
+			case 'j': threads_count = atol(optarg); break;
+			case 'f': format = optarg; break;
+			case 'S': synthetic = strtoull(optarg, NULL, 0); break;
+			case 'A': devices = (unsigned)atoi(optarg); break;
+			case 'N': noise = atof(optarg); break;
+			case 'D': offset = atof(optarg); break;
+			default: optfail = true; break;
+		}
+	}
+	if (optfail || threads_count < 1 || devices < 1 || devices > 256 ||
+			optind != argc - (synthetic ? 0 : 1)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (synthetic) {
+		sweep.samples = Synthesize(synthetic, devices, noise, offset,
+				&sweep.count);
+		if (!sweep.samples) {
+			fprintf(stderr, "Could not allocate the synthetic capture\n");
+			return 1;
+		}
+		fprintf(stderr, "Synthesized %" PRIu64 " packets of %u devices\n",
+				synthetic, devices);
+	} else {
+		sweep.samples = LoadCapture(argv[optind], format, &sweep.count);
+		if (!sweep.samples) {
+			fprintf(stderr, "Could not read capture %s\n", argv[optind]);
+			return 1;
+		}
+	}
+	if (sweep.count == 0) {
+		fprintf(stderr, "The capture is empty\n");
+		return 1;
+	}
+
+	// every combination, the last setting varying fastest
+	sweep.total = 1;
+	for (i = 0; i < SETTINGS; ++i) sweep.total *= counts[i];
+	sweep.results = calloc(sweep.total, sizeof(SweepResult));
+	if (!sweep.results) {
+		fprintf(stderr, "Too many combinations\n");
+		return 1;
+	}
+	for (i = 0; i < sweep.total; ++i) {
+		antsniff_decoder_params *p = &sweep.results[i].params;
+		size_t rest = i;
+		for (j = SETTINGS; j-- > 0;) {
+			index[j] = rest % counts[j];
+			rest /= counts[j];
+		}
+		*p = defaults;
+		p->threshold_window = values[0][index[0]];
+		p->saturation = (int32_t)values[1][index[1]];
+		p->transitions = values[2][index[2]];
+		p->initial_skip = values[3][index[3]];
+		p->packet_skip = values[4][index[4]];
+		p->ring_size = values[5][index[5]];
+		p->known_devices = values[6][index[6]];
+	}
+
+	if ((size_t)threads_count > sweep.total) threads_count = (long)sweep.total;
+	fprintf(stderr, "Sweeping %zu settings over %" PRIu64 " samples on %ld "
+			"threads\n", sweep.total, sweep.count, threads_count);
+
+	sweep.next = 0;
+	pthread_mutex_init(&sweep.lock, NULL);
+	threads = calloc((size_t)threads_count, sizeof(pthread_t));
+	for (i = 0; i < (size_t)threads_count; ++i) {
+		if (pthread_create(&threads[i], NULL, Worker, &sweep) != 0) {
+			fprintf(stderr, "Could not start thread %zu\n", i);
+			return 1;
+		}
+	}
+	for (i = 0; i < (size_t)threads_count; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+
+	printf("threshold_window,saturation,transitions,initial_skip,packet_skip,"
+			"ring_size,known_devices,packets,reacquired,false_preambles,"
+			"false_per_msample,"
+			"ns_per_sample\n");
+	for (i = 0; i < sweep.total; ++i) {
+		const SweepResult *r = &sweep.results[i];
+		const antsniff_decoder_params *p = &r->params;
+		printf("%u,%d,%u,%u,%u,%u,%u,", p->threshold_window, p->saturation,
+				p->transitions, p->initial_skip, p->packet_skip, p->ring_size,
+				p->known_devices);
+		if (!r->valid) {
+			// e.g. a ring too short for a packet
+			printf("invalid,,,,\n");
+			continue;
+		}
+		printf("%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.2f,%.2f\n", r->packets,
+				r->reacquired, r->false_preambles, r->false_preambles * 1e6 / sweep.count,
+				r->ns_per_sample);
+	}
+
+	return 0;
+}
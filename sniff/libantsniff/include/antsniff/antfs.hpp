@@ -0,0 +1,477 @@
+#pragma once
+#include "antsniff.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+namespace antsniff {
+
+/*
+ * ANT-FS parser
+ *
+ * Parses the payload of a ShockBurst packet (two bytes of ANT header, then the
+ * 8 byte ANT message) into an antsniff_antfs_message. Nothing is allocated:
+ * strings are literals, and "unknown" messages point into the payload.
+ */
+class ANTFSParser
+{
+public:
+	static bool parse(const uint8_t *data, size_t length,
+			antsniff_antfs_message &msg)
+	{
+		msg.type = "unknown";
+		msg.field_count = 0;
+		msg.trigger = 0;
+		msg.action = ANTSNIFF_ACTION_NONE;
+		msg.link_frequency = 0;
+
+		if (length < 10) {
+			addBytes(msg, "data", data, length);
+			return false;
+		}
+
+		switch (data[2]) {
+			case 0x43:
+				parseBeacon(data, msg);
+				return true;
+			case 0x44:
+				parseCommandResponse(data, msg);
+				return true;
+			default:
+				addBytes(msg, "data", data, length);
+				return false;
+		}
+	}
+
+	static const char *periodString(uint8_t period)
+	{
+		switch (period) {
+			case 0: return "0.5 Hz (65535)";
+			case 1: return "1 Hz (32768)";
+			case 2: return "2 Hz (16384)";
+			case 3: return "4 Hz (8192)";
+			case 4: return "8 Hz (4096)";
+			case 7: return "match established";
+			default: return "reserved";
+		}
+	}
+
+private:
+	static uint16_t makeWord(const uint8_t *data, size_t start)
+	{
+		return data[start + 1] << 8 | data[start];
+	}
+
+	static uint32_t makeDword(const uint8_t *data, size_t start)
+	{
+		return uint32_t(data[start + 3]) << 24 | data[start + 2] << 16 |
+			data[start + 1] << 8 | data[start];
+	}
+
+	static antsniff_field &add(antsniff_antfs_message &msg, const char *name,
+			antsniff_field_kind kind)
+	{
+		antsniff_field &f = msg.fields[msg.field_count++];
+		f.name = name;
+		f.kind = kind;
+		f.number = 0;
+		f.string = nullptr;
+		f.bytes = nullptr;
+		f.length = 0;
+		return f;
+	}
+
+	static void addNumber(antsniff_antfs_message &msg, const char *name,
+			antsniff_field_kind kind, uint32_t number)
+	{
+		add(msg, name, kind).number = number;
+	}
+
+	static void addString(antsniff_antfs_message &msg, const char *name,
+			const char *string)
+	{
+		add(msg, name, ANTSNIFF_FIELD_STRING).string = string;
+	}
+
+	static void addBytes(antsniff_antfs_message &msg, const char *name,
+			const uint8_t *bytes, size_t length)
+	{
+		antsniff_field &f = add(msg, name, ANTSNIFF_FIELD_BYTES);
+		f.bytes = bytes;
+		f.length = length;
+	}
+
+	static void parseCommandResponse(const uint8_t *data,
+			antsniff_antfs_message &msg)
+	{
+		switch(data[3]) {
+			// ANTFS Commands
+			case 0x02: parseLinkCommand(data, msg); break;
+			case 0x03: parseDisconnectCommand(data, msg); break;
+			case 0x04: parseAuthCommand(data, msg); break;
+			case 0x05: msg.type = "ping command"; break;
+			case 0x09: parseDownloadReqCommand1(data, msg); break;
+			case 0x0a: parseUploadReqCommand1(data, msg); break;
+			case 0x0b: parseEraseReqCommand(data, msg); break;
+			case 0x0c: parseUploadDataCommand(data, msg); break;
+			// ANTFS Responses
+			case 0x84: parseAuthResponse(data, msg); break;
+			case 0x89: parseDownloadReqResp2(data, msg); break;
+			case 0x8a: parseUploadReqResp2(data, msg); break;
+			case 0x8b: parseEraseResp2(data, msg); break;
+			case 0x8c: parseUploadDataResp2(data, msg); break;
+			// None of the known commands/responses
+			default:
+				msg.type = "unknown command/response";
+				addBytes(msg, "data", data, 10);
+				break;
+		}
+	}
+
+	/*
+	 * ANT-FS Beacon
+	 */
+	static void parseBeacon(const uint8_t *data, antsniff_antfs_message &msg)
+	{
+		msg.type = "client beaecon";
+
+		uint8_t status1 = data[3];
+		addString(msg, "data", status1 & (1 << 5) ? "true" : "false");
+		addString(msg, "upload", status1 & (1 << 4) ? "true" : "false");
+		addString(msg, "pairing", status1 & (1 << 3) ? "true" : "false");
+		addString(msg, "period", periodString(status1 & 7));
+
+		const char *state;
+		switch (data[4] & 0x0f) {
+			case 0:
+				state = "link";
+				addNumber(msg, "device_type", ANTSNIFF_FIELD_U16, makeWord(data, 6));
+				addNumber(msg, "manufacturer", ANTSNIFF_FIELD_U16, makeWord(data, 8));
+				break;
+			case 1:
+				state = "auth";
+				addNumber(msg, "host_serial", ANTSNIFF_FIELD_U32, makeDword(data, 6));
+				break;
+			case 2:
+				state = "transport";
+				addNumber(msg, "host_serial", ANTSNIFF_FIELD_U32, makeDword(data, 6));
+				break;
+			case 3: state = "busy"; break;
+			default: state = "reserved"; break;
+		}
+		addString(msg, "state", state);
+
+		const char *auth;
+		switch (data[5]) {
+			case 0: auth = "pass-through"; break;
+			case 1: auth = "n/a"; break;
+			case 2: auth = "pairing"; break;
+			case 3: auth = "passkey & pairing"; break;
+			default: auth = "reserved"; break;
+		}
+		addString(msg, "auth_type", auth);
+	}
+
+	/*
+	 * ANT-FS Commands
+	 */
+	static void parseLinkCommand(const uint8_t *data, antsniff_antfs_message &msg)
+	{
+		msg.type = "link command";
+		msg.trigger = 1;
+		addNumber(msg, "frequency", ANTSNIFF_FIELD_U8, data[4]);
+		addString(msg, "period", periodString(data[5]));
+		addNumber(msg, "host_serial", ANTSNIFF_FIELD_U32, makeDword(data, 6));
+
+		// From ANT_File_Share_Technology.pdf: The host may use the Link command
+		// to specify a different channel period or RF frequency for subsequent
+		// interactions.
+		msg.action = ANTSNIFF_ACTION_FOLLOW;
+		msg.link_frequency = data[4];
+	}
+
+	static void parseDisconnectCommand(const uint8_t *data,
+			antsniff_antfs_message &msg)
+	{
+		msg.type = "disconnect command";
+
+		const char *type;
+		if (data[4] == 0) type = "return to link";
+		else if (data[4] == 1) type = "return to broadcast";
+		else if (data[4] <= 127) type = "reserved";
+		else type = "device specific";
+		addString(msg, "disconnect_type", type);
+
+		addNumber(msg, "time_duration", ANTSNIFF_FIELD_U8, data[5]);
+		addNumber(msg, "application_duration", ANTSNIFF_FIELD_U8, data[6]);
+
+		// Connection state returns to Link layer, thus frequency changes back
+		// to the initial Beacon Channel frequency.
+		msg.action = ANTSNIFF_ACTION_RETURN;
+	}
+
+	static void parseAuthCommand(const uint8_t *data, antsniff_antfs_message &msg)
+	{
+		msg.type = "auth command";
+		msg.trigger = 1;
+
+		const char *type;
+		switch (data[4]) {
+			case 0: type = "pass-through"; break;
+			case 1: type = "request serial"; break;
+			case 2: type = "request pairing"; break;
+			case 3: type = "request passkey"; break;
+			default: type = "EINVAL"; break;
+		}
+		addString(msg, "auth_type", type);
+
+		addNumber(msg, "auth_string_length", ANTSNIFF_FIELD_U8, data[5]);
+		addNumber(msg, "host_serial", ANTSNIFF_FIELD_U32, makeDword(data, 6));
+	}
+
+	//TODO: 2-packet burst
+	static void parseDownloadReqCommand1(const uint8_t *data,
+			antsniff_antfs_message &msg)
+	{
+		msg.type = "download request command";
+		msg.trigger = 1;
+		addNumber(msg, "index", ANTSNIFF_FIELD_U16, makeWord(data, 4));
+		addNumber(msg, "offset", ANTSNIFF_FIELD_U32, makeDword(data, 6));
+	}
+
+	//TODO: 2-packet burst
+	static void parseUploadReqCommand1(const uint8_t *data,
+			antsniff_antfs_message &msg)
+	{
+		msg.type = "upload request command";
+		msg.trigger = 1;
+		addNumber(msg, "index", ANTSNIFF_FIELD_U16, makeWord(data, 4));
+		addNumber(msg, "max_size", ANTSNIFF_FIELD_U32, makeDword(data, 6));
+	}
+
+	//TODO: 2+n-packet burst
+	static void parseUploadDataCommand(const uint8_t *data,
+			antsniff_antfs_message &msg)
+	{
+		msg.type = "upload data command";
+		addNumber(msg, "crc_seed", ANTSNIFF_FIELD_U16, makeWord(data, 4));
+		addNumber(msg, "offset", ANTSNIFF_FIELD_U32, makeDword(data, 6));
+	}
+
+	static void parseEraseReqCommand(const uint8_t *data,
+			antsniff_antfs_message &msg)
+	{
+		msg.type = "erase request command";
+		msg.trigger = 1;
+		addNumber(msg, "index", ANTSNIFF_FIELD_U16, makeWord(data, 4));
+	}
+
+	/*
+	 * ANT-FS Responses
+	 */
+	static void parseAuthResponse(const uint8_t *data,
+			antsniff_antfs_message &msg)
+	{
+		msg.type = "auth response";
+
+		const char *response;
+		switch (data[4]) {
+			case 0: response = "response to serial req."; break;
+			case 1: response = "accept"; break;
+			case 2: response = "reject"; break;
+			default: response = "EINVAL";
+		}
+		addString(msg, "response", response);
+
+		addNumber(msg, "auth_string_length", ANTSNIFF_FIELD_U8, data[5]);
+		addNumber(msg, "client_serial", ANTSNIFF_FIELD_U32, makeDword(data, 6));
+	}
+
+	//TODO: 3+n-packet burst
+	static void parseDownloadReqResp2(const uint8_t *data,
+			antsniff_antfs_message &msg)
+	{
+		msg.type = "download request response";
+
+		const char *response;
+		switch (data[4]) {
+			case 0: response = "ANTFS_OK"; break;
+			case 1: response = "ANTFS_ENOENT"; break;
+			case 2: response = "ANTFS_EACCESS"; break;
+			case 3: response = "ANTFS_ENOTREADY"; break;
+			case 4: response = "ANTFS_EINVAL"; break;
+			case 5: response = "ANTFS_ECRC"; break;
+			default: response = "EINVAL";
+		}
+		addString(msg, "response", response);
+
+		addNumber(msg, "remaining", ANTSNIFF_FIELD_U32, makeDword(data, 6));
+	}
+
+	//TODO: 4-packet burst
+	static void parseUploadReqResp2(const uint8_t *data,
+			antsniff_antfs_message &msg)
+	{
+		msg.type = "upload request response";
+
+		const char *response;
+		switch (data[4]) {
+			case 0: response = "ANTFS_OK"; break;
+			case 1: response = "ANTFS_ENOENT"; break;
+			case 2: response = "ANTFS_EACCESS"; break;
+			case 3: response = "ANTFS_ENOSPC"; break;
+			case 4: response = "ANTFS_EINVAL"; break;
+			case 5: response = "ANTFS_ENOTREADY"; break;
+			default: response = "EINVAL";
+		}
+		addString(msg, "response", response);
+
+		addNumber(msg, "last_offset", ANTSNIFF_FIELD_U32, makeDword(data, 6));
+	}
+
+	//TODO: 2-packet burst
+	static void parseUploadDataResp2(const uint8_t *data,
+			antsniff_antfs_message &msg)
+	{
+		msg.type = "upload data response";
+		addString(msg, "response", data[4] ? "true" : "false");
+	}
+
+	//TODO: 2-packet burst
+	static void parseEraseResp2(const uint8_t *data, antsniff_antfs_message &msg)
+	{
+		msg.type = "erase response";
+
+		const char *response;
+		switch (data[4]) {
+			case 0: response = "OK"; break;
+			case 1: response = "FAILED"; break;
+			case 2: response = "ENOTREADY"; break;
+			default: response = "EINVAL";
+		}
+		addString(msg, "response", response);
+	}
+};
+
+/*
+ * Per-device beacon state, for emitting beacons only when they change.
+ *
+ * ANT-FS clients beacon at up to 8 Hz, and most beacons repeat the previous
+ * one. The filter keeps the raw beacon bytes (status 1, status 2, auth type
+ * and the device type/manufacturer or host serial) of each device, so an
+ * unchanged beacon is recognized by a 7 byte compare, before any parsing.
+ * Suppressed beacons are counted, and the counts are handed out as periodic
+ * summaries. Devices that stop beaconing are forgotten after a while, so
+ * the filter doesn't grow with every device that ever passed by.
+ */
+class BeaconFilter
+{
+public:
+	/*
+	 * Record a beacon (a payload with data[2] == 0x43) of address. Returns
+	 * true if it's the device's first beacon, or differs from the last one.
+	 */
+	bool changed(uint64_t address, const uint8_t *data, uint64_t sample)
+	{
+		auto it = _devices.find(address);
+		if (it == _devices.end()) {
+			State &state = _devices[address];
+			std::memcpy(state.beacon, data + 3, sizeof(state.beacon));
+			state.summarySample = sample;
+			state.lastSample = sample;
+			state.suppressed = 0;
+			return true;
+		}
+
+		State &state = it->second;
+		state.lastSample = sample;
+		if (std::memcmp(state.beacon, data + 3, sizeof(state.beacon)) != 0) {
+			std::memcpy(state.beacon, data + 3, sizeof(state.beacon));
+			return true;
+		}
+
+		++state.suppressed;
+		return false;
+	}
+
+	/*
+	 * The number of beacons of address suppressed since its last summary, if
+	 * there were any and the last summary is at least period samples old;
+	 * otherwise 0. The count restarts when it's taken.
+	 */
+	uint32_t takeSummary(uint64_t address, uint64_t sample, uint64_t period)
+	{
+		auto it = _devices.find(address);
+		if (it == _devices.end()) return 0;
+
+		State &state = it->second;
+		if (state.suppressed == 0 || sample < state.summarySample + period) {
+			return 0;
+		}
+
+		uint32_t suppressed = state.suppressed;
+		state.suppressed = 0;
+		state.summarySample = sample;
+		return suppressed;
+	}
+
+	/*
+	 * Hand out the due summaries of all devices, calling fn(address, sample
+	 * of its latest beacon, suppressed) for each, as takeSummary() does for
+	 * the device of a beacon; a device that has gone quiet would otherwise
+	 * never have its count taken. Devices not heard from for idle samples
+	 * are forgotten, after their last count is handed out.
+	 */
+	template <typename Fn>
+	void sweep(uint64_t sample, uint64_t period, uint64_t idle, Fn fn)
+	{
+		for (auto it = _devices.begin(); it != _devices.end();) {
+			State &state = it->second;
+			bool gone = sample >= state.lastSample &&
+				sample - state.lastSample >= idle;
+			if (state.suppressed > 0 && (gone ||
+						sample >= state.summarySample + period)) {
+				fn(it->first, state.lastSample, state.suppressed);
+				state.suppressed = 0;
+				state.summarySample = sample;
+			}
+
+			if (gone) it = _devices.erase(it);
+			else ++it;
+		}
+	}
+
+	/* Hand out all pending counts, as sweep() does, and forget all devices */
+	template <typename Fn>
+	void flush(Fn fn)
+	{
+		for (const auto &device : _devices) {
+			if (device.second.suppressed == 0) continue;
+			fn(device.first, device.second.lastSample, device.second.suppressed);
+		}
+		_devices.clear();
+	}
+
+	size_t devices(void) const
+	{
+		return _devices.size();
+	}
+
+	void clear(void)
+	{
+		_devices.clear();
+	}
+
+private:
+	struct State {
+		uint8_t beacon[7];
+		uint64_t summarySample;
+		uint64_t lastSample;	// of the latest beacon
+		uint32_t suppressed;
+	};
+
+	std::unordered_map<uint64_t, State> _devices;
+};
+
+} // namespace antsniff
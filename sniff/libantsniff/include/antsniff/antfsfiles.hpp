@@ -0,0 +1,498 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace antsniff {
+
+/* The CRC-16 of ANT-FS (and FIT files), continuing from crc */
+inline uint16_t antfsCrc(uint16_t crc, const uint8_t *data, size_t length)
+{
+	static const uint16_t table[16] = {
+		0x0000, 0xcc01, 0xd801, 0x1400, 0xf001, 0x3c00, 0x2800, 0xe401,
+		0xa001, 0x6c00, 0x7800, 0xb401, 0x5000, 0x9c01, 0x8801, 0x4400
+	};
+
+	for (size_t i = 0; i < length; ++i) {
+		uint16_t tmp = table[crc & 0xf];
+		crc = ((crc >> 4) & 0x0fff) ^ tmp ^ table[data[i] & 0xf];
+		tmp = table[crc & 0xf];
+		crc = ((crc >> 4) & 0x0fff) ^ tmp ^ table[data[i] >> 4];
+	}
+	return crc;
+}
+
+/* An entry of a device's ANT-FS directory (the file at index 0) */
+struct ANTFSDirectoryEntry
+{
+	uint64_t address;
+	uint16_t index;
+	uint8_t dataType;	// 0x80: FIT
+	uint32_t identifier;	// 3 bytes, the FIT file type etc.
+	uint8_t typeFlags;
+	uint8_t flags;	// read, write, erase, archive, append, crypto
+	uint32_t size;
+	uint32_t timestamp;	// seconds since 1989-12-31 00:00 UTC
+};
+
+/* A block of a file, as sent in one download response */
+struct ANTFSFileBlock
+{
+	uint64_t address;
+	uint16_t index;
+	const char *path;
+	uint32_t offset;
+	uint32_t length;	// bytes received
+	uint32_t fileSize;
+	const char *status;	// "ok", "crc mismatch", "unverified", "incomplete"
+	bool complete;	// the whole file is on disk, with every block verified
+	uint32_t retransmissions;
+	uint64_t sample;	// of the download response
+};
+
+/*
+ * ANT-FS file extractor
+ *
+ * Follows the download requests and responses of the devices it hears, and
+ * writes the downloaded data to <directory>/<address>/<index>.<type>. Each
+ * response is a burst of 8 byte packets:
+ *
+ *   beacon | 0x44 0x89 response, remaining | offset, file size |
+ *   data ... | reserved (6), CRC (2)
+ *
+ * The first response to a download request tells the file's size, so the
+ * file is preallocated right away, and every data block is written at its
+ * offset (pwrite), no matter in which order the blocks come or if the host
+ * resumes a download later. The CRC in the last packet covers the file from
+ * offset 0 to the end of the block, seeded by the host in its request, so it
+ * is checked incrementally while the data arrives: a block continuing a
+ * verified chain from offset 0 is verified without reading anything back. A
+ * block starting elsewhere is verified if the request carrying its seed was
+ * received; otherwise it is "unverified".
+ *
+ * Burst packets are told apart by the second byte of the ShockBurst payload,
+ * as seen in antfs2-annotated.txt: bit 6 is the direction (the host's packets
+ * have it set, the client's don't), and bit 4 alternates between consecutive
+ * packets of a side, so retransmissions (which repeat it) are skipped. A
+ * packet lost for good shifts the rest of the block, which the CRC then
+ * catches; a burst that stops for a second is reported "incomplete".
+ *
+ * Directory entries (file index 0) are parsed as the directory streams in.
+ *
+ * Memory is bounded: each device in a transfer has a fixed state and a
+ * BUFFER_SIZE write buffer, whatever the file sizes, and at most
+ * maxTransfers devices are followed; the least recently heard one is dropped
+ * (and its files closed) to make room for another.
+ */
+class ANTFSExtractor
+{
+public:
+	static const size_t BUFFER_SIZE = 4096;
+	static const uint64_t TIMEOUT = 2000000;	// samples, 1 s at 2 Msps
+	static const size_t MAX_TYPES = 1024;	// directory entries remembered
+
+	ANTFSExtractor(const std::string &directory, size_t maxTransfers):
+		_directory(directory),
+		_maxTransfers(maxTransfers ? maxTransfers : 1),
+		_bytesWritten(0),
+		_writeErrors(0)
+	{ }
+
+	~ANTFSExtractor(void)
+	{
+		for (auto &it : _devices) closeFile(it.second);
+	}
+
+	ANTFSExtractor(const ANTFSExtractor &) = delete;
+	ANTFSExtractor &operator=(const ANTFSExtractor &) = delete;
+
+	/*
+	 * Feed a ShockBurst payload (2 byte header and an 8 byte ANT message) of
+	 * address. onBlock(const ANTFSFileBlock &) is called at the end of every
+	 * response, onEntry(const ANTFSDirectoryEntry &) for directory entries.
+	 */
+	template <typename BlockFn, typename EntryFn>
+	void feed(uint64_t address, const uint8_t *data, size_t length,
+			uint64_t sample, BlockFn onBlock, EntryFn onEntry)
+	{
+		if (length < 10) return;
+
+		auto it = _devices.find(address);
+		if (it == _devices.end()) {
+			// only downloads make a device worth following
+			bool download = data[2] == 0x44 && (data[3] == 0x09 || data[3] == 0x89);
+			if (!download) return;
+			it = this->addDevice(address, onBlock);
+		}
+		Device &d = it->second;
+
+		if (d.state != IDLE && sample > d.lastSample + TIMEOUT) {
+			this->endBlock(d, "incomplete", onBlock);
+		}
+		d.lastSample = sample;
+
+		uint8_t direction = data[1] & 0x40;
+		uint8_t sequence = data[1] & 0x10;
+		int &last = direction ? d.hostSequence : d.clientSequence;
+		if (last == sequence) {
+			if (d.state != IDLE && direction == d.clientDirection) {
+				++d.retransmissions;
+			}
+			return;
+		}
+		last = sequence;
+
+		// a block in progress takes the client's packets in order
+		if (d.state != IDLE && direction == d.clientDirection) {
+			this->blockPacket(d, data + 2, onBlock, onEntry);
+			return;
+		}
+
+		if (d.expectSeed && direction == d.hostDirection) {
+			d.expectSeed = false;
+			if (data[2] != 0x43 && data[2] != 0x44) {
+				d.crcSeed = uint16_t(data[5] << 8 | data[4]);
+				d.haveSeed = true;
+				return;
+			}
+		}
+
+		if (data[2] != 0x44) return;
+		if (data[3] == 0x09) {
+			// download request: the seed is in its second packet
+			d.hostDirection = direction;
+			d.requestIndex = uint16_t(data[5] << 8 | data[4]);
+			d.requestOffset = dword(data + 6);
+			d.expectSeed = true;
+			d.haveSeed = false;
+		} else if (data[3] == 0x89 && data[4] == 0) {
+			// ANTFS_OK download response: offset and size come next
+			d.clientDirection = direction;
+			d.remaining = dword(data + 6);
+			d.blockSample = sample;
+			d.retransmissions = 0;
+			d.state = HEADER;
+		}
+	}
+
+	/* End every block in progress as incomplete, and close all files */
+	template <typename BlockFn>
+	void flush(BlockFn onBlock)
+	{
+		for (auto &it : _devices) {
+			if (it.second.state != IDLE) this->endBlock(it.second, "incomplete", onBlock);
+			closeFile(it.second);
+		}
+		_devices.clear();
+	}
+
+	/* End the blocks that have been silent for a second at sample */
+	template <typename BlockFn>
+	void expire(uint64_t sample, BlockFn onBlock)
+	{
+		for (auto &it : _devices) {
+			Device &d = it.second;
+			if (d.state != IDLE && sample > d.lastSample + TIMEOUT) {
+				this->endBlock(d, "incomplete", onBlock);
+			}
+		}
+	}
+
+	size_t transfers(void) const
+	{
+		return _devices.size();
+	}
+
+	uint64_t bytesWritten(void) const
+	{
+		return _bytesWritten;
+	}
+
+	uint64_t writeErrors(void) const
+	{
+		return _writeErrors;
+	}
+
+private:
+	enum State { IDLE, HEADER, DATA, FOOTER };
+
+	struct Device
+	{
+		uint64_t address;
+		uint64_t lastSample;
+
+		// the host's download request
+		uint8_t hostDirection;
+		uint16_t requestIndex;
+		uint32_t requestOffset;
+		uint16_t crcSeed;
+		bool haveSeed;
+		bool expectSeed;
+
+		// the client's response in progress
+		uint8_t clientDirection;
+		int hostSequence;
+		int clientSequence;
+		State state;
+		uint16_t index;
+		uint32_t offset;
+		uint32_t remaining;
+		uint32_t fileSize;
+		uint32_t pos;	// file offset of the next data byte
+		uint16_t crc;
+		bool crcKnown;
+		bool chained;	// the block continues the verified chain
+		uint32_t retransmissions;
+		uint64_t blockSample;
+
+		// the open file
+		int fd;
+		uint16_t fdIndex;
+		uint32_t verifiedTo;	// bytes verified from offset 0
+		uint16_t verifiedCrc;	// their CRC
+		std::string path;
+		uint8_t buffer[BUFFER_SIZE];
+		uint32_t bufferOffset;
+		size_t bufferLength;
+
+		// the directory record being streamed in
+		uint8_t record[16];
+		size_t recordFill;
+		std::unordered_map<uint16_t, uint8_t> types;
+	};
+
+	std::string _directory;
+	size_t _maxTransfers;
+	std::unordered_map<uint64_t, Device> _devices;
+	uint64_t _bytesWritten;
+	uint64_t _writeErrors;
+
+	static uint32_t dword(const uint8_t *p)
+	{
+		return uint32_t(p[3]) << 24 | uint32_t(p[2]) << 16 |
+			uint32_t(p[1]) << 8 | p[0];
+	}
+
+	template <typename BlockFn>
+	typename std::unordered_map<uint64_t, Device>::iterator
+	addDevice(uint64_t address, BlockFn onBlock)
+	{
+		if (_devices.size() >= _maxTransfers) {
+			auto oldest = _devices.begin();
+			for (auto it = _devices.begin(); it != _devices.end(); ++it) {
+				if (it->second.lastSample < oldest->second.lastSample) oldest = it;
+			}
+			if (oldest->second.state != IDLE) {
+				this->endBlock(oldest->second, "incomplete", onBlock);
+			}
+			closeFile(oldest->second);
+			_devices.erase(oldest);
+		}
+
+		Device &d = _devices[address];
+		d.address = address;
+		d.lastSample = 0;
+		d.hostDirection = 0x40;
+		d.requestIndex = 0;
+		d.requestOffset = 0;
+		d.crcSeed = 0;
+		d.haveSeed = false;
+		d.expectSeed = false;
+		d.clientDirection = 0;
+		d.hostSequence = -1;
+		d.clientSequence = -1;
+		d.state = IDLE;
+		d.fd = -1;
+		d.fdIndex = 0;
+		d.verifiedTo = 0;
+		d.verifiedCrc = 0;
+		d.bufferLength = 0;
+		d.recordFill = 0;
+		return _devices.find(address);
+	}
+
+	/* The 8 byte message of the next packet of a response */
+	template <typename BlockFn, typename EntryFn>
+	void blockPacket(Device &d, const uint8_t *msg, BlockFn onBlock,
+			EntryFn onEntry)
+	{
+		switch (d.state) {
+			case HEADER:
+				this->startBlock(d, dword(msg), dword(msg + 4));
+				break;
+
+			case DATA: {
+				uint32_t n = d.remaining < 8 ? d.remaining : 8;
+				this->write(d, msg, n, onEntry);
+				d.remaining -= n;
+				if (d.remaining == 0) d.state = FOOTER;
+				break;
+			}
+
+			case FOOTER: {
+				uint16_t crc = uint16_t(msg[7] << 8 | msg[6]);
+				const char *status = !d.crcKnown ? "unverified" :
+					crc == d.crc ? "ok" : "crc mismatch";
+				if (d.crcKnown && crc == d.crc && d.chained) {
+					d.verifiedTo = d.pos;
+					d.verifiedCrc = d.crc;
+				}
+				this->endBlock(d, status, onBlock);
+				break;
+			}
+
+			default:
+				break;
+		}
+	}
+
+	void startBlock(Device &d, uint32_t offset, uint32_t fileSize)
+	{
+		d.index = d.requestIndex;
+		d.offset = d.pos = offset;
+		d.fileSize = fileSize;
+		d.recordFill = 0;
+		d.state = d.remaining ? DATA : FOOTER;
+
+		if (d.fd < 0 || d.fdIndex != d.index) this->openFile(d);
+
+		// the CRC chain from offset 0, or the host's seed for this offset
+		d.chained = offset == 0 || (d.fd >= 0 && offset == d.verifiedTo);
+		if (offset == 0) {
+			d.crc = 0;
+			d.crcKnown = true;
+		} else if (d.chained) {
+			d.crc = d.verifiedCrc;
+			d.crcKnown = true;
+		} else {
+			d.crc = d.crcSeed;
+			d.crcKnown = d.haveSeed && d.requestIndex == d.index &&
+				d.requestOffset == offset;
+		}
+		if (offset == 0) d.verifiedTo = 0;
+	}
+
+	template <typename EntryFn>
+	void write(Device &d, const uint8_t *data, uint32_t n, EntryFn onEntry)
+	{
+		d.crc = antfsCrc(d.crc, data, n);
+
+		if (d.fd >= 0) {
+			if (d.bufferLength + n > BUFFER_SIZE ||
+					d.bufferOffset + d.bufferLength != d.pos) {
+				this->flushBuffer(d);
+			}
+			if (d.bufferLength == 0) d.bufferOffset = d.pos;
+			std::memcpy(d.buffer + d.bufferLength, data, n);
+			d.bufferLength += n;
+		}
+
+		if (d.index == 0) {
+			for (uint32_t i = 0; i < n; ++i) {
+				this->directoryByte(d, d.pos + i, data[i], onEntry);
+			}
+		}
+		d.pos += n;
+	}
+
+	template <typename EntryFn>
+	void directoryByte(Device &d, uint32_t pos, uint8_t byte, EntryFn onEntry)
+	{
+		// the 16 byte header, then 16 byte entries
+		if (pos % 16 == 0) d.recordFill = 0;
+		d.record[pos % 16] = byte;
+		if (++d.recordFill < 16 || pos < 16) return;
+
+		ANTFSDirectoryEntry e;
+		const uint8_t *r = d.record;
+		e.address = d.address;
+		e.index = uint16_t(r[1] << 8 | r[0]);
+		e.dataType = r[2];
+		e.identifier = uint32_t(r[5]) << 16 | uint32_t(r[4]) << 8 | r[3];
+		e.typeFlags = r[6];
+		e.flags = r[7];
+		e.size = dword(r + 8);
+		e.timestamp = dword(r + 12);
+		if (d.types.size() < MAX_TYPES || d.types.count(e.index)) {
+			d.types[e.index] = e.dataType;
+		}
+		onEntry(e);
+	}
+
+	template <typename BlockFn>
+	void endBlock(Device &d, const char *status, BlockFn onBlock)
+	{
+		this->flushBuffer(d);
+
+		ANTFSFileBlock b;
+		b.address = d.address;
+		b.index = d.index;
+		b.path = d.path.c_str();
+		b.offset = d.offset;
+		b.length = d.pos - d.offset;
+		b.fileSize = d.fileSize;
+		b.status = status;
+		b.complete = d.fd >= 0 && d.verifiedTo >= d.fileSize;
+		b.retransmissions = d.retransmissions;
+		b.sample = d.blockSample;
+		d.state = IDLE;
+		onBlock(b);
+	}
+
+	void openFile(Device &d)
+	{
+		closeFile(d);
+
+		char name[64];
+		std::snprintf(name, sizeof(name), "/%010llx",
+				(unsigned long long)d.address);
+		std::string dir = _directory + name;
+		mkdir(_directory.c_str(), 0755);
+		mkdir(dir.c_str(), 0755);
+
+		auto type = d.types.find(d.index);
+		const char *ext = d.index == 0 ? "directory" :
+			type != d.types.end() && type->second == 0x80 ? "fit" : "bin";
+		std::snprintf(name, sizeof(name), "/%u.%s", unsigned(d.index), ext);
+		d.path = dir + name;
+
+		d.fd = open(d.path.c_str(), O_WRONLY | O_CREAT, 0644);
+		d.fdIndex = d.index;
+		d.verifiedTo = 0;
+		d.verifiedCrc = 0;
+		d.bufferLength = 0;
+		if (d.fd < 0) {
+			++_writeErrors;
+			return;
+		}
+
+		// the whole file at once, so blocks land in place and never fragment
+		if (d.fileSize > 0) posix_fallocate(d.fd, 0, off_t(d.fileSize));
+	}
+
+	void flushBuffer(Device &d)
+	{
+		if (d.fd < 0 || d.bufferLength == 0) return;
+
+		ssize_t n = pwrite(d.fd, d.buffer, d.bufferLength, off_t(d.bufferOffset));
+		if (n == ssize_t(d.bufferLength)) _bytesWritten += uint64_t(n);
+		else ++_writeErrors;
+		d.bufferLength = 0;
+	}
+
+	void closeFile(Device &d)
+	{
+		if (d.fd < 0) return;
+		this->flushBuffer(d);
+		close(d.fd);
+		d.fd = -1;
+	}
+};
+
+} // namespace antsniff
@@ -0,0 +1,215 @@
+#ifndef ANTSNIFF_H
+#define ANTSNIFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * libantsniff C API
+ *
+ * A stable, Pothos-free interface to the ShockBurst decoder and the ANT-FS
+ * parser, used by the shockburst CLI and usable from any C program. C++ code
+ * can use the header-only classes in shockburst.hpp and antfs.hpp directly;
+ * they share the structures defined here.
+ *
+ * The API version is bumped on every incompatible change. Structures only
+ * ever get fields appended: callers built against an older header still read
+ * the ones the library fills in (antsniff_packet) in place, and the ones
+ * callers fill in (antsniff_decoder_params) carry their size.
+ */
+
+#define ANTSNIFF_API_VERSION 5
+
+#define ANTSNIFF_MAX_ADDRESS 5
+#define ANTSNIFF_MAX_PAYLOAD 32
+#define ANTSNIFF_MAX_FIELDS 8
+
+#if defined(_WIN32)
+	#define ANTSNIFF_API
+#else
+	#define ANTSNIFF_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A decoded ShockBurst packet.
+ *
+ * "sample" is the absolute index of the input sample the packet was found at,
+ * "threshold" the slicer level it was decoded with. The address is stored
+ * as a number (first byte on air is the most significant), the payload as it
+ * was transmitted. "margin" (since API version 2) is the mean distance of
+ * the sliced symbols from the threshold: a signal quality metric, higher is
+ * better.
+ */
+typedef struct antsniff_packet {
+	uint64_t sample;
+	uint64_t address;
+	int32_t threshold;
+	uint16_t crc;
+	uint8_t address_length;
+	uint8_t payload_length;
+	uint8_t payload[ANTSNIFF_MAX_PAYLOAD];
+	int32_t margin;
+} antsniff_packet;
+
+/*
+ * A parsed ANT-FS message: the message type, and its fields in the order the
+ * Pothos ANT-FS decoder and anteater.py report them. Strings point to static
+ * storage, bytes into the payload that was parsed.
+ */
+typedef enum antsniff_field_kind {
+	ANTSNIFF_FIELD_U8,
+	ANTSNIFF_FIELD_U16,
+	ANTSNIFF_FIELD_U32,
+	ANTSNIFF_FIELD_STRING,
+	ANTSNIFF_FIELD_BYTES
+} antsniff_field_kind;
+
+typedef struct antsniff_field {
+	const char *name;
+	antsniff_field_kind kind;
+	uint32_t number;
+	const char *string;
+	const uint8_t *bytes;
+	size_t length;
+} antsniff_field;
+
+typedef enum antsniff_antfs_action {
+	ANTSNIFF_ACTION_NONE,
+	ANTSNIFF_ACTION_FOLLOW,	// link command: move to link_frequency
+	ANTSNIFF_ACTION_RETURN	// disconnect: back to the beacon channel
+} antsniff_antfs_action;
+
+typedef struct antsniff_antfs_message {
+	const char *type;
+	antsniff_field fields[ANTSNIFF_MAX_FIELDS];
+	size_t field_count;
+	int trigger;	// a command worth recording the raw samples of
+	antsniff_antfs_action action;
+	uint8_t link_frequency;	// 2400 + this MHz, for ANTSNIFF_ACTION_FOLLOW
+} antsniff_antfs_message;
+
+/*
+ * The decoder's detection settings. antsniff_decoder_params_init() fills in
+ * the defaults, the hand-picked values the decoder has always used (antsweep
+ * measures others), and the size of the structure the caller was built
+ * with; settings added to the library since keep their defaults:
+ *
+ * - ring_size: samples a packet moves through before it's decoded; at least
+ *   the length of the packet (preamble to CRC)
+ * - threshold_window: samples averaged into the slicer level
+ * - saturation: the slicer level (in int16 units) at or above which a
+ *   preamble is rejected
+ * - transitions: the edges a preamble must have
+ * - initial_skip, packet_skip: samples passed over before the first
+ *   preamble check, and after a packet
+ * - known_devices: how many devices the decoder learns the slicer levels of
+ *   (up to 256), for CRC failure recovery: a preamble that fails the CRC is
+ *   sliced again at the levels of the 4 of them heard most recently (see
+ *   devicecache.hpp); 0, the default, turns that off, as it changes the
+ *   packets found
+ */
+typedef struct antsniff_decoder_params {
+	uint32_t size;	// set by antsniff_decoder_params_init()
+	uint32_t ring_size;
+	uint32_t threshold_window;
+	int32_t saturation;
+	uint32_t transitions;
+	uint32_t initial_skip;
+	uint32_t packet_skip;
+	uint32_t known_devices;
+} antsniff_decoder_params;
+
+typedef struct antsniff_decoder antsniff_decoder;
+
+typedef void (*antsniff_packet_cb)(const antsniff_packet *packet, void *ctx);
+
+ANTSNIFF_API const char *antsniff_version(void);
+
+/* CRC-16-CCITT (initial value 0xffff), as used by ShockBurst */
+ANTSNIFF_API uint16_t antsniff_crc16(const uint8_t *data, size_t length);
+
+/*
+ * Decoder for frequency demodulated, signed 16 bit samples at 2 Msps.
+ * Returns NULL if the lengths are out of range (address 3-5, payload 1-32).
+ */
+ANTSNIFF_API antsniff_decoder *antsniff_decoder_new(uint8_t address_length,
+		uint8_t payload_length);
+
+/*
+ * Fill in the defaults of the first size bytes of params; call it through
+ * antsniff_decoder_params_init(), which passes the size the caller knows
+ */
+ANTSNIFF_API void antsniff_decoder_params_init_size(
+		antsniff_decoder_params *params, size_t size);
+
+static inline void antsniff_decoder_params_init(antsniff_decoder_params *params)
+{
+	antsniff_decoder_params_init_size(params, sizeof(*params));
+}
+
+/*
+ * A decoder with other settings; NULL if they are out of range, too, or if
+ * params->size is not that of a version of the structure
+ */
+ANTSNIFF_API antsniff_decoder *antsniff_decoder_new_params(
+		uint8_t address_length, uint8_t payload_length,
+		const antsniff_decoder_params *params);
+ANTSNIFF_API void antsniff_decoder_free(antsniff_decoder *decoder);
+
+/*
+ * Feed count samples, calling cb for every packet found. Returns the number of
+ * packets found.
+ */
+ANTSNIFF_API size_t antsniff_decoder_feed(antsniff_decoder *decoder,
+		const int16_t *samples, size_t count, antsniff_packet_cb cb, void *ctx);
+
+/* Number of samples fed so far */
+ANTSNIFF_API uint64_t antsniff_decoder_samples(const antsniff_decoder *decoder);
+
+/* Number of preambles found that failed the CRC check */
+ANTSNIFF_API uint64_t antsniff_decoder_false_preambles(
+		const antsniff_decoder *decoder);
+
+/* Number of packets found by slicing them again at a known device's level */
+ANTSNIFF_API uint64_t antsniff_decoder_reacquired(
+		const antsniff_decoder *decoder);
+
+/*
+ * The decoder's state (see checkpoint.h), for resuming a decoding job later:
+ * save writes it to buffer if size is large enough, and returns its size;
+ * restore returns 0, or -1 (leaving the decoder as it was) if the state is
+ * not one of a decoder with the same lengths.
+ */
+ANTSNIFF_API size_t antsniff_decoder_save(const antsniff_decoder *decoder,
+		uint8_t *buffer, size_t size);
+ANTSNIFF_API int antsniff_decoder_restore(antsniff_decoder *decoder,
+		const uint8_t *buffer, size_t size);
+
+/*
+ * Parse the payload of a ShockBurst packet as an ANT-FS message. Returns 1 if
+ * it's a beacon or command/response, 0 if it's something else (the message
+ * is still filled in, as type "unknown").
+ */
+ANTSNIFF_API int antsniff_antfs_parse(const uint8_t *payload, size_t length,
+		antsniff_antfs_message *message);
+
+/*
+ * Timeline tracing of the decoder (see timeline.hpp). start begins writing a
+ * Chrome trace event file to path, and returns 0, or -1 if it can't be
+ * written; stop finishes it, and returns the number of events written, or -1.
+ * In between, enable pauses and resumes tracing.
+ */
+ANTSNIFF_API int antsniff_timeline_start(const char *path);
+ANTSNIFF_API long antsniff_timeline_stop(void);
+ANTSNIFF_API void antsniff_timeline_enable(int enabled);
+ANTSNIFF_API int antsniff_timeline_enabled(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ANTSNIFF_H */
@@ -0,0 +1,190 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fmdemod.h"
+
+/*
+ * Recorded captures, for replaying them faster than real time
+ *
+ * A capture is a headerless file of samples in one of these formats:
+ *
+ *   s16   frequency demodulated signed 16 bit samples (what shockburst reads
+ *         from standard input)
+ *   cs16  interleaved signed 16 bit I/Q (I/Q Recorder: complex_int16)
+ *   cs8   interleaved signed 8 bit I/Q (I/Q Recorder: complex_int8)
+ *   cu8   interleaved unsigned 8 bit I/Q (rtl_sdr)
+ *   cf32  interleaved 32 bit float I/Q (I/Q Recorder: complex_float32)
+ *
+ * The file is memory mapped for sequential access, so replaying it costs no
+ * read() copies, and the kernel reads ahead in large blocks. capture_demod()
+ * turns any of the formats into the decoder's int16 samples; s16 files are
+ * fed to the decoder straight from the mapping.
+ *
+ * As captures have no header, their start time is taken from the file's
+ * modification time (which is when the recording ended) minus its duration,
+ * unless the caller knows better.
+ */
+
+typedef enum {
+	CAPTURE_UNKNOWN = 0,
+	CAPTURE_S16,
+	CAPTURE_CS16,
+	CAPTURE_CS8,
+	CAPTURE_CU8,
+	CAPTURE_CF32
+} CaptureFormat;
+
+typedef struct {
+	int fd;
+	const uint8_t *data;
+	size_t size;
+	CaptureFormat format;
+	size_t elem_size;	// bytes per sample
+	uint64_t samples;	// in the file
+	uint64_t mtime;	// ns since the epoch
+	FmDemod demod;
+} CaptureFile;
+
+/* "s16", "cs16", "cs8", "cu8" or "cf32", or a Pothos dtype name */
+static inline CaptureFormat capture_format(const char *name)
+{
+	if (!strcmp(name, "s16") || !strcmp(name, "int16")) return CAPTURE_S16;
+	if (!strcmp(name, "cs16") || !strcmp(name, "complex_int16")) return CAPTURE_CS16;
+	if (!strcmp(name, "cs8") || !strcmp(name, "complex_int8")) return CAPTURE_CS8;
+	if (!strcmp(name, "cu8") || !strcmp(name, "complex_uint8")) return CAPTURE_CU8;
+	if (!strcmp(name, "cf32") || !strcmp(name, "complex_float32")) return CAPTURE_CF32;
+	return CAPTURE_UNKNOWN;
+}
+
+/* The format from the file name's extension, e.g. capture.cu8 */
+static inline CaptureFormat capture_format_of(const char *path)
+{
+	const char *dot = strrchr(path, '.');
+	return dot ? capture_format(dot + 1) : CAPTURE_UNKNOWN;
+}
+
+static inline size_t capture_elem_size(CaptureFormat format)
+{
+	switch (format) {
+		case CAPTURE_S16: return 2;
+		case CAPTURE_CS16: return 4;
+		case CAPTURE_CS8: return 2;
+		case CAPTURE_CU8: return 2;
+		case CAPTURE_CF32: return 8;
+		default: return 0;
+	}
+}
+
+/* Open and map path; format may be CAPTURE_UNKNOWN to go by the extension */
+static inline int capture_open(CaptureFile *c, const char *path,
+		CaptureFormat format)
+{
+	struct stat st;
+	void *p;
+
+	memset(c, 0, sizeof(*c));
+	c->fd = -1;
+	fmdemod_init(&c->demod);
+
+	c->format = format != CAPTURE_UNKNOWN ? format : capture_format_of(path);
+	c->elem_size = capture_elem_size(c->format);
+	if (!c->elem_size) return -1;
+
+	c->fd = open(path, O_RDONLY);
+	if (c->fd < 0) return -1;
+	if (fstat(c->fd, &st) < 0) goto fail;
+
+	c->size = (size_t)st.st_size;
+	c->samples = c->size / c->elem_size;
+	c->mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL +
+		(uint64_t)st.st_mtim.tv_nsec;
+	if (c->size == 0) return 0;
+
+	p = mmap(NULL, c->size, PROT_READ, MAP_PRIVATE, c->fd, 0);
+	if (p == MAP_FAILED) goto fail;
+	madvise(p, c->size, MADV_SEQUENTIAL);
+	c->data = (const uint8_t *)p;
+	return 0;
+
+fail:
+	close(c->fd);
+	c->fd = -1;
+	return -1;
+}
+
+static inline void capture_close(CaptureFile *c)
+{
+	if (c->data) munmap((void *)c->data, c->size);
+	if (c->fd >= 0) close(c->fd);
+	c->data = NULL;
+	c->fd = -1;
+}
+
+/* When the first sample was recorded, in ns, if sample_rate is right */
+static inline uint64_t capture_start_time(const CaptureFile *c,
+		double sample_rate)
+{
+	uint64_t duration = (uint64_t)((double)c->samples / sample_rate * 1e9);
+	return c->mtime > duration ? c->mtime - duration : 0;
+}
+
+/* The address of sample first */
+static inline const void *capture_at(const CaptureFile *c, uint64_t first)
+{
+	return c->data + first * c->elem_size;
+}
+
+/*
+ * Samples first to first + count - 1 as decoder input, in out. The
+ * demodulator state carries over, so consecutive calls continue the stream.
+ */
+static inline void capture_demod(CaptureFile *c, uint64_t first, size_t count,
+		int16_t *out)
+{
+	const void *in = capture_at(c, first);
+
+	switch (c->format) {
+		case CAPTURE_S16:
+			memcpy(out, in, count * sizeof(int16_t));
+			break;
+		case CAPTURE_CS16:
+			fmdemod_cs16(&c->demod, (const int16_t *)in, count, out);
+			break;
+		case CAPTURE_CS8:
+			fmdemod_cs8(&c->demod, (const int8_t *)in, count, out);
+			break;
+		case CAPTURE_CU8:
+			fmdemod_cu8(&c->demod, (const uint8_t *)in, count, out);
+			break;
+		case CAPTURE_CF32:
+			fmdemod_cf32(&c->demod, (const float *)in, count, out);
+			break;
+		default:
+			break;
+	}
+}
+
+/*
+ * Drop the mapping of samples first to first + count - 1 once they have been
+ * used, so a long replay doesn't keep the whole file mapped in memory.
+ */
+static inline void capture_release(CaptureFile *c, uint64_t first,
+		uint64_t count)
+{
+	uintptr_t start = (uintptr_t)capture_at(c, first);
+	uintptr_t end = start + count * c->elem_size;
+
+	start = (start + 4095) & ~(uintptr_t)4095;
+	end &= ~(uintptr_t)4095;
+	if (end > start) madvise((void *)start, end - start, MADV_DONTNEED);
+}
+
+#endif /* CAPTURE_H */
@@ -0,0 +1,270 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+namespace antsniff {
+
+/*
+ * Adaptive channel scan, for discovering ANT-FS clients with a single
+ * narrowband receiver.
+ *
+ * ANT-FS clients beacon on one of the RF channels 3-80 (2403-2480 MHz), at
+ * 0.5 to 8 Hz. The scanner moves the receiver from channel to channel, and
+ * works out how long to stay on each from what it heard there before:
+ *
+ * - a channel where nothing was heard gets the base dwell time, long enough
+ *   to catch a beacon at the usual 4 Hz or more;
+ * - a channel with known devices gets 1.5 times the longest beacon period
+ *   decoded there (up to maxDwell), so every device on it beacons once per
+ *   visit, but it's left as soon as all of them have been heard (and the
+ *   base dwell time has passed);
+ * - the next channel is one never visited, or else the one longest unvisited,
+ *   with the wait of channels with known devices counted activeWeight times,
+ *   so they are revisited that many times more often.
+ *
+ * A link command makes the scanner follow the host to the channel it
+ * names, until the disconnect command, or until nothing was heard there for
+ * followTimeout; then it returns to the beacon channel it came from.
+ *
+ * Times are in ns, on any monotonic clock. Packets heard within settle of a
+ * channel change are not counted for the new channel, as they may still
+ * come from the old one. The calls that can move the receiver return the
+ * channel to tune to, or 0 to stay.
+ */
+class ChannelScanner
+{
+public:
+	struct Channel
+	{
+		uint8_t channel;
+		uint64_t visits;
+		int64_t left;	// when it was last left, -1 if never visited
+		int64_t dwelled;	// in total
+		uint64_t beacons;
+		int64_t period;	// the longest beacon period heard, 0 if none
+		int64_t discovery;	// after the start, its first device, -1 if none
+		std::unordered_set<uint64_t> devices;
+	};
+
+	int64_t dwell;
+	int64_t maxDwell;
+	int64_t settle;
+	int64_t followTimeout;
+	int activeWeight;
+
+	ChannelScanner(uint8_t first = 3, uint8_t last = 80):
+		dwell(300000000),
+		maxDwell(2500000000LL),
+		settle(50000000),
+		followTimeout(10000000000LL),
+		activeWeight(4),
+		_current(0),
+		_arrived(0),
+		_started(0),
+		_following(false),
+		_followed(0),
+		_lastPacket(0),
+		_lastDiscovery(-1)
+	{
+		for (unsigned c = first; c <= last; ++c) {
+			Channel ch;
+			ch.channel = uint8_t(c);
+			ch.visits = 0;
+			ch.left = -1;
+			ch.dwelled = 0;
+			ch.beacons = 0;
+			ch.period = 0;
+			ch.discovery = -1;
+			_channels.push_back(ch);
+		}
+	}
+
+	/* The beacon period of an ANT-FS beacon's status 1 byte, 0 if unknown */
+	static int64_t beaconPeriod(uint8_t status1)
+	{
+		uint8_t period = status1 & 7;
+		return period <= 4 ? 2000000000LL >> period : 0;
+	}
+
+	/* Start over at channel (the beacon channel) at now */
+	uint8_t start(uint8_t channel, int64_t now)
+	{
+		for (Channel &ch : _channels) {
+			ch.visits = 0;
+			ch.left = -1;
+			ch.dwelled = 0;
+			ch.beacons = 0;
+			ch.period = 0;
+			ch.discovery = -1;
+			ch.devices.clear();
+		}
+		_devices.clear();
+		_started = now;
+		_following = false;
+		_lastDiscovery = -1;
+
+		size_t index = 0;
+		for (size_t i = 0; i < _channels.size(); ++i) {
+			if (_channels[i].channel == channel) index = i;
+		}
+		return this->arrive(index, now);
+	}
+
+	/* Leave the channel if its dwell time is up */
+	uint8_t tick(int64_t now)
+	{
+		if (_following) {
+			if (now - _lastPacket < followTimeout) return 0;
+			_following = false;
+			return this->arrive(_followed, now);
+		}
+
+		if (now - _arrived < this->dwellTime(_channels[_current])) return 0;
+		return this->hop(now);
+	}
+
+	/* A beacon of address, with the period decoded from it */
+	uint8_t beacon(uint64_t address, int64_t period, int64_t now)
+	{
+		if (_following) {
+			// clients beacon on the link channel too
+			_lastPacket = now;
+			return 0;
+		}
+		if (now - _arrived < settle) return 0;
+
+		Channel &ch = _channels[_current];
+		++ch.beacons;
+		ch.period = std::max(ch.period, period);
+		_heard.insert(address);
+		if (ch.devices.insert(address).second) {
+			if (ch.discovery < 0) ch.discovery = now - _started;
+			if (_devices.insert(address).second) _lastDiscovery = now - _started;
+		}
+
+		// everyone known here has been heard: no need to wait any longer
+		if (now - _arrived < dwell || _heard.size() < ch.devices.size()) return 0;
+		for (uint64_t device : ch.devices) {
+			if (!_heard.count(device)) return 0;
+		}
+		return this->hop(now);
+	}
+
+	/* Any other packet */
+	void packet(int64_t now)
+	{
+		if (_following) _lastPacket = now;
+	}
+
+	/* A link command: follow the host to channel */
+	uint8_t link(uint8_t channel, int64_t now)
+	{
+		if (!_following) {
+			this->leave(now);
+			_followed = _current;
+			_following = true;
+		}
+		_lastPacket = now;
+		return channel;
+	}
+
+	/* A disconnect command: back to the beacon channel */
+	uint8_t disconnect(int64_t now)
+	{
+		if (!_following) return 0;
+		_following = false;
+		return this->arrive(_followed, now);
+	}
+
+	uint8_t channel(void) const
+	{
+		return _channels[_current].channel;
+	}
+
+	bool following(void) const
+	{
+		return _following;
+	}
+
+	const std::vector<Channel> &channels(void) const
+	{
+		return _channels;
+	}
+
+	/* Devices found so far, and how long after the start the last one was */
+	size_t devices(void) const
+	{
+		return _devices.size();
+	}
+
+	int64_t lastDiscovery(void) const
+	{
+		return _lastDiscovery;
+	}
+
+private:
+	std::vector<Channel> _channels;
+	size_t _current;
+	int64_t _arrived;
+	int64_t _started;
+	std::unordered_set<uint64_t> _heard;	// on this visit
+	std::unordered_set<uint64_t> _devices;
+	bool _following;
+	size_t _followed;	// the channel left to follow
+	int64_t _lastPacket;
+	int64_t _lastDiscovery;
+
+	int64_t dwellTime(const Channel &ch) const
+	{
+		if (ch.period == 0) return dwell;
+		return std::min(maxDwell, std::max(dwell, ch.period * 3 / 2));
+	}
+
+	void leave(int64_t now)
+	{
+		Channel &ch = _channels[_current];
+		ch.dwelled += now - _arrived;
+		ch.left = now;
+	}
+
+	uint8_t arrive(size_t index, int64_t now)
+	{
+		_current = index;
+		_arrived = now;
+		_heard.clear();
+		++_channels[index].visits;
+		return _channels[index].channel;
+	}
+
+	uint8_t hop(int64_t now)
+	{
+		this->leave(now);
+
+		size_t next = _current;
+		int64_t best = -1;
+		for (size_t i = 0; i < _channels.size(); ++i) {
+			const Channel &ch = _channels[i];
+			if (i == _current) continue;
+
+			int64_t score;
+			if (ch.left < 0) {
+				// the unvisited ones first, in order from here
+				size_t distance = (i + _channels.size() - _current) %
+					_channels.size();
+				score = INT64_MAX - int64_t(distance);
+			} else {
+				score = (now - ch.left) * (ch.devices.empty() ? 1 : activeWeight);
+			}
+			if (score > best) {
+				best = score;
+				next = i;
+			}
+		}
+
+		return this->arrive(next, now);
+	}
+};
+
+} // namespace antsniff
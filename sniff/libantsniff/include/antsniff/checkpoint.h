@@ -0,0 +1,108 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "antsniff.h"
+#include "fmdemod.h"
+#include "packetlog.h"
+
+/*
+ * Checkpoints of long decoding jobs
+ *
+ * A job decoding e.g. a multi-day capture writes a checkpoint every so often,
+ * and if it's interrupted, the next run resumes from the last checkpoint
+ * instead of from the start, with the same output as if it had never
+ * stopped. A checkpoint holds how far the job got in its input, the decoder's
+ * state (see antsniff_decoder_save()) and the FM demodulator's, and where the
+ * outputs were at that point, so that what they got after it can be cut off.
+ *
+ * The file is the header below, the decoder state and a CRC-16 of both, in
+ * host byte order: a checkpoint is resumed on the machine that wrote it. It
+ * is written to path.tmp, which then replaces the previous checkpoint, so an
+ * interrupted write leaves the previous one in place.
+ */
+
+#define CHECKPOINT_MAGIC "ANTCKPT"
+#define CHECKPOINT_VERSION 5
+#define CHECKPOINT_MAX_STATE 16384
+#define CHECKPOINT_NO_OFFSET UINT64_MAX
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t state_size;	// bytes of decoder state after the header
+	uint64_t samples;	// input samples decoded
+	uint32_t format;	// of the input: a CaptureFormat, 0 for standard input
+	uint32_t has_log;	// whether log is valid
+	uint64_t input_size;	// bytes, 0 if the input is not a file
+	uint64_t output;	// standard output offset, or CHECKPOINT_NO_OFFSET
+	FmDemod demod;
+	PacketLogPosition log;
+} CheckpointHeader;
+
+typedef struct {
+	CheckpointHeader header;
+	uint8_t state[CHECKPOINT_MAX_STATE];
+} Checkpoint;
+
+/* Start c, clearing the padding too, so that the CRC is reproducible */
+static inline void checkpoint_init(Checkpoint *c)
+{
+	memset(&c->header, 0, sizeof(c->header));
+	memcpy(c->header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+	c->header.version = CHECKPOINT_VERSION;
+	c->header.output = CHECKPOINT_NO_OFFSET;
+	fmdemod_init(&c->header.demod);
+}
+
+/* Returns 0 on success, -1 on error */
+static inline int checkpoint_write(const char *path, const Checkpoint *c)
+{
+	char tmp_path[4096];
+	size_t size = sizeof(c->header) + c->header.state_size;
+	uint16_t crc = antsniff_crc16((const uint8_t *)c, size);
+	FILE *f;
+	int ok;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	f = fopen(tmp_path, "wb");
+	if (!f) return -1;
+
+	ok = fwrite(c, size, 1, f) == 1 && fwrite(&crc, sizeof(crc), 1, f) == 1;
+	ok = fflush(f) == 0 && ok;
+	ok = fsync(fileno(f)) == 0 && ok;
+	ok = fclose(f) == 0 && ok;
+	if (!ok || rename(tmp_path, path) < 0) {
+		unlink(tmp_path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Returns 0 on success, -1 if path is missing, unreadable or corrupt */
+static inline int checkpoint_read(const char *path, Checkpoint *c)
+{
+	FILE *f = fopen(path, "rb");
+	uint16_t crc;
+	int ok;
+
+	if (!f) return -1;
+	ok = fread(&c->header, sizeof(c->header), 1, f) == 1 &&
+		memcmp(c->header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) == 0 &&
+		c->header.version == CHECKPOINT_VERSION &&
+		c->header.state_size <= CHECKPOINT_MAX_STATE &&
+		fread(c->state, 1, c->header.state_size, f) == c->header.state_size &&
+		fread(&crc, sizeof(crc), 1, f) == 1 &&
+		antsniff_crc16((const uint8_t *)c, sizeof(c->header) +
+				c->header.state_size) == crc;
+	fclose(f);
+
+	return ok ? 0 : -1;
+}
+
+#endif /* CHECKPOINT_H */
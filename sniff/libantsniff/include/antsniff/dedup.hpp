@@ -0,0 +1,192 @@
+#pragma once
+#include "antsniff.h"
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+namespace antsniff {
+
+/* 64 bit FNV-1a hash of the address, payload and CRC of a packet */
+inline uint64_t frameKey(uint64_t address, const uint8_t *payload,
+		size_t length, uint16_t crc)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (int i = 0; i < 8; ++i) {
+		h = (h ^ ((address >> i * 8) & 0xff)) * 0x100000001b3ULL;
+	}
+	for (size_t i = 0; i < length; ++i) {
+		h = (h ^ payload[i]) * 0x100000001b3ULL;
+	}
+	h = (h ^ (crc & 0xff)) * 0x100000001b3ULL;
+	h = (h ^ (crc >> 8)) * 0x100000001b3ULL;
+
+	return h;
+}
+
+/*
+ * Deduplication of frames received by several receivers.
+ *
+ * Frames are offered with their key (see frameKey()), their sample index on a
+ * common clock, and a quality metric. A frame whose key was seen within
+ * "window" samples is a copy: the best of the copies is kept, the rest are
+ * dropped. Frames are emitted, oldest first, once the newest sample seen is
+ * more than window + delay samples past them, where the delay covers how far
+ * the receivers may run ahead of each other.
+ *
+ * Pending frames live in a fixed ring, indexed by an open addressing table of
+ * (key, ring position) pairs, so nothing is allocated per frame. When the
+ * ring is full, the oldest frame is emitted early.
+ */
+template <typename T>
+class FrameDeduper
+{
+public:
+	FrameDeduper(size_t capacity, uint64_t window, uint64_t delay):
+		_window(window),
+		_delay(delay),
+		_newest(0),
+		_head(0),
+		_count(0),
+		_duplicates(0)
+	{
+		size_t n = 16;
+		while (n < capacity) n <<= 1;
+		_entries.resize(n);
+		_slots.resize(2 * n);
+	}
+
+	/* Offer a frame; fn(item, sample, copies) is called for emitted frames */
+	template <typename Fn>
+	void offer(uint64_t key, uint64_t sample, int32_t metric, T item, Fn fn)
+	{
+		if (sample > _newest) _newest = sample;
+		this->expire(fn);
+
+		size_t slot = this->find(key);
+		if (_slots[slot].pos != 0) {
+			Entry &e = _entries[(_slots[slot].pos - 1) & (_entries.size() - 1)];
+			uint64_t distance = sample > e.sample ?
+				sample - e.sample : e.sample - sample;
+			if (distance <= _window) {
+				++e.copies;
+				++_duplicates;
+				if (metric > e.metric) {
+					e.metric = metric;
+					e.item = std::move(item);
+				}
+				if (sample < e.sample) e.sample = sample;
+				return;
+			}
+		}
+
+		if (_count == _entries.size()) this->emitOldest(fn);
+		slot = this->find(key);
+
+		uint64_t pos = _head + _count++;
+		Entry &e = _entries[pos & (_entries.size() - 1)];
+		e.key = key;
+		e.sample = sample;
+		e.metric = metric;
+		e.copies = 1;
+		e.item = std::move(item);
+
+		_slots[slot].key = key;
+		_slots[slot].pos = pos + 1;
+	}
+
+	/* Emit every pending frame */
+	template <typename Fn>
+	void flush(Fn fn)
+	{
+		while (_count > 0) this->emitOldest(fn);
+	}
+
+	size_t pending(void) const
+	{
+		return _count;
+	}
+
+	/* Number of copies dropped so far */
+	uint64_t duplicates(void) const
+	{
+		return _duplicates;
+	}
+
+private:
+	struct Entry {
+		uint64_t key;
+		uint64_t sample;
+		int32_t metric;
+		uint32_t copies;
+		T item;
+	};
+
+	struct Slot {
+		uint64_t key;
+		uint64_t pos;	// ring position + 1, 0 if empty
+	};
+
+	uint64_t _window;
+	uint64_t _delay;
+	uint64_t _newest;
+	std::vector<Entry> _entries;
+	std::vector<Slot> _slots;
+	uint64_t _head;	// ring position of the oldest entry
+	size_t _count;
+	uint64_t _duplicates;
+
+	/* The slot holding key, or the empty slot it would go to */
+	size_t find(uint64_t key) const
+	{
+		const size_t mask = _slots.size() - 1;
+		size_t i = size_t(key) & mask;
+		while (_slots[i].pos != 0 && _slots[i].key != key) i = (i + 1) & mask;
+		return i;
+	}
+
+	/* Empty slot i, shifting back the entries that probed past it */
+	void erase(size_t i)
+	{
+		const size_t mask = _slots.size() - 1;
+		size_t j = i;
+		for (;;) {
+			j = (j + 1) & mask;
+			if (_slots[j].pos == 0) break;
+			size_t home = size_t(_slots[j].key) & mask;
+			// move j into the hole at i, unless its home lies in (i, j]
+			if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+				_slots[i] = _slots[j];
+				i = j;
+			}
+		}
+		_slots[i].pos = 0;
+	}
+
+	template <typename Fn>
+	void emitOldest(Fn fn)
+	{
+		Entry &e = _entries[_head & (_entries.size() - 1)];
+
+		// a later, out of window frame with the same key may own the slot
+		size_t slot = this->find(e.key);
+		if (_slots[slot].pos == _head + 1) this->erase(slot);
+
+		fn(e.item, e.sample, e.copies);
+		e.item = T();
+		++_head;
+		--_count;
+	}
+
+	template <typename Fn>
+	void expire(Fn fn)
+	{
+		while (_count > 0) {
+			const Entry &e = _entries[_head & (_entries.size() - 1)];
+			if (_newest - e.sample <= _window + _delay) break;
+			this->emitOldest(fn);
+		}
+	}
+};
+
+} // namespace antsniff
@@ -0,0 +1,136 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace antsniff {
+
+/*
+ * Slicer levels of known devices, for recovering their packets after a CRC
+ * failure.
+ *
+ * A device's crystal offset (the DC level of its frequency demodulated
+ * signal, which is where the slicer threshold should be) hardly changes from
+ * packet to packet. The cache learns it from the packets decoded, per
+ * address, as a moving average, and keeps the capacity devices heard most
+ * recently.
+ *
+ * The devices are kept in an array, most recently heard first, and searched
+ * linearly: for a few dozen devices that beats hashing, and the decoder
+ * only searches it after a CRC failure. Levels are in int16 sample units,
+ * as the packets report them.
+ */
+class DeviceCache
+{
+public:
+	struct Device
+	{
+		uint64_t address;
+		int32_t level;	// the DC level: the slicer threshold
+		uint32_t packets;
+		int32_t levelAverage;	// in 1/FRACTION units
+	};
+
+	// the average keeps 4 fractional bits, so that it still follows the
+	// last few units of a change, which an integer average / 4 never would
+	static const int FRACTION = 16;
+
+	explicit DeviceCache(size_t capacity):
+		_capacity(capacity)
+	{
+		_devices.reserve(capacity);
+	}
+
+	size_t capacity(void) const
+	{
+		return _capacity;
+	}
+
+	size_t size(void) const
+	{
+		return _devices.size();
+	}
+
+	/* The i-th most recently heard device */
+	const Device &operator[](size_t i) const
+	{
+		return _devices[i];
+	}
+
+	/* A packet of address was decoded at threshold */
+	void learn(uint64_t address, int32_t threshold)
+	{
+		if (_capacity == 0) return;
+
+		size_t i = 0;
+		while (i < _devices.size() && _devices[i].address != address) ++i;
+
+		Device d;
+		if (i < _devices.size()) {
+			// moving average, over about the last 4 packets
+			d = _devices[i];
+			d.levelAverage += (threshold * FRACTION - d.levelAverage) / 4;
+			++d.packets;
+		} else {
+			if (_devices.size() == _capacity) i = _capacity - 1;
+			else _devices.push_back(Device());
+			d.address = address;
+			d.levelAverage = threshold * FRACTION;
+			d.packets = 1;
+		}
+		d.level = round(d.levelAverage);
+
+		// to the front, the least recently heard device drops off the back
+		for (; i > 0; --i) _devices[i] = _devices[i - 1];
+		_devices[0] = d;
+	}
+
+	void clear(void)
+	{
+		_devices.clear();
+	}
+
+	/* Bytes save() takes */
+	size_t stateSize(void) const
+	{
+		return sizeof(uint32_t) + _capacity * sizeof(Device);
+	}
+
+	void save(uint8_t *buffer) const
+	{
+		const uint32_t count = uint32_t(_devices.size());
+		std::memset(buffer, 0, stateSize());
+		std::memcpy(buffer, &count, sizeof(count));
+		if (count > 0) {
+			std::memcpy(buffer + sizeof(count), &_devices[0],
+					count * sizeof(Device));
+		}
+	}
+
+	bool restore(const uint8_t *buffer)
+	{
+		uint32_t count;
+		std::memcpy(&count, buffer, sizeof(count));
+		if (count > _capacity) return false;
+
+		_devices.resize(count);
+		if (count > 0) {
+			std::memcpy(&_devices[0], buffer + sizeof(count),
+					count * sizeof(Device));
+		}
+		return true;
+	}
+
+private:
+	/* average / FRACTION, rounded to nearest */
+	static int32_t round(int32_t average)
+	{
+		return (average + (average < 0 ? -FRACTION / 2 : FRACTION / 2)) /
+			FRACTION;
+	}
+
+	size_t _capacity;
+	std::vector<Device> _devices;
+};
+
+} // namespace antsniff
@@ -0,0 +1,110 @@
+#ifndef FMDEMOD_H
+#define FMDEMOD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+
+/*
+ * FM (quadrature) demodulator for raw I/Q samples
+ *
+ * The output is the phase difference between consecutive samples,
+ * arg(x[n] * conj(x[n-1])), scaled from -pi..pi to the int16 range, which is
+ * what the decoder expects: the same as the "Freq Demod" block followed by
+ * the ShockBurst Decoder's float to int16 conversion. So a raw capture
+ * decodes the same with and without Pothos in the loop.
+ *
+ * The arctangent is a polynomial approximation (error below 1e-5 rad, far
+ * less than one output step), which is several times faster than atan2f().
+ * The state is just the previous sample, so a stream can be demodulated in
+ * chunks of any size.
+ */
+
+typedef struct {
+	float i;
+	float q;
+} FmDemod;
+
+static inline void fmdemod_init(FmDemod *d)
+{
+	d->i = 0.0f;
+	d->q = 0.0f;
+}
+
+/* atan2(y, x) scaled to -32767..32767 */
+static inline int16_t fmdemod_angle(float y, float x)
+{
+	float ax = fabsf(x), ay = fabsf(y);
+	float a, s, r;
+
+	if (ax == 0.0f && ay == 0.0f) return 0;
+
+	a = ax < ay ? ax / ay : ay / ax;
+	s = a * a;
+	r = ((-0.0464964749f * s + 0.15931422f) * s - 0.327622764f) * s * a + a;
+	if (ay > ax) r = 1.57079637f - r;
+	if (x < 0.0f) r = 3.14159274f - r;
+	if (y < 0.0f) r = -r;
+
+	// (1 << 15) / pi, like the decoder's float input, but without overflowing
+	r *= 10430.378f;
+	return (int16_t)(r > 32767.0f ? 32767.0f : r < -32767.0f ? -32767.0f : r);
+}
+
+/* One sample: the phase step from the previous one */
+static inline int16_t fmdemod_step(FmDemod *d, float i, float q)
+{
+	float re = i * d->i + q * d->q;
+	float im = q * d->i - i * d->q;
+
+	d->i = i;
+	d->q = q;
+	return fmdemod_angle(im, re);
+}
+
+/* Interleaved signed 16 bit I/Q (cs16), n complex samples */
+static inline void fmdemod_cs16(FmDemod *d, const int16_t *iq, size_t n,
+		int16_t *out)
+{
+	size_t k;
+
+	for (k = 0; k < n; ++k) {
+		out[k] = fmdemod_step(d, (float)iq[2 * k], (float)iq[2 * k + 1]);
+	}
+}
+
+/* Interleaved signed 8 bit I/Q (cs8, SoapySDR's native RTL-SDR format) */
+static inline void fmdemod_cs8(FmDemod *d, const int8_t *iq, size_t n,
+		int16_t *out)
+{
+	size_t k;
+
+	for (k = 0; k < n; ++k) {
+		out[k] = fmdemod_step(d, (float)iq[2 * k], (float)iq[2 * k + 1]);
+	}
+}
+
+/* Interleaved unsigned 8 bit I/Q (cu8, as rtl_sdr writes it) */
+static inline void fmdemod_cu8(FmDemod *d, const uint8_t *iq, size_t n,
+		int16_t *out)
+{
+	size_t k;
+
+	for (k = 0; k < n; ++k) {
+		out[k] = fmdemod_step(d, (float)iq[2 * k] - 127.5f,
+				(float)iq[2 * k + 1] - 127.5f);
+	}
+}
+
+/* Interleaved 32 bit float I/Q (cf32) */
+static inline void fmdemod_cf32(FmDemod *d, const float *iq, size_t n,
+		int16_t *out)
+{
+	size_t k;
+
+	for (k = 0; k < n; ++k) {
+		out[k] = fmdemod_step(d, iq[2 * k], iq[2 * k + 1]);
+	}
+}
+
+#endif /* FMDEMOD_H */
@@ -0,0 +1,154 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
+
+namespace antsniff {
+
+/*
+ * A large, preallocated ring of raw samples with a single writer (the DSP
+ * thread) and any number of readers (the I/O thread).
+ *
+ * The writer never waits. Like a seqlock, it first announces how far it is
+ * about to write, then copies the samples in and publishes the new total
+ * with a release store. Readers copy a window out and then check, against
+ * the announced end, that the writer has not lapped them (or started to) in
+ * the meantime, so a slow disk can only cost the oldest part of a recording,
+ * never a stall of the decoder.
+ *
+ * The memory is an anonymous mapping that is touched once up front, so the
+ * first trigger doesn't page fault in the DSP path. With hugePages it is
+ * backed by huge pages if the system has any reserved, and falls back to
+ * normal pages otherwise.
+ */
+class IQRing
+{
+private:
+	uint8_t *_buffer;
+	size_t _mapped;
+	size_t _elemSize;
+	uint64_t _capacity;	// in elements
+	std::atomic<uint64_t> _written;	// elements written since construction
+	std::atomic<uint64_t> _writing;	// elements written once push() returns
+
+public:
+	bool hugePages;
+
+	IQRing(size_t elemSize, uint64_t capacity, bool useHugePages):
+		_buffer(nullptr),
+		_mapped(elemSize * capacity),
+		_elemSize(elemSize),
+		_capacity(capacity),
+		_written(0),
+		_writing(0),
+		hugePages(false)
+	{
+		void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+		if (useHugePages) {
+			const size_t huge = 2 << 20;
+			size_t length = (_mapped + huge - 1) & ~(huge - 1);
+			p = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (p != MAP_FAILED) {
+				_mapped = length;
+				hugePages = true;
+			}
+		}
+#endif
+		if (p == MAP_FAILED) {
+			p = mmap(nullptr, _mapped, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		}
+		if (p == MAP_FAILED) throw std::runtime_error("IQRing: mmap failed");
+
+		_buffer = static_cast<uint8_t *>(p);
+		std::memset(_buffer, 0, _mapped);
+	}
+
+	~IQRing(void)
+	{
+		munmap(_buffer, _mapped);
+	}
+
+	IQRing(const IQRing &) = delete;
+	IQRing &operator=(const IQRing &) = delete;
+
+	size_t elemSize(void) const
+	{
+		return _elemSize;
+	}
+
+	uint64_t capacity(void) const
+	{
+		return _capacity;
+	}
+
+	/* Total number of elements ever written (the next element's index) */
+	uint64_t written(void) const
+	{
+		return _written.load(std::memory_order_acquire);
+	}
+
+	/* Oldest element index still in the ring */
+	uint64_t oldest(void) const
+	{
+		uint64_t w = this->written();
+		return w > _capacity ? w - _capacity : 0;
+	}
+
+	/* Writer side: append n elements */
+	void push(const void *data, size_t n)
+	{
+		const uint8_t *in = static_cast<const uint8_t *>(data);
+		uint64_t w = _written.load(std::memory_order_relaxed);
+
+		// only the last capacity elements can survive anyway
+		if (n > _capacity) {
+			in += (n - _capacity) * _elemSize;
+			w += n - _capacity;
+			n = _capacity;
+		}
+
+		// the slots of [w + n - capacity, w + n) are overwritten from here
+		_writing.store(w + n, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		size_t pos = w % _capacity;
+		size_t first = std::min<uint64_t>(n, _capacity - pos);
+		std::memcpy(_buffer + pos * _elemSize, in, first * _elemSize);
+		std::memcpy(_buffer, in + first * _elemSize, (n - first) * _elemSize);
+
+		_written.store(w + n, std::memory_order_release);
+	}
+
+	/*
+	 * Reader side: call fn(pointer, elements) for the (up to two) contiguous
+	 * pieces of [start, end). Returns the index of the first element that was
+	 * still valid after fn returned, i.e. anything before it may have been
+	 * overwritten while it was being read.
+	 */
+	template <typename Fn>
+	uint64_t read(uint64_t start, uint64_t end, Fn fn) const
+	{
+		start = std::max(start, this->oldest());
+		if (end > this->written()) end = this->written();
+		if (start >= end) return end;
+
+		size_t pos = start % _capacity;
+		uint64_t n = end - start;
+		uint64_t first = std::min<uint64_t>(n, _capacity - pos);
+		fn(_buffer + pos * _elemSize, size_t(first));
+		if (n > first) fn(_buffer, size_t(n - first));
+
+		// a push() still copying counts as having overwritten its slots
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t writing = _writing.load(std::memory_order_relaxed);
+		return std::max(start, writing > _capacity ? writing - _capacity : 0);
+	}
+};
+
+} // namespace antsniff
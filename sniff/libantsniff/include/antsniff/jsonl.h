@@ -0,0 +1,248 @@
+#ifndef JSONL_H
+#define JSONL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "antsniff.h"
+
+/*
+ * JSON Lines writer for decoded packets
+ *
+ * One JSON object per line, e.g. (wrapped here):
+ *
+ * {"sample":8305,"channel":50,"threshold":-1024,"margin":9341,
+ *  "address":"0x3BA3472401","crc":"9D16","payload":"0000440403087B000000",
+ *  "antfs":{"type":"auth command","auth_type":"pass-through",...}}
+ *
+ * Address, CRC and payload are hex strings, as they were transmitted; ANT-FS
+ * fields keep their names and are numbers, strings or hex strings.
+ *
+ * Objects are serialized by hand straight into one preallocated buffer, with
+ * table driven integer and hex formatting, and the buffer is written out with
+ * a single write() when it fills up or on jsonl_flush(). The caller makes sure
+ * JSONL_MAX_LINE bytes are free before each object (jsonl_reserve()); nothing
+ * is allocated per packet.
+ */
+
+#define JSONL_BUFFER_SIZE (256 * 1024)
+#define JSONL_MAX_LINE 4096
+
+typedef struct {
+	int fd;
+	char *buf;
+	size_t used;
+} JsonlWriter;
+
+static const char jsonl_hex_digits[] = "0123456789ABCDEF";
+
+static const char jsonl_digit_pairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233"
+	"34353637383940414243444546474849505152535455565758596061626364656667"
+	"6869707172737475767778798081828384858687888990919293949596979899";
+
+static inline int jsonl_open(JsonlWriter *w, int fd)
+{
+	w->fd = fd;
+	w->used = 0;
+	w->buf = (char *)malloc(JSONL_BUFFER_SIZE);
+	return w->buf ? 0 : -1;
+}
+
+static inline int jsonl_flush(JsonlWriter *w)
+{
+	size_t done = 0;
+
+	while (done < w->used) {
+		ssize_t n = write(w->fd, w->buf + done, w->used - done);
+		if (n <= 0) {
+			w->used = 0;
+			return -1;
+		}
+		done += (size_t)n;
+	}
+
+	w->used = 0;
+	return 0;
+}
+
+static inline void jsonl_close(JsonlWriter *w)
+{
+	if (!w->buf) return;
+
+	jsonl_flush(w);
+	free(w->buf);
+	w->buf = NULL;
+}
+
+/* Make room for an object of up to length bytes */
+static inline void jsonl_reserve(JsonlWriter *w, size_t length)
+{
+	if (w->used + length > JSONL_BUFFER_SIZE) jsonl_flush(w);
+}
+
+static inline void jsonl_raw(JsonlWriter *w, const char *s, size_t length)
+{
+	memcpy(w->buf + w->used, s, length);
+	w->used += length;
+}
+
+static inline void jsonl_char(JsonlWriter *w, char c)
+{
+	w->buf[w->used++] = c;
+}
+
+static inline void jsonl_u64(JsonlWriter *w, uint64_t v)
+{
+	char tmp[20];
+	char *p = tmp + sizeof(tmp);
+
+	while (v >= 100) {
+		unsigned pair = (unsigned)(v % 100) * 2;
+		v /= 100;
+		*--p = jsonl_digit_pairs[pair + 1];
+		*--p = jsonl_digit_pairs[pair];
+	}
+	if (v >= 10) {
+		*--p = jsonl_digit_pairs[v * 2 + 1];
+		*--p = jsonl_digit_pairs[v * 2];
+	} else {
+		*--p = (char)('0' + v);
+	}
+
+	jsonl_raw(w, p, (size_t)(tmp + sizeof(tmp) - p));
+}
+
+static inline void jsonl_i64(JsonlWriter *w, int64_t v)
+{
+	if (v < 0) {
+		jsonl_char(w, '-');
+		jsonl_u64(w, 0 - (uint64_t)v);
+	} else {
+		jsonl_u64(w, (uint64_t)v);
+	}
+}
+
+/* "key": (with a leading comma unless it's the first member) */
+static inline void jsonl_key(JsonlWriter *w, const char *key, int first)
+{
+	if (!first) jsonl_char(w, ',');
+	jsonl_char(w, '"');
+	jsonl_raw(w, key, strlen(key));
+	jsonl_raw(w, "\":", 2);
+}
+
+/* A string, escaped, and cut short if it would overflow the line */
+static inline void jsonl_string(JsonlWriter *w, const char *s, size_t length)
+{
+	size_t i;
+
+	if (length > JSONL_MAX_LINE / 8) length = JSONL_MAX_LINE / 8;
+
+	jsonl_char(w, '"');
+	for (i = 0; i < length; ++i) {
+		unsigned char c = (unsigned char)s[i];
+		if (c == '"' || c == '\\') {
+			jsonl_char(w, '\\');
+			jsonl_char(w, (char)c);
+		} else if (c < 0x20) {
+			jsonl_raw(w, "\\u00", 4);
+			jsonl_char(w, jsonl_hex_digits[c >> 4]);
+			jsonl_char(w, jsonl_hex_digits[c & 15]);
+		} else {
+			jsonl_char(w, (char)c);
+		}
+	}
+	jsonl_char(w, '"');
+}
+
+/* Bytes as a hex string, cut short if it would overflow the line */
+static inline void jsonl_hex(JsonlWriter *w, const uint8_t *data, size_t length)
+{
+	size_t i;
+
+	if (length > JSONL_MAX_LINE / 8) length = JSONL_MAX_LINE / 8;
+
+	jsonl_char(w, '"');
+	for (i = 0; i < length; ++i) {
+		w->buf[w->used++] = jsonl_hex_digits[data[i] >> 4];
+		w->buf[w->used++] = jsonl_hex_digits[data[i] & 15];
+	}
+	jsonl_char(w, '"');
+}
+
+/* The low length bytes of v as a big endian hex string */
+static inline void jsonl_hex_be(JsonlWriter *w, uint64_t v, int length,
+		int prefix)
+{
+	int i;
+
+	jsonl_char(w, '"');
+	if (prefix) jsonl_raw(w, "0x", 2);
+	for (i = length - 1; i >= 0; --i) {
+		uint8_t byte = (uint8_t)(v >> (8 * i));
+		w->buf[w->used++] = jsonl_hex_digits[byte >> 4];
+		w->buf[w->used++] = jsonl_hex_digits[byte & 15];
+	}
+	jsonl_char(w, '"');
+}
+
+/* The members of a parsed ANT-FS message, as an object */
+static inline void jsonl_antfs(JsonlWriter *w, const antsniff_antfs_message *m)
+{
+	size_t i;
+
+	jsonl_char(w, '{');
+	jsonl_key(w, "type", 1);
+	jsonl_string(w, m->type, strlen(m->type));
+	for (i = 0; i < m->field_count; ++i) {
+		const antsniff_field *f = &m->fields[i];
+		jsonl_key(w, f->name, 0);
+		switch (f->kind) {
+			case ANTSNIFF_FIELD_U8:
+			case ANTSNIFF_FIELD_U16:
+			case ANTSNIFF_FIELD_U32:
+				jsonl_u64(w, f->number);
+				break;
+			case ANTSNIFF_FIELD_STRING:
+				jsonl_string(w, f->string, strlen(f->string));
+				break;
+			case ANTSNIFF_FIELD_BYTES:
+				jsonl_hex(w, f->bytes, f->length);
+				break;
+		}
+	}
+	jsonl_char(w, '}');
+}
+
+/* One packet per line; antfs may be NULL */
+static inline void jsonl_packet(JsonlWriter *w, const antsniff_packet *p,
+		uint8_t channel, const antsniff_antfs_message *antfs)
+{
+	jsonl_reserve(w, JSONL_MAX_LINE);
+
+	jsonl_raw(w, "{\"sample\":", 10);
+	jsonl_u64(w, p->sample);
+	jsonl_raw(w, ",\"channel\":", 11);
+	jsonl_u64(w, channel);
+	jsonl_raw(w, ",\"threshold\":", 13);
+	jsonl_i64(w, p->threshold);
+	jsonl_raw(w, ",\"margin\":", 10);
+	jsonl_i64(w, p->margin);
+	jsonl_raw(w, ",\"address\":", 11);
+	jsonl_hex_be(w, p->address, p->address_length, 1);
+	jsonl_raw(w, ",\"crc\":", 7);
+	jsonl_hex_be(w, p->crc, 2, 0);
+	jsonl_raw(w, ",\"payload\":", 11);
+	jsonl_hex(w, p->payload, p->payload_length);
+	if (antfs) {
+		jsonl_raw(w, ",\"antfs\":", 9);
+		jsonl_antfs(w, antfs);
+	}
+	jsonl_raw(w, "}\n", 2);
+}
+
+#endif /* JSONL_H */
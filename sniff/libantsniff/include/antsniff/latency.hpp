@@ -0,0 +1,105 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace antsniff {
+
+/*
+ * Latency histogram
+ *
+ * Log-linear buckets, like HdrHistogram: every power of two range of
+ * nanoseconds is split into 16 buckets, so a percentile is off by at most
+ * 1/16 of its value, from 16 ns up to about 18 minutes, in a fixed 5 KiB
+ * and with a couple of instructions per sample.
+ */
+class LatencyHistogram
+{
+public:
+	static const int SUB_BITS = 4;
+	static const int SUB_BUCKETS = 1 << SUB_BITS;
+	static const int MAX_BITS = 40;
+	static const int BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS;
+
+	LatencyHistogram(void)
+	{
+		this->reset();
+	}
+
+	void reset(void)
+	{
+		std::memset(_counts, 0, sizeof(_counts));
+		_count = 0;
+		_sum = 0;
+		_max = 0;
+	}
+
+	void record(int64_t ns)
+	{
+		uint64_t v = ns < 0 ? 0 : uint64_t(ns);
+		++_counts[bucket(v)];
+		++_count;
+		_sum += v;
+		_max = std::max(_max, v);
+	}
+
+	uint64_t count(void) const
+	{
+		return _count;
+	}
+
+	uint64_t max(void) const
+	{
+		return _max;
+	}
+
+	double mean(void) const
+	{
+		return _count ? double(_sum) / double(_count) : 0.0;
+	}
+
+	/* The latency p (0-100) percent of the samples are at or below, in ns */
+	uint64_t percentile(double p) const
+	{
+		if (_count == 0) return 0;
+
+		uint64_t rank = uint64_t(p / 100.0 * double(_count) + 0.5);
+		if (rank < 1) rank = 1;
+		if (rank > _count) rank = _count;
+
+		uint64_t seen = 0;
+		for (int i = 0; i < BUCKETS; ++i) {
+			seen += _counts[i];
+			if (seen >= rank) return std::min(upperBound(i), _max);
+		}
+		return _max;
+	}
+
+private:
+	uint64_t _counts[BUCKETS];
+	uint64_t _count;
+	uint64_t _sum;
+	uint64_t _max;
+
+	static int bucket(uint64_t v)
+	{
+		if (v < SUB_BUCKETS) return int(v);
+
+		int msb = 63 - __builtin_clzll(v);
+		if (msb >= MAX_BITS) return BUCKETS - 1;
+
+		int shift = msb - SUB_BITS;
+		return (shift + 1) * SUB_BUCKETS + int((v >> shift) & (SUB_BUCKETS - 1));
+	}
+
+	static uint64_t upperBound(int i)
+	{
+		if (i < SUB_BUCKETS) return uint64_t(i);
+
+		int shift = i / SUB_BUCKETS - 1;
+		uint64_t sub = uint64_t(i % SUB_BUCKETS + SUB_BUCKETS);
+		return ((sub + 1) << shift) - 1;
+	}
+};
+
+} // namespace antsniff
@@ -0,0 +1,486 @@
+#ifndef PACKETLOG_H
+#define PACKETLOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if !defined(WIN32)
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif /* !defined(WIN32) */
+
+/*
+ * Binary packet log
+ *
+ * An append-only file of length-prefixed records, one per decoded ShockBurst
+ * packet, written by one decoding job: sample numbers restart with every
+ * job, so each job starts a new log (a resumed job continues its own, see
+ * checkpoint.h). All integers are little endian.
+ *
+ * File header (24 bytes):
+ *
+ * +-----------+-------------+-----------------+---------------------+
+ * | Magic (8) | Version (4) | Sample rate (4) | Start time, ns (8)  |
+ * +-----------+-------------+-----------------+---------------------+
+ *
+ * Record (2 + PLOG_RECORD_FIXED + payload length bytes):
+ *
+ * +------------+------------+-------------+---------+-------------+
+ * | Length (2) | Sample (8) | Address (8) | CRC (2) | Channel (1) |
+ * +------------+------------+-------------+---------+-------------+
+ * | Address length (1) | Payload length (1) | Payload (1-32)      |
+ * +--------------------+--------------------+---------------------+
+ *
+ * "Length" counts the bytes following the length field, so readers can skip
+ * records they do not understand. "Sample" is the absolute index of the input
+ * sample at which the packet was detected.
+ *
+ * Sparse index (<log>.idx): a 16 byte header (magic, version, interval) and
+ * one 32 byte entry per PLOG_INDEX_INTERVAL records:
+ *
+ * +------------------+------------+----------------+-------------------+
+ * | First sample (8) | Offset (8) | End offset (8) | Address bloom (8) |
+ * +------------------+------------+----------------+-------------------+
+ *
+ * The bloom word has two bits set per address seen in the block, so address
+ * queries skip every block that cannot contain a match. Records past the last
+ * index entry (e.g. after a crash) are still found by a linear scan.
+ */
+
+#define PLOG_MAGIC "ANTPLOG"
+#define PLOG_INDEX_MAGIC "ANTPIDX"
+#define PLOG_VERSION 1
+#define PLOG_HEADER_SIZE 24
+#define PLOG_INDEX_HEADER_SIZE 16
+#define PLOG_INDEX_ENTRY_SIZE 32
+#define PLOG_RECORD_FIXED 21
+#define PLOG_INDEX_INTERVAL 1024
+#define PLOG_MAX_PAYLOAD 32
+
+typedef struct {
+	uint64_t sample;
+	uint64_t address;
+	uint16_t crc;
+	uint8_t channel;
+	uint8_t address_length;
+	uint8_t payload_length;
+	const uint8_t *payload;
+} PacketLogRecord;
+
+typedef struct {
+	uint64_t first_sample;
+	uint64_t offset;
+	uint64_t end;
+	uint64_t bloom;
+} PacketLogIndexEntry;
+
+static inline void plog_put_le(uint8_t *dst, uint64_t value, int bytes)
+{
+	int i;
+	for (i = 0; i < bytes; ++i) {
+		dst[i] = (uint8_t)(value >> (8 * i));
+	}
+}
+
+static inline uint64_t plog_get_le(const uint8_t *src, int bytes)
+{
+	uint64_t value = 0;
+	int i;
+	for (i = 0; i < bytes; ++i) {
+		value |= (uint64_t)src[i] << (8 * i);
+	}
+
+	return value;
+}
+
+static inline uint64_t plog_bloom(uint64_t address)
+{
+	uint64_t h = address * 0x9E3779B97F4A7C15ULL;
+	return (1ULL << (h >> 58)) | (1ULL << ((h >> 52) & 63));
+}
+
+/*
+ * Writer
+ */
+typedef struct {
+	FILE *log;
+	FILE *idx;
+	uint64_t offset;	// file offset of the next record
+	uint32_t block_records;
+	PacketLogIndexEntry block;
+} PacketLogWriter;
+
+static inline void plog_write_index_entry(PacketLogWriter *w)
+{
+	uint8_t buf[PLOG_INDEX_ENTRY_SIZE];
+
+	if (w->block_records == 0) return;
+
+	plog_put_le(buf, w->block.first_sample, 8);
+	plog_put_le(buf + 8, w->block.offset, 8);
+	plog_put_le(buf + 16, w->block.end, 8);
+	plog_put_le(buf + 24, w->block.bloom, 8);
+	fwrite(buf, sizeof(buf), 1, w->idx);
+	w->block_records = 0;
+}
+
+/*
+ * Create the log at path, and its index at path.idx, replacing any previous
+ * ones, or with resume set, append to the log of the job being resumed (which
+ * plog_rewind() then takes back to the checkpoint). Returns 0 on success, -1
+ * on error.
+ */
+static inline int plog_open(PacketLogWriter *w, const char *path,
+		uint32_t sample_rate, uint64_t start_time_ns, int resume)
+{
+	const char *mode = resume ? "ab" : "wb";
+	char idx_path[4096];
+	uint8_t hdr[PLOG_HEADER_SIZE];
+
+	memset(w, 0, sizeof(*w));
+	snprintf(idx_path, sizeof(idx_path), "%s.idx", path);
+
+	w->log = fopen(path, mode);
+	w->idx = fopen(idx_path, mode);
+	if (!w->log || !w->idx) {
+		if (w->log) fclose(w->log);
+		if (w->idx) fclose(w->idx);
+		return -1;
+	}
+	setvbuf(w->log, NULL, _IOFBF, 1 << 20);
+
+	fseek(w->log, 0, SEEK_END);
+	w->offset = (uint64_t)ftell(w->log);
+	if (w->offset == 0) {
+		memset(hdr, 0, sizeof(hdr));
+		memcpy(hdr, PLOG_MAGIC, sizeof(PLOG_MAGIC));
+		plog_put_le(hdr + 8, PLOG_VERSION, 4);
+		plog_put_le(hdr + 12, sample_rate, 4);
+		plog_put_le(hdr + 16, start_time_ns, 8);
+		fwrite(hdr, sizeof(hdr), 1, w->log);
+		w->offset = sizeof(hdr);
+	}
+
+	fseek(w->idx, 0, SEEK_END);
+	if (ftell(w->idx) == 0) {
+		memset(hdr, 0, PLOG_INDEX_HEADER_SIZE);
+		memcpy(hdr, PLOG_INDEX_MAGIC, sizeof(PLOG_INDEX_MAGIC));
+		plog_put_le(hdr + 8, PLOG_VERSION, 4);
+		plog_put_le(hdr + 12, PLOG_INDEX_INTERVAL, 4);
+		fwrite(hdr, PLOG_INDEX_HEADER_SIZE, 1, w->idx);
+	}
+
+	return 0;
+}
+
+static inline int plog_write(PacketLogWriter *w, const PacketLogRecord *r)
+{
+	uint8_t buf[2 + PLOG_RECORD_FIXED + PLOG_MAX_PAYLOAD];
+	size_t length = PLOG_RECORD_FIXED + r->payload_length;
+
+	if (r->payload_length > PLOG_MAX_PAYLOAD) return -1;
+
+	plog_put_le(buf, length, 2);
+	plog_put_le(buf + 2, r->sample, 8);
+	plog_put_le(buf + 10, r->address, 8);
+	plog_put_le(buf + 18, r->crc, 2);
+	buf[20] = r->channel;
+	buf[21] = r->address_length;
+	buf[22] = r->payload_length;
+	memcpy(buf + 23, r->payload, r->payload_length);
+
+	if (fwrite(buf, 2 + length, 1, w->log) != 1) return -1;
+
+	if (w->block_records == 0) {
+		w->block.first_sample = r->sample;
+		w->block.offset = w->offset;
+		w->block.bloom = 0;
+	}
+	w->block.bloom |= plog_bloom(r->address);
+	w->offset += 2 + length;
+	w->block.end = w->offset;
+
+	if (++w->block_records == PLOG_INDEX_INTERVAL) {
+		plog_write_index_entry(w);
+	}
+
+	return 0;
+}
+
+static inline void plog_flush(PacketLogWriter *w)
+{
+	fflush(w->log);
+	fflush(w->idx);
+}
+
+#if !defined(WIN32)
+/*
+ * Where the writer is, so that a resumed job can take the log back there (see
+ * checkpoint.h), dropping the records written since and the index entries
+ * that point to them.
+ */
+typedef struct {
+	uint64_t offset;
+	uint64_t idx_offset;
+	uint32_t block_records;
+	PacketLogIndexEntry block;
+} PacketLogPosition;
+
+static inline void plog_position(PacketLogWriter *w, PacketLogPosition *p)
+{
+	plog_flush(w);
+	memset(p, 0, sizeof(*p));
+	p->offset = w->offset;
+	p->idx_offset = (uint64_t)ftell(w->idx);
+	p->block_records = w->block_records;
+	p->block = w->block;
+}
+
+/* Returns 0, or -1 if the log is shorter than it was at p */
+static inline int plog_rewind(PacketLogWriter *w, const PacketLogPosition *p)
+{
+	struct stat st, idx_st;
+
+	plog_flush(w);
+	if (fstat(fileno(w->log), &st) < 0 || fstat(fileno(w->idx), &idx_st) < 0 ||
+			(uint64_t)st.st_size < p->offset ||
+			(uint64_t)idx_st.st_size < p->idx_offset) {
+		return -1;
+	}
+	if (ftruncate(fileno(w->log), (off_t)p->offset) < 0 ||
+			ftruncate(fileno(w->idx), (off_t)p->idx_offset) < 0) {
+		return -1;
+	}
+	fseek(w->log, 0, SEEK_END);
+	fseek(w->idx, 0, SEEK_END);
+
+	w->offset = p->offset;
+	w->block_records = p->block_records;
+	w->block = p->block;
+	return 0;
+}
+#endif /* !defined(WIN32) */
+
+static inline void plog_close(PacketLogWriter *w)
+{
+	if (!w->log) return;
+
+	// the index entry is written after the records it points to, so a torn
+	// write never leaves an entry pointing past the end of the log
+	fflush(w->log);
+	plog_write_index_entry(w);
+	fclose(w->log);
+	fclose(w->idx);
+	w->log = w->idx = NULL;
+}
+
+#if !defined(WIN32)
+/*
+ * Reader
+ *
+ * Both files are mapped read-only; iterating never copies or parses text, and
+ * seeking is a binary search over the index.
+ */
+typedef struct {
+	const uint8_t *base;
+	size_t size;
+	const uint8_t *index;
+	size_t index_entries;
+	size_t index_size;
+	size_t pos;
+	uint32_t sample_rate;
+	uint64_t start_time_ns;
+} PacketLogReader;
+
+static inline const uint8_t *plog_map(const char *path, size_t *size)
+{
+	struct stat st;
+	void *p;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) return NULL;
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) return NULL;
+
+	*size = st.st_size;
+	return (const uint8_t *)p;
+}
+
+static inline int plog_reader_open(PacketLogReader *r, const char *path)
+{
+	char idx_path[4096];
+
+	memset(r, 0, sizeof(*r));
+	r->base = plog_map(path, &r->size);
+	if (!r->base) return -1;
+
+	if (r->size < PLOG_HEADER_SIZE ||
+			memcmp(r->base, PLOG_MAGIC, sizeof(PLOG_MAGIC)) != 0 ||
+			plog_get_le(r->base + 8, 4) != PLOG_VERSION) {
+		munmap((void *)r->base, r->size);
+		r->base = NULL;
+		return -1;
+	}
+	r->sample_rate = (uint32_t)plog_get_le(r->base + 12, 4);
+	r->start_time_ns = plog_get_le(r->base + 16, 8);
+	madvise((void *)r->base, r->size, MADV_SEQUENTIAL);
+
+	// a missing or foreign index only costs speed
+	snprintf(idx_path, sizeof(idx_path), "%s.idx", path);
+	r->index = plog_map(idx_path, &r->index_size);
+	if (r->index && (r->index_size < PLOG_INDEX_HEADER_SIZE ||
+			memcmp(r->index, PLOG_INDEX_MAGIC, sizeof(PLOG_INDEX_MAGIC)))) {
+		munmap((void *)r->index, r->index_size);
+		r->index = NULL;
+	}
+	if (r->index) {
+		r->index_entries = (r->index_size - PLOG_INDEX_HEADER_SIZE) /
+			PLOG_INDEX_ENTRY_SIZE;
+	}
+
+	r->pos = PLOG_HEADER_SIZE;
+	return 0;
+}
+
+static inline void plog_reader_close(PacketLogReader *r)
+{
+	if (r->base) munmap((void *)r->base, r->size);
+	if (r->index) munmap((void *)r->index, r->index_size);
+	r->base = r->index = NULL;
+}
+
+static inline void plog_index_entry(const PacketLogReader *r, size_t i,
+		PacketLogIndexEntry *e)
+{
+	const uint8_t *p = r->index + PLOG_INDEX_HEADER_SIZE +
+		i * PLOG_INDEX_ENTRY_SIZE;
+
+	e->first_sample = plog_get_le(p, 8);
+	e->offset = plog_get_le(p + 8, 8);
+	e->end = plog_get_le(p + 16, 8);
+	e->bloom = plog_get_le(p + 24, 8);
+}
+
+/*
+ * Read the record at the current position. Returns 1 on success, 0 at EOF or
+ * at a torn or corrupt record.
+ */
+static inline int plog_next(PacketLogReader *r, PacketLogRecord *rec)
+{
+	const uint8_t *p;
+	size_t length;
+
+	if (r->pos + 2 > r->size) return 0;
+	p = r->base + r->pos;
+	length = (size_t)plog_get_le(p, 2);
+	if (length < PLOG_RECORD_FIXED || r->pos + 2 + length > r->size) {
+		return 0;	// torn tail record
+	}
+	if (p[22] > PLOG_MAX_PAYLOAD || PLOG_RECORD_FIXED + (size_t)p[22] > length) {
+		return 0;	// the payload would run past the record
+	}
+
+	rec->sample = plog_get_le(p + 2, 8);
+	rec->address = plog_get_le(p + 10, 8);
+	rec->crc = (uint16_t)plog_get_le(p + 18, 2);
+	rec->channel = p[20];
+	rec->address_length = p[21];
+	rec->payload_length = p[22];
+	rec->payload = p + 23;
+
+	r->pos += 2 + length;
+	return 1;
+}
+
+/* Index of the last block starting at or before offset, or -1 if none */
+static inline long plog_find_block(const PacketLogReader *r, uint64_t offset)
+{
+	PacketLogIndexEntry e;
+	size_t lo = 0, hi = r->index_entries;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		plog_index_entry(r, mid, &e);
+		if (e.offset <= offset) lo = mid + 1;
+		else hi = mid;
+	}
+
+	return (long)lo - 1;
+}
+
+/*
+ * Position the reader on the first record whose sample is not less than
+ * sample. Uses the index to get within one block, then scans.
+ */
+static inline void plog_seek_sample(PacketLogReader *r, uint64_t sample)
+{
+	PacketLogIndexEntry e;
+	PacketLogRecord rec;
+	size_t lo = 0, hi = r->index_entries, pos;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		plog_index_entry(r, mid, &e);
+		if (e.first_sample < sample) lo = mid + 1;
+		else hi = mid;
+	}
+
+	r->pos = PLOG_HEADER_SIZE;
+	if (lo > 0) {
+		plog_index_entry(r, lo - 1, &e);
+		r->pos = (size_t)e.offset;
+	}
+
+	for (pos = r->pos; plog_next(r, &rec); pos = r->pos) {
+		if (rec.sample >= sample) break;
+	}
+	r->pos = pos;
+}
+
+/*
+ * Like plog_next, but only returns records with the given address, skipping
+ * whole indexed blocks whose bloom word rules it out.
+ */
+static inline int plog_next_address(PacketLogReader *r, uint64_t address,
+		PacketLogRecord *rec)
+{
+	const uint64_t bloom = plog_bloom(address);
+	PacketLogIndexEntry e;
+	size_t checked_end = 0;
+
+	for (;;) {
+		if (r->pos >= checked_end) {
+			long i = plog_find_block(r, r->pos);
+
+			if (i >= 0) plog_index_entry(r, i, &e);
+			if (i >= 0 && r->pos < e.end) {
+				if ((e.bloom & bloom) != bloom) {
+					r->pos = (size_t)e.end;
+					continue;
+				}
+				checked_end = (size_t)e.end;
+			} else if ((size_t)(i + 1) < r->index_entries) {
+				// unindexed gap up to the next block
+				plog_index_entry(r, i + 1, &e);
+				checked_end = (size_t)e.offset;
+			} else {
+				checked_end = r->size;
+			}
+		}
+
+		if (!plog_next(r, rec)) return 0;
+		if (rec->address == address) return 1;
+	}
+}
+#endif /* !defined(WIN32) */
+
+#endif /* PACKETLOG_H */
@@ -0,0 +1,300 @@
+#ifndef PCAPNG_H
+#define PCAPNG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+/*
+ * PCAPNG writer for decoded ShockBurst packets
+ *
+ * Every file starts with a Section Header Block and one Interface Description
+ * Block (link type LINKTYPE_USER0, nanosecond timestamps), followed by one
+ * Enhanced Packet Block per packet. The packet data is a small pseudo header
+ * followed by the packet as it was on air (without the preamble):
+ *
+ * +-------------+-------------+--------------------+--------------------+
+ * | Version (1) | Channel (1) | Address length (1) | Payload length (1) |
+ * +-------------+-------------+--------------------+--------------------+
+ * | Threshold (4, signed) | Sample (8)                                  |
+ * +-----------------------+---------------------------------------------+
+ * | Address (3-5) | Payload (1-32) | CRC (2)                            |
+ * +---------------+----------------+------------------------------------+
+ *
+ * Threshold and sample are little endian; address and CRC are big endian, as
+ * they were transmitted. "Threshold" is the slicer level the packet was
+ * decoded with (the DC level of the frequency demodulated signal). antsniff.lua
+ * is a Wireshark dissector for this format.
+ *
+ * Blocks are serialized straight into one large staging buffer, which is
+ * written out with a single writev() together with the file headers when it
+ * fills up, so there is one syscall per few thousand packets. So that a live
+ * capture's file trails it by little, pcapng_poll() also writes the buffer
+ * out once PCAPNG_FLUSH_NS have passed since the last write. Files can be
+ * rotated by size and/or by (packet) time; rotated files are named
+ * <path>.<n>.
+ */
+
+#define PCAPNG_LINKTYPE 147	// LINKTYPE_USER0
+#define PCAPNG_HEADER_VERSION 1
+#define PCAPNG_PSEUDO_HEADER 16
+#define PCAPNG_MAX_PACKET (PCAPNG_PSEUDO_HEADER + 5 + 32 + 2)
+#define PCAPNG_BUFFER_SIZE (256 * 1024)
+#define PCAPNG_FLUSH_NS 1000000000ULL
+
+typedef struct {
+	uint64_t sample;
+	uint64_t address;
+	int32_t threshold;
+	uint16_t crc;
+	uint8_t channel;
+	uint8_t address_length;
+	uint8_t payload_length;
+	const uint8_t *payload;
+} PcapngPacket;
+
+typedef struct {
+	int fd;
+	char path[4096];
+	unsigned file_index;
+	uint64_t max_bytes;	// rotate after this many bytes (0: never)
+	uint64_t max_ns;	// rotate after this much packet time (0: never)
+	uint64_t file_bytes;
+	uint64_t file_start_ns;
+	uint64_t start_time_ns;	// wall clock time of sample 0
+	uint32_t sample_rate;
+	int headers_pending;
+	uint8_t *buf;
+	size_t used;
+	uint64_t flushed_ns;	// monotonic time of the last write
+} PcapngWriter;
+
+static inline uint64_t pcapng_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline void pcapng_put32(uint8_t *p, uint32_t v)
+{
+	memcpy(p, &v, 4);	// pcapng blocks are host endian
+}
+
+static inline void pcapng_put16(uint8_t *p, uint16_t v)
+{
+	memcpy(p, &v, 2);
+}
+
+/* Section Header Block + Interface Description Block */
+static inline size_t pcapng_file_headers(uint8_t *p)
+{
+	static const uint32_t shb[] = {
+		0x0A0D0D0A, 28, 0x1A2B3C4D, 0x00000001, 0xFFFFFFFF, 0xFFFFFFFF, 28
+	};
+	uint8_t *idb = p + sizeof(shb);
+
+	memcpy(p, shb, sizeof(shb));
+	// the 16 bit fields are host endian on their own, not packed in words
+	pcapng_put32(idb, 0x00000001);
+	pcapng_put32(idb + 4, 32);
+	pcapng_put16(idb + 8, PCAPNG_LINKTYPE);
+	pcapng_put16(idb + 10, 0);	// reserved
+	pcapng_put32(idb + 12, 0);	// snaplen: unlimited
+	pcapng_put16(idb + 16, 9);	// if_tsresol
+	pcapng_put16(idb + 18, 1);
+	pcapng_put32(idb + 20, 9);	// 10^-9: nanoseconds, padded to 32 bits
+	pcapng_put32(idb + 24, 0);	// opt_endofopt
+	pcapng_put32(idb + 28, 32);
+	return sizeof(shb) + 32;
+}
+
+static inline int pcapng_open_file(PcapngWriter *w)
+{
+	char name[4200];
+
+	if (w->max_bytes || w->max_ns) {
+		snprintf(name, sizeof(name), "%s.%u", w->path, w->file_index);
+	} else {
+		snprintf(name, sizeof(name), "%s", w->path);
+	}
+
+	w->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (w->fd < 0) return -1;
+
+	w->file_bytes = 0;
+	w->headers_pending = 1;
+	return 0;
+}
+
+/* Write the staging buffer (and the file headers, for a new file) */
+static inline int pcapng_flush(PcapngWriter *w)
+{
+	uint8_t headers[64];
+	struct iovec iov[2];
+	int n = 0;
+	size_t total = 0;
+
+	if (w->fd < 0) return -1;
+	if (w->headers_pending) {
+		iov[n].iov_base = headers;
+		iov[n].iov_len = pcapng_file_headers(headers);
+		total += iov[n++].iov_len;
+	}
+	if (w->used) {
+		iov[n].iov_base = w->buf;
+		iov[n].iov_len = w->used;
+		total += iov[n++].iov_len;
+	}
+
+	while (total > 0) {
+		ssize_t r = writev(w->fd, iov, n);
+		if (r < 0) {
+			// SIGINT/SIGTERM are handled without SA_RESTART
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		total -= r;
+		// partial write: advance the iovecs
+		while (r > 0 && n > 0) {
+			if ((size_t)r >= iov[0].iov_len) {
+				r -= iov[0].iov_len;
+				iov[0] = iov[1];
+				--n;
+			} else {
+				iov[0].iov_base = (uint8_t *)iov[0].iov_base + r;
+				iov[0].iov_len -= r;
+				r = 0;
+			}
+		}
+	}
+
+	w->headers_pending = 0;
+	w->used = 0;
+	w->flushed_ns = pcapng_now_ns();
+	return 0;
+}
+
+/* Write the staging buffer out if it has waited PCAPNG_FLUSH_NS */
+static inline int pcapng_poll(PcapngWriter *w)
+{
+	if (w->fd < 0 || w->used == 0) return 0;
+	if (pcapng_now_ns() - w->flushed_ns < PCAPNG_FLUSH_NS) return 0;
+	return pcapng_flush(w);
+}
+
+/*
+ * Open a writer. max_bytes and max_seconds enable rotation (0 disables each).
+ * Returns 0 on success, -1 on error.
+ */
+static inline int pcapng_open(PcapngWriter *w, const char *path,
+		uint32_t sample_rate, uint64_t start_time_ns,
+		uint64_t max_bytes, uint64_t max_seconds)
+{
+	memset(w, 0, sizeof(*w));
+	snprintf(w->path, sizeof(w->path), "%s", path);
+	w->sample_rate = sample_rate;
+	w->start_time_ns = start_time_ns;
+	w->max_bytes = max_bytes;
+	w->max_ns = max_seconds * 1000000000ULL;
+	w->fd = -1;
+	w->flushed_ns = pcapng_now_ns();
+
+	w->buf = (uint8_t *)malloc(PCAPNG_BUFFER_SIZE);
+	if (!w->buf) return -1;
+
+	if (pcapng_open_file(w) < 0) {
+		free(w->buf);
+		w->buf = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static inline void pcapng_close(PcapngWriter *w)
+{
+	if (w->fd >= 0) {
+		pcapng_flush(w);
+		close(w->fd);
+		w->fd = -1;
+	}
+	free(w->buf);
+	w->buf = NULL;
+}
+
+static inline int pcapng_write(PcapngWriter *w, const PcapngPacket *pkt)
+{
+	uint64_t ts = w->start_time_ns + (uint64_t)((double)pkt->sample *
+			1e9 / w->sample_rate);
+	uint32_t caplen = PCAPNG_PSEUDO_HEADER + pkt->address_length +
+		pkt->payload_length + 2;
+	uint32_t padded = (caplen + 3) & ~3U;
+	uint32_t block_len = 28 + padded + 4;
+	uint8_t *p;
+	int i;
+
+	if (w->fd < 0 || pkt->payload_length > 32 || pkt->address_length > 5) {
+		return -1;
+	}
+
+	// a packet older than the file (e.g. merged from another receiver)
+	// doesn't count towards its time limit
+	if (w->file_bytes == 0) w->file_start_ns = ts;
+	if (w->file_bytes > 0 &&
+			((w->max_bytes && w->file_bytes + block_len > w->max_bytes) ||
+			 (w->max_ns && ts >= w->file_start_ns &&
+			  ts - w->file_start_ns >= w->max_ns))) {
+		if (pcapng_flush(w) < 0) return -1;
+		close(w->fd);
+		++w->file_index;
+		if (pcapng_open_file(w) < 0) return -1;
+		w->file_start_ns = ts;
+	}
+
+	if (w->used + block_len > PCAPNG_BUFFER_SIZE && pcapng_flush(w) < 0) {
+		return -1;
+	}
+
+	// Enhanced Packet Block
+	p = w->buf + w->used;
+	pcapng_put32(p, 0x00000006);
+	pcapng_put32(p + 4, block_len);
+	pcapng_put32(p + 8, 0);	// interface
+	pcapng_put32(p + 12, (uint32_t)(ts >> 32));
+	pcapng_put32(p + 16, (uint32_t)ts);
+	pcapng_put32(p + 20, caplen);
+	pcapng_put32(p + 24, caplen);
+	p += 28;
+
+	p[0] = PCAPNG_HEADER_VERSION;
+	p[1] = pkt->channel;
+	p[2] = pkt->address_length;
+	p[3] = pkt->payload_length;
+	for (i = 0; i < 4; ++i) p[4 + i] = (uint8_t)((uint32_t)pkt->threshold >> (8 * i));
+	for (i = 0; i < 8; ++i) p[8 + i] = (uint8_t)(pkt->sample >> (8 * i));
+	p += PCAPNG_PSEUDO_HEADER;
+
+	for (i = 0; i < pkt->address_length; ++i) {
+		*p++ = (uint8_t)(pkt->address >> (8 * (pkt->address_length - 1 - i)));
+	}
+	memcpy(p, pkt->payload, pkt->payload_length);
+	p += pkt->payload_length;
+	*p++ = (uint8_t)(pkt->crc >> 8);
+	*p++ = (uint8_t)pkt->crc;
+	memset(p, 0, padded - caplen);
+	p += padded - caplen;
+	pcapng_put32(p, block_len);
+
+	w->used += block_len;
+	w->file_bytes += block_len;
+	return 0;
+}
+
+#endif /* PCAPNG_H */
@@ -0,0 +1,132 @@
+#ifndef RTTHREAD_H
+#define RTTHREAD_H
+
+/* cpu_set_t and the affinity calls need _GNU_SOURCE (C++ compilers define
+ * it anyway); C users have to define it before their first #include */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+/*
+ * Thread placement for real time decoding (Linux only)
+ *
+ * At high sample rates the decoder has a few hundred microseconds of slack
+ * per buffer: if the scheduler moves it to another core, or lets something
+ * else run first, the SDR's buffers overflow and samples are lost. These
+ * helpers pin the calling thread to a set of cores, optionally give it a
+ * SCHED_FIFO priority, and check whether its input pipe has filled up.
+ *
+ * CPU lists use the taskset/cpuset syntax: "2", "2,3" or "0-3,8".
+ *
+ * Memory is placed on the NUMA node of the core that first touches it, so
+ * buffers that are allocated (and written) after pinning a thread, or while
+ * it is temporarily pinned (see rtthread_get_affinity()), are local to the
+ * cores that decode them; no libnuma is needed for that.
+ */
+
+/* Parse a CPU list into set; returns the number of CPUs, or -1 if invalid */
+static inline int rtthread_parse_cpus(const char *list, cpu_set_t *set)
+{
+	const char *p = list;
+
+	CPU_ZERO(set);
+	while (*p) {
+		char *end;
+		long first, last;
+
+		first = last = strtol(p, &end, 10);
+		if (end == p || first < 0) return -1;
+		p = end;
+		if (*p == '-') {
+			++p;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first) return -1;
+			p = end;
+		}
+		if (last >= CPU_SETSIZE) return -1;
+		for (; first <= last; ++first) CPU_SET((int)first, set);
+
+		if (*p == ',') ++p;
+		else if (*p) return -1;
+	}
+
+	return CPU_COUNT(set) ? CPU_COUNT(set) : -1;
+}
+
+static inline int rtthread_get_affinity(cpu_set_t *set)
+{
+	errno = pthread_getaffinity_np(pthread_self(), sizeof(*set), set);
+	return errno ? -1 : 0;
+}
+
+static inline int rtthread_set_affinity(const cpu_set_t *set)
+{
+	errno = pthread_setaffinity_np(pthread_self(), sizeof(*set), set);
+	return errno ? -1 : 0;
+}
+
+/* Pin the calling thread to the CPUs in list */
+static inline int rtthread_pin(const char *list)
+{
+	cpu_set_t set;
+
+	if (rtthread_parse_cpus(list, &set) < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	return rtthread_set_affinity(&set);
+}
+
+/*
+ * Run the calling thread with SCHED_FIFO at priority (clamped to 1-99), or
+ * with the normal time sharing policy if priority is 0. Needs CAP_SYS_NICE
+ * or an RLIMIT_RTPRIO of at least priority.
+ */
+static inline int rtthread_set_priority(int priority)
+{
+	struct sched_param param;
+	int policy = priority > 0 ? SCHED_FIFO : SCHED_OTHER;
+
+	memset(&param, 0, sizeof(param));
+	if (priority > 0) {
+		int lo = sched_get_priority_min(SCHED_FIFO);
+		int hi = sched_get_priority_max(SCHED_FIFO);
+		param.sched_priority = priority < lo ? lo : priority > hi ? hi : priority;
+	}
+
+	errno = pthread_setschedparam(pthread_self(), policy, &param);
+	return errno ? -1 : 0;
+}
+
+/* The capacity of the pipe fd in bytes, or -1 if fd isn't a pipe */
+static inline int rtthread_pipe_size(int fd)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) < 0 || !S_ISFIFO(st.st_mode)) return -1;
+#ifdef F_GETPIPE_SZ
+	return fcntl(fd, F_GETPIPE_SZ);
+#else
+	return 65536;
+#endif
+}
+
+/*
+ * 1 if the pipe fd (of capacity size) is full, i.e. its writer is blocked
+ * because the reader fell behind, and a capture tool like rtl_sdr is losing
+ * samples in its own buffers; 0 otherwise.
+ */
+static inline int rtthread_pipe_full(int fd, int size)
+{
+	int queued;
+
+	if (size <= 0 || ioctl(fd, FIONREAD, &queued) < 0) return 0;
+	return queued >= size;
+}
+
+#endif /* RTTHREAD_H */
@@ -0,0 +1,308 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Shared memory packet feed
+ *
+ * The decoder publishes packets into a POSIX shared memory object (see
+ * shm_open(3); the name starts with a slash, e.g. "/antsniff"), which local
+ * consumers map and read directly: no pipes, no text formatting, and no
+ * syscalls per packet on either side.
+ *
+ * The object is a 128 byte header followed by a power of two number of fixed,
+ * 128 byte records:
+ *
+ * header:
+ * +-----------+-------------+-----------------+---------------+------------+
+ * | Magic (8) | Version (4) | Record size (4) | Capacity (8)  | State (4)  |
+ * +-----------+-------------+-----------------+---------------+------------+
+ * | Sample rate (4) | Start time (8, ns) | ... | Head (8, at offset 64)    |
+ * +-----------------+--------------------+-----+---------------------------+
+ *
+ * record:
+ * +---------+------------+-------------+----------------+---------------+
+ * | Seq (8) | Sample (8) | Address (8) | Time (8, ns)   | Threshold (4) |
+ * +---------+------------+-------------+----------------+---------------+
+ * | Margin (4) | CRC (2) | Channel (1) | Address length (1) |            |
+ * +------------+---------+-------------+--------------------+------------+
+ * | Payload length (1) | (3) | Payload (32) | Reserved (48)             |
+ * +--------------------+-----+--------------+---------------------------+
+ *
+ * All fields are host endian. There is a single writer, which never waits
+ * for anyone: record n goes to slot n % capacity, overwriting whatever was
+ * there. Each slot is a seqlock: the writer sets its Seq to 2n + 1 before
+ * writing it and to 2n + 2 after, then publishes Head = n + 1. Readers keep
+ * their own cursor, copy a record out, and check that its Seq did not change
+ * meanwhile; a reader that falls more than a ring behind skips ahead and
+ * counts the records it lost. So any number of readers can follow the feed,
+ * and a slow one only ever loses packets itself.
+ *
+ * Time is the wall clock time of the packet's sample, derived from the start
+ * time and the sample rate. State is 1 while the writer is running, and 2
+ * after it closed the feed.
+ */
+
+#define SHMRING_MAGIC "ANTSHM1"
+#define SHMRING_VERSION 1
+#define SHMRING_HEADER_SIZE 128
+#define SHMRING_RECORD_SIZE 128
+#define SHMRING_MAX_PAYLOAD 32
+
+#define SHMRING_RUNNING 1
+#define SHMRING_CLOSED 2
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t capacity;	// in records, a power of two
+	uint32_t state;
+	uint32_t sample_rate;
+	uint64_t start_time_ns;	// wall clock time of sample 0
+	uint8_t reserved1[24];
+	uint64_t head;	// records written, on its own cache line
+	uint8_t reserved2[56];
+} ShmRingHeader;
+
+typedef struct {
+	uint64_t seq;
+	uint64_t sample;
+	uint64_t address;
+	uint64_t time_ns;
+	int32_t threshold;
+	int32_t margin;
+	uint16_t crc;
+	uint8_t channel;
+	uint8_t address_length;
+	uint8_t payload_length;
+	uint8_t pad[3];
+	uint8_t payload[SHMRING_MAX_PAYLOAD];
+	uint8_t reserved[48];
+} ShmRingRecord;
+
+typedef struct {
+	uint64_t sample;
+	uint64_t address;
+	int32_t threshold;
+	int32_t margin;
+	uint16_t crc;
+	uint8_t channel;
+	uint8_t address_length;
+	uint8_t payload_length;
+	const uint8_t *payload;
+} ShmRingPacket;
+
+typedef struct {
+	ShmRingHeader *header;
+	ShmRingRecord *records;
+	size_t mapped;
+	char name[256];
+	uint64_t head;
+} ShmRingWriter;
+
+typedef struct {
+	const ShmRingHeader *header;
+	const ShmRingRecord *records;
+	size_t mapped;
+	uint64_t cursor;	// next record to read
+	uint64_t lost;	// records overwritten before they were read
+} ShmRingReader;
+
+#define shmring_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define shmring_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/*
+ * Create (or replace) the feed name with room for capacity records (rounded
+ * up to a power of two). Returns 0 on success, -1 on error.
+ */
+static inline int shmring_open(ShmRingWriter *w, const char *name,
+		uint64_t capacity, uint32_t sample_rate, uint64_t start_time_ns)
+{
+	uint64_t n = 1024;
+	int fd;
+	void *p;
+
+	while (n < capacity) n <<= 1;
+
+	memset(w, 0, sizeof(*w));
+	snprintf(w->name, sizeof(w->name), "%s", name);
+	w->mapped = SHMRING_HEADER_SIZE + n * SHMRING_RECORD_SIZE;
+
+	// a fresh object, so readers of a previous run keep their old mapping
+	shm_unlink(name);
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0) return -1;
+	if (ftruncate(fd, (off_t)w->mapped) < 0) {
+		close(fd);
+		shm_unlink(name);
+		return -1;
+	}
+
+	p = mmap(NULL, w->mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		shm_unlink(name);
+		return -1;
+	}
+
+	w->header = (ShmRingHeader *)p;
+	w->records = (ShmRingRecord *)((uint8_t *)p + SHMRING_HEADER_SIZE);
+	memcpy(w->header->magic, SHMRING_MAGIC, 8);
+	w->header->version = SHMRING_VERSION;
+	w->header->record_size = SHMRING_RECORD_SIZE;
+	w->header->capacity = n;
+	w->header->sample_rate = sample_rate;
+	w->header->start_time_ns = start_time_ns;
+	shmring_store(&w->header->state, (uint32_t)SHMRING_RUNNING);
+
+	return 0;
+}
+
+/* Publish a packet; never blocks */
+static inline void shmring_write(ShmRingWriter *w, const ShmRingPacket *pkt)
+{
+	ShmRingRecord *r = &w->records[w->head & (w->header->capacity - 1)];
+	uint64_t n = w->head;
+	uint64_t rate = w->header->sample_rate;
+	uint8_t length = pkt->payload_length > SHMRING_MAX_PAYLOAD ?
+		SHMRING_MAX_PAYLOAD : pkt->payload_length;
+
+	__atomic_store_n(&r->seq, 2 * n + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	r->sample = pkt->sample;
+	r->address = pkt->address;
+	// in whole seconds and the rest: sample * 1e9 overflows after 2.5 hours
+	// at 2 Msps
+	r->time_ns = w->header->start_time_ns + (rate ?
+			pkt->sample / rate * 1000000000ULL +
+			pkt->sample % rate * 1000000000ULL / rate : 0);
+	r->threshold = pkt->threshold;
+	r->margin = pkt->margin;
+	r->crc = pkt->crc;
+	r->channel = pkt->channel;
+	r->address_length = pkt->address_length;
+	r->payload_length = length;
+	memcpy(r->payload, pkt->payload, length);
+
+	shmring_store(&r->seq, 2 * n + 2);
+	shmring_store(&w->header->head, n + 1);
+	w->head = n + 1;
+}
+
+/* Mark the feed closed, and remove its name (mapped readers keep reading) */
+static inline void shmring_close(ShmRingWriter *w)
+{
+	if (!w->header) return;
+
+	shmring_store(&w->header->state, (uint32_t)SHMRING_CLOSED);
+	munmap(w->header, w->mapped);
+	shm_unlink(w->name);
+	w->header = NULL;
+}
+
+/*
+ * Attach to the feed name, starting at the oldest record still in the ring
+ * (or the newest, with from_now). Returns 0 on success, -1 on error.
+ */
+static inline int shmring_reader_open(ShmRingReader *r, const char *name,
+		int from_now)
+{
+	struct stat st;
+	const ShmRingHeader *h;
+	void *p;
+	uint64_t head;
+	int fd;
+
+	memset(r, 0, sizeof(*r));
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) return -1;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < SHMRING_HEADER_SIZE) {
+		close(fd);
+		return -1;
+	}
+
+	p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) return -1;
+
+	h = (const ShmRingHeader *)p;
+	if (memcmp(h->magic, SHMRING_MAGIC, 8) != 0 ||
+			h->version != SHMRING_VERSION ||
+			h->record_size != SHMRING_RECORD_SIZE ||
+			SHMRING_HEADER_SIZE + h->capacity * SHMRING_RECORD_SIZE >
+			(uint64_t)st.st_size) {
+		munmap(p, (size_t)st.st_size);
+		return -1;
+	}
+
+	r->header = h;
+	r->records = (const ShmRingRecord *)((const uint8_t *)p +
+			SHMRING_HEADER_SIZE);
+	r->mapped = (size_t)st.st_size;
+
+	head = shmring_load(&h->head);
+	if (from_now) r->cursor = head;
+	else r->cursor = head > h->capacity ? head - h->capacity : 0;
+
+	return 0;
+}
+
+static inline void shmring_reader_close(ShmRingReader *r)
+{
+	if (r->header) munmap((void *)r->header, r->mapped);
+	r->header = NULL;
+}
+
+/* Whether the writer closed the feed */
+static inline int shmring_closed(const ShmRingReader *r)
+{
+	return shmring_load(&r->header->state) == SHMRING_CLOSED;
+}
+
+/*
+ * Copy the next record into rec. Returns 1 if there was one, 0 if the reader
+ * is caught up (poll again later). Never blocks the writer.
+ */
+static inline int shmring_read(ShmRingReader *r, ShmRingRecord *rec)
+{
+	const uint64_t capacity = r->header->capacity;
+
+	for (;;) {
+		uint64_t head = shmring_load(&r->header->head);
+		const ShmRingRecord *slot;
+		uint64_t seq;
+
+		if (r->cursor >= head) return 0;
+		if (head - r->cursor > capacity) {
+			r->lost += head - capacity - r->cursor;
+			r->cursor = head - capacity;
+		}
+
+		slot = &r->records[r->cursor & (capacity - 1)];
+		seq = shmring_load(&slot->seq);
+		if (seq == 2 * r->cursor + 2) {
+			memcpy(rec, slot, sizeof(*rec));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq) {
+				++r->cursor;
+				return 1;
+			}
+		}
+
+		// lapped while reading: the slot already holds a newer record
+		++r->lost;
+		++r->cursor;
+	}
+}
+
+#endif /* SHMRING_H */
@@ -0,0 +1,577 @@
+#pragma once
+#include "antsniff.h"
+#include "devicecache.hpp"
+#include "timeline.hpp"
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+namespace antsniff {
+
+/* CRC-16-CCITT (initial value 0xffff), as used by ShockBurst */
+inline uint16_t crc16(const uint8_t *data, size_t length)
+{
+	uint16_t crc = 0xffff;
+
+	while (length--) {
+		crc ^= *data++ << 8;
+		for (int i = 0; i < 8; ++i)
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+
+	return crc;
+}
+
+/*
+ * The sample types the decoder runs on natively, so that e.g. RTL-SDR's
+ * 8 bit samples aren't widened before they go through the ring buffer.
+ * Levels (the slicer threshold) are computed in Level; for the packets they
+ * are reported in int16 sample units, so a packet looks the same whatever
+ * the decoder's input was. saturation() turns the |threshold| at or above
+ * which a preamble is rejected from int16 units into Level.
+ */
+template <typename T> struct ShockBurstSample;
+
+template <> struct ShockBurstSample<int16_t>
+{
+	typedef int32_t Level;
+	typedef int64_t Sum;
+	static Level saturation(int32_t level) { return level; }
+	static int32_t toInt16(Level level) { return level; }
+	static Level fromInt16(int32_t level) { return level; }
+};
+
+template <> struct ShockBurstSample<int8_t>
+{
+	typedef int32_t Level;
+	typedef int64_t Sum;
+	// 256 * |threshold| < level
+	static Level saturation(int32_t level) { return (level + 255) / 256; }
+	static int32_t toInt16(Level level) { return level * 256; }
+	static Level fromInt16(int32_t level) { return level / 256; }
+};
+
+/* Frequency demodulated to radians, between -pi and +pi */
+template <> struct ShockBurstSample<float>
+{
+	typedef float Level;
+	typedef double Sum;
+	static Level saturation(int32_t level) { return float(level / scale()); }
+	static int32_t toInt16(Level level) { return int32_t(level * scale()); }
+	static Level fromInt16(int32_t level) { return float(level / scale()); }
+	static double scale(void) { return (1 << 15) / 3.14159265358979323846; }
+};
+
+/* The detection settings the decoder has always used (see antsniff.h) */
+inline antsniff_decoder_params shockBurstDefaults(void)
+{
+	antsniff_decoder_params params;
+	params.size = sizeof(params);
+	params.ring_size = 1000;
+	params.threshold_window = 16;
+	params.saturation = 15500;
+	params.transitions = 4;
+	params.initial_skip = 1000;
+	params.packet_skip = 20;
+	params.known_devices = 0;
+	return params;
+}
+
+/*
+ * The part of the decoder that doesn't depend on the sample type: the
+ * packet lengths, the detection settings, the sample count, the last packet
+ * found and the known devices. Code that takes any decoder (e.g. the Pothos block, which
+ * picks the sample type from its input) holds one of these.
+ */
+class ShockBurstDecoderBase
+{
+public:
+	static const int SAMPLES_PER_SYMBOL = 2;
+	// known devices tried after a CRC failure, most recently heard first
+	static const size_t REACQUIRE_DEVICES = 4;
+
+	virtual ~ShockBurstDecoderBase(void)
+	{ }
+
+	/* The last packet found */
+	const antsniff_packet &packet(void) const
+	{
+		return _packet;
+	}
+
+	/*
+	 * Index of the last sample (the end of the CRC) of the last packet found.
+	 * A packet is only found once it has moved through the ring, so this is
+	 * a bit less than its "sample".
+	 */
+	uint64_t packetEnd(void) const
+	{
+		return _packet.sample - _params.ring_size + packetSpan(ADDRESS_LENGTH,
+				PAYLOAD_LENGTH);
+	}
+
+	uint64_t samples(void) const
+	{
+		return _samples;
+	}
+
+	/* Preambles that failed the CRC check */
+	uint64_t falsePreambles(void) const
+	{
+		return _falsePreambles;
+	}
+
+	const antsniff_decoder_params &params(void) const
+	{
+		return _params;
+	}
+
+	/* The devices heard most recently, and their slicer levels */
+	const DeviceCache &devices(void) const
+	{
+		return _devices;
+	}
+
+	/* Packets recovered after a CRC failure at a known device's level */
+	uint64_t reacquired(void) const
+	{
+		return _reacquired;
+	}
+
+	/* Samples from the start of the preamble to the end of the CRC */
+	static size_t packetSpan(uint8_t addressLength, uint8_t payloadLength)
+	{
+		return (8 + (addressLength + payloadLength + 2) * 8) *
+			SAMPLES_PER_SYMBOL;
+	}
+
+protected:
+	const uint8_t ADDRESS_LENGTH;
+	const uint8_t PAYLOAD_LENGTH;
+	const antsniff_decoder_params _params;
+
+	uint64_t _samples;
+	uint64_t _falsePreambles;
+	uint64_t _reacquired;
+	antsniff_packet _packet;
+	DeviceCache _devices;
+
+	ShockBurstDecoderBase(uint8_t addressLength, uint8_t payloadLength,
+			const antsniff_decoder_params &params):
+		ADDRESS_LENGTH(addressLength),
+		PAYLOAD_LENGTH(payloadLength),
+		_params(params),
+		_samples(0),
+		_falsePreambles(0),
+		_reacquired(0),
+		_devices(params.known_devices)
+	{
+		if (addressLength < 3 || addressLength > ANTSNIFF_MAX_ADDRESS ||
+				payloadLength < 1 || payloadLength > ANTSNIFF_MAX_PAYLOAD)
+		{
+			throw std::invalid_argument("ShockBurstDecoder: invalid length");
+		}
+
+		// the whole packet must be in the ring when it's decoded
+		if (params.ring_size < packetSpan(addressLength, payloadLength) ||
+				params.threshold_window < 1 ||
+				params.threshold_window > params.ring_size ||
+				params.saturation < 1 || params.transitions > 8 ||
+				params.initial_skip > INT32_MAX || params.packet_skip > INT32_MAX ||
+				params.known_devices > 256)
+		{
+			throw std::invalid_argument("ShockBurstDecoder: invalid parameters");
+		}
+
+		std::memset(&_packet, 0, sizeof(_packet));
+	}
+};
+
+/*
+ * ShockBurst decoder for frequency demodulated samples at 2 Msps (2 samples per
+ * symbol), of type T (see ShockBurstSample), with the detection settings in
+ * params.
+ *
+ * Samples go through a ring buffer, and at every sample the decoder checks for
+ * a preamble, slices the address, payload and CRC fields, and checks the CRC.
+ * The ring is stored twice back to back, so the window starting at the head
+ * is always contiguous and indexing it needs no modulo.
+ */
+template <typename T>
+class BasicShockBurstDecoder : public ShockBurstDecoderBase
+{
+public:
+	typedef typename ShockBurstSample<T>::Level Level;
+
+	BasicShockBurstDecoder(uint8_t addressLength, uint8_t payloadLength,
+			const antsniff_decoder_params &params = shockBurstDefaults()):
+		ShockBurstDecoderBase(addressLength, payloadLength, params),
+		_ringSize(params.ring_size),
+		_head(_ringSize - 1),
+		_buffer(new T[2 * _ringSize]()),
+		_skip(int(params.initial_skip)),
+		_threshold(0),
+		_window(int(params.threshold_window)),
+		_transitions(int(params.transitions)),
+		_windowShift(-1),
+		_saturation(Sample::saturation(params.saturation))
+	{
+		for (int shift = 0; shift < 31; ++shift) {
+			if (_window == 1 << shift) _windowShift = shift;
+		}
+	}
+
+	/* Feed one sample; returns true if it completed a packet (see packet()) */
+	inline bool feedOne(T sample)
+	{
+		_head = _head + 1 == _ringSize ? 0 : _head + 1;
+		_buffer[_head] = _buffer[_head + _ringSize] = sample;
+		++_samples;
+
+		if (--_skip < 1) {
+			if (decodePacket(_samples)) {
+				_skip = int(_params.packet_skip);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/* Feed count samples, calling fn(packet) for every packet found */
+	template <typename Fn>
+	size_t feed(const T *samples, size_t count, Fn fn)
+	{
+		size_t found = 0;
+		for (size_t i = 0; i < count; ++i) {
+			if (feedOne(samples[i])) {
+				fn(_packet);
+				++found;
+			}
+		}
+		return found;
+	}
+
+	/*
+	 * Pass over count samples without decoding them, e.g. to shed load. The
+	 * sample count moves on, and decoding resumes once the ring has filled
+	 * up again, so no packet is sliced across the gap.
+	 */
+	void skip(uint64_t count)
+	{
+		if (count == 0) return;
+		_samples += count;
+		_skip = int(_ringSize);
+	}
+
+	/* The slicer level at the last preamble check, in sample units */
+	Level threshold(void) const
+	{
+		return _threshold;
+	}
+
+	/*
+	 * Everything the decoder's output depends on: the ring buffer, the
+	 * threshold, the skip counter, the counts, the last packet and the known
+	 * devices, in host byte order (a state is restored on the
+	 * machine that saved it). saveState() writes it to buffer if it's at
+	 * least stateSize() bytes, and returns stateSize(); restoreState()
+	 * returns false, and leaves the decoder as it was, if the state is not
+	 * one of a decoder of this type, these lengths, this ring size and
+	 * this many known devices.
+	 */
+	size_t stateSize(void) const
+	{
+		return 4 + 4 + 3 * sizeof(uint64_t) + sizeof(int) + sizeof(Level) +
+			sizeof(antsniff_packet) + 2 * _ringSize * sizeof(T) +
+			_devices.stateSize();
+	}
+
+	size_t saveState(uint8_t *buffer, size_t size) const
+	{
+		if (size < stateSize()) return stateSize();
+
+		const uint32_t head = uint32_t(_head);
+		buffer[0] = ADDRESS_LENGTH;
+		buffer[1] = PAYLOAD_LENGTH;
+		buffer[2] = uint8_t(sizeof(T));
+		buffer[3] = 0;
+		uint8_t *p = buffer + 4;
+		p = put(p, &head, sizeof(head));
+		p = put(p, &_samples, sizeof(_samples));
+		p = put(p, &_falsePreambles, sizeof(_falsePreambles));
+		p = put(p, &_reacquired, sizeof(_reacquired));
+		p = put(p, &_skip, sizeof(_skip));
+		p = put(p, &_threshold, sizeof(_threshold));
+		p = put(p, &_packet, sizeof(_packet));
+		p = put(p, _buffer.get(), 2 * _ringSize * sizeof(T));
+		_devices.save(p);
+		return stateSize();
+	}
+
+	bool restoreState(const uint8_t *buffer, size_t size)
+	{
+		if (size != stateSize() || buffer[0] != ADDRESS_LENGTH ||
+				buffer[1] != PAYLOAD_LENGTH || buffer[2] != sizeof(T))
+		{
+			return false;
+		}
+
+		uint32_t head;
+		std::memcpy(&head, buffer + 4, sizeof(head));
+		const uint8_t *devices = buffer + stateSize() - _devices.stateSize();
+		if (head >= _ringSize || !_devices.restore(devices)) return false;
+
+		const uint8_t *p = buffer + 4 + sizeof(head);
+		_head = head;
+		p = get(p, &_samples, sizeof(_samples));
+		p = get(p, &_falsePreambles, sizeof(_falsePreambles));
+		p = get(p, &_reacquired, sizeof(_reacquired));
+		p = get(p, &_skip, sizeof(_skip));
+		p = get(p, &_threshold, sizeof(_threshold));
+		p = get(p, &_packet, sizeof(_packet));
+		get(p, _buffer.get(), 2 * _ringSize * sizeof(T));
+		return true;
+	}
+
+private:
+	typedef ShockBurstSample<T> Sample;
+
+	const size_t _ringSize;
+	size_t _head;
+	std::unique_ptr<T[]> _buffer;
+	int _skip;
+	Level _threshold;
+	const int _window;
+	const int _transitions;
+	int _windowShift;	// log2(_window), or -1 if it's not a power of 2
+	const Level _saturation;
+
+	/*
+	 * sum / window, rounded towards zero; with a shift where possible, as a
+	 * division per sample would show in the throughput
+	 */
+	static inline int32_t divide(int32_t sum, int window, int shift)
+	{
+		if (shift < 0) return sum / window;
+		return (sum + (sum < 0 ? (1 << shift) - 1 : 0)) >> shift;
+	}
+
+	static inline float divide(float sum, int window, int)
+	{
+		return sum / window;
+	}
+
+	static uint8_t *put(uint8_t *dst, const void *src, size_t size)
+	{
+		std::memcpy(dst, src, size);
+		return dst + size;
+	}
+
+	static const uint8_t *get(const uint8_t *src, void *dst, size_t size)
+	{
+		std::memcpy(dst, src, size);
+		return src + size;
+	}
+
+	/* Sample l of the window starting at the ring head */
+	inline T RB(size_t l) const
+	{
+		return _buffer[_head + l];
+	}
+
+	/*
+	 * Quantize symbol at location l by checking whether it's over the
+	 * threshold.
+	 */
+	inline bool quantize(int l) const
+	{
+		return RB(l * SAMPLES_PER_SYMBOL) > _threshold;
+	}
+
+	/* Extract quantization threshold from preamble sequence */
+	inline Level extractThreshold(void) const
+	{
+		Level threshold = 0;
+		if (_window != 8 * SAMPLES_PER_SYMBOL) return extractThreshold(_window);
+
+		// the usual window, unrolled
+		for (int c = 0; c < 8 * SAMPLES_PER_SYMBOL; c++) {
+			threshold += Level(RB(c));
+		}
+		return threshold / (8 * SAMPLES_PER_SYMBOL);
+	}
+
+	Level extractThreshold(int window) const
+	{
+		Level threshold = 0;
+		for (int c = 0; c < window; c++) {
+			threshold += Level(RB(c));
+		}
+
+		return divide(threshold, window, _windowShift);
+	}
+
+	/* Identify preamble sequence */
+	inline bool detectPreamble(void) const
+	{
+		int transitions = 0;
+
+		// preamble sequence is based on the 9th symbol (either 0x55 or 0xAA)
+		if (quantize(9)) {
+			for (int c = 0; c < 8; c++) {
+				transitions += quantize(c) > quantize(c + 1);
+			}
+		} else {
+			for (int c = 0; c < 8; c++) {
+				transitions += quantize(c) < quantize(c + 1);
+			}
+		}
+
+		return transitions == _transitions &&
+			std::abs(_threshold) < _saturation;
+	}
+
+	/* Extract byte from ring buffer starting location l */
+	inline uint8_t extractByte(int l) const
+	{
+		uint8_t byte = 0;
+		for (int c = 0; c < 8; c++) {
+			byte |= quantize(l + c) << (7 - c);
+		}
+
+		return byte;
+	}
+
+	/* Mean distance from the threshold of count symbols from location l */
+	inline int32_t extractMargin(int l, int count) const
+	{
+		typename Sample::Sum margin = 0;
+		for (int c = 0; c < count; c++) {
+			margin += std::abs(Level(RB((l + c) * SAMPLES_PER_SYMBOL)) -
+					_threshold);
+		}
+
+		return Sample::toInt16(Level(margin / count));
+	}
+
+	/* Extract count bytes from ring buffer starting location l into buffer*/
+	inline void extractBytes(int l, uint8_t *buffer, int count) const
+	{
+		for (int t = 0; t < count; t++) {
+			buffer[t] = extractByte(l + t * 8);
+		}
+	}
+
+	/* Whether the CRC of the length bytes sliced into buffer is right */
+	static inline bool crcValid(const uint8_t *buffer, int length)
+	{
+		return crc16(buffer, length) == (buffer[length] << 8 | buffer[length + 1]);
+	}
+
+	/* Whether the address sliced from the ring is address */
+	inline bool matchAddress(uint64_t address) const
+	{
+		for (int i = 0; i < ADDRESS_LENGTH; ++i) {
+			uint8_t byte = uint8_t(address >> (ADDRESS_LENGTH - 1 - i) * 8);
+			if (extractByte(8 + i * 8) != byte) return false;
+		}
+		return true;
+	}
+
+	/*
+	 * CRC failure recovery. A preamble that failed the CRC check may still be
+	 * a packet of a known device, sliced at the wrong level: the threshold is
+	 * taken from just 16 samples, and noise on those moves it more than a
+	 * weak signal can take. So the preamble is sliced again at the learned
+	 * level of the REACQUIRE_DEVICES devices heard most recently, and if the
+	 * address is the device's (checked first, a byte at a time, which costs
+	 * a few comparisons for the others), the rest and the CRC. This only
+	 * runs after a CRC failure, which on a noisy channel is most preambles,
+	 * so the devices tried are capped: the ones heard most recently are the
+	 * ones likely to be transmitting. On success, buffer holds the packet,
+	 * and the threshold is the level it was sliced at.
+	 */
+	bool reacquire(uint8_t *buffer, int length)
+	{
+		const Level measured = _threshold;
+		for (size_t i = 0; i < _devices.size() && i < REACQUIRE_DEVICES; ++i) {
+			const DeviceCache::Device &device = _devices[i];
+			_threshold = Sample::fromInt16(device.level);
+			if (_threshold == measured || !matchAddress(device.address)) {
+				continue;
+			}
+
+			for (int b = 0; b < ADDRESS_LENGTH; ++b) {
+				buffer[b] = uint8_t(device.address >> (ADDRESS_LENGTH - 1 - b) * 8);
+			}
+			extractBytes(8 + ADDRESS_LENGTH * 8, buffer + ADDRESS_LENGTH,
+					length - ADDRESS_LENGTH + 2);
+			if (crcValid(buffer, length)) {
+				++_reacquired;
+				return true;
+			}
+		}
+
+		_threshold = measured;
+		return false;
+	}
+
+	/*
+	 * ShockBurst packet format (length in bytes in parenthesis):
+	 *
+	 * +--------------+---------------+----------------------------+-----------+
+	 * | Preamble (1) | Address (3-5) | Payload (1-32)             | CRC (1-2) |
+	 * +--------------+---------------+----------------------------+-----------+
+	 *
+	 * CRC is calculated over the "Address" and "Payload" fields, and it is 2
+	 * bytes in case of ANT.
+	 */
+	bool decodePacket(uint64_t sample)
+	{
+		_threshold = extractThreshold();
+		if (!detectPreamble()) return false;
+
+		uint8_t tmp_buf[ANTSNIFF_MAX_ADDRESS + ANTSNIFF_MAX_PAYLOAD + 2];
+		const int length = ADDRESS_LENGTH + PAYLOAD_LENGTH;
+		extractBytes(8, tmp_buf, length + 2);
+
+		if (!crcValid(tmp_buf, length) && !reacquire(tmp_buf, length)) {
+			++_falsePreambles;
+			if (Timeline::enabled()) {
+				Timeline::instant("crc failure", "shockburst", "sample", sample);
+			}
+			return false;
+		}
+
+		uint16_t crc = tmp_buf[length] << 8 | tmp_buf[length + 1];
+		_packet.sample = sample;
+		_packet.threshold = Sample::toInt16(_threshold);
+		_packet.margin = extractMargin(8, (length + 2) * 8);
+		_packet.crc = crc;
+		_packet.address_length = ADDRESS_LENGTH;
+		_packet.payload_length = PAYLOAD_LENGTH;
+		_packet.address = 0;
+		for (int i = 0; i < ADDRESS_LENGTH; ++i) {
+			_packet.address |=
+				uint64_t(tmp_buf[i]) << (ADDRESS_LENGTH - 1 - i) * 8;
+		}
+		std::memcpy(_packet.payload, tmp_buf + ADDRESS_LENGTH, PAYLOAD_LENGTH);
+
+		// at the level the packet decoded at: a level that failed the CRC
+		// would pull the device's average off
+		_devices.learn(_packet.address, _packet.threshold);
+
+		if (Timeline::enabled()) {
+			Timeline::instant("packet", "shockburst", "address", _packet.address);
+		}
+		return true;
+	}
+};
+
+/* The decoder for int16 samples, as the C API and shockburst use it */
+typedef BasicShockBurstDecoder<int16_t> ShockBurstDecoder;
+
+} // namespace antsniff
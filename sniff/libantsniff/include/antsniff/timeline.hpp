@@ -0,0 +1,339 @@
+#pragma once
+#include "antsniff.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace antsniff {
+
+/*
+ * Timeline tracing
+ *
+ * Spans (e.g. a work() call) and instant events (e.g. a CRC failure) are
+ * recorded with their steady clock time into a buffer per thread, and
+ * streamed to a Chrome trace event file, which chrome://tracing and the
+ * Perfetto UI show as a timeline per thread. This shows what the decoders
+ * were doing around a missed packet, which the latency histograms can't.
+ *
+ * Tracing is switched on and off at run time, process wide. While it's
+ * off, a trace point costs a relaxed atomic load and a predicted branch, so
+ * the trace points stay in production builds. While it's on, recording an
+ * event takes no lock: each buffer is a ring with a single writer (its
+ * thread) and a single reader (the thread writing the file), and events
+ * that don't fit until the next flush are dropped, and counted.
+ *
+ * Names, categories and argument names must be string literals (or other
+ * static storage) that need no escaping in JSON: only their pointers are
+ * recorded.
+ */
+struct TimelineEvent
+{
+	int64_t ts;	// ns, steady clock
+	int64_t dur;	// ns, or -1 for an instant event
+	const char *name;
+	const char *category;
+	const char *argName;	// NULL without an argument
+	uint64_t arg;
+};
+
+class TimelineBuffer
+{
+public:
+	static const size_t SIZE = 1 << 16;	// events, 3 MiB
+
+	TimelineBuffer(uint32_t tid):
+		tid(tid),
+		named(false),
+		_events(new TimelineEvent[SIZE]),
+		_head(0),
+		_tail(0),
+		_dropped(0)
+	{ }
+
+	const uint32_t tid;
+	bool named;	// its thread_name was written
+
+	/* Called by the owning thread only */
+	void push(const TimelineEvent &event)
+	{
+		size_t head = _head.load(std::memory_order_relaxed);
+		if (head - _tail.load(std::memory_order_acquire) == SIZE) {
+			_dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		_events[head & (SIZE - 1)] = event;
+		_head.store(head + 1, std::memory_order_release);
+	}
+
+	/* Call fn(event) for the events recorded since the last drain */
+	template <typename Fn>
+	size_t drain(Fn fn)
+	{
+		size_t tail = _tail.load(std::memory_order_relaxed);
+		size_t head = _head.load(std::memory_order_acquire);
+		for (size_t i = tail; i != head; ++i) {
+			fn(_events[i & (SIZE - 1)]);
+		}
+		_tail.store(head, std::memory_order_release);
+		return head - tail;
+	}
+
+	uint64_t takeDropped(void)
+	{
+		return _dropped.exchange(0, std::memory_order_relaxed);
+	}
+
+private:
+	std::unique_ptr<TimelineEvent[]> _events;
+	std::atomic<size_t> _head;
+	std::atomic<size_t> _tail;
+	std::atomic<uint64_t> _dropped;
+};
+
+/*
+ * The process wide state. A class template, so that the header can define
+ * its statics: with default visibility they are unique symbols, shared by
+ * every Pothos module that includes this header.
+ */
+template <typename T = void>
+struct ANTSNIFF_API TimelineState
+{
+	static std::atomic<bool> enabled;
+	static std::mutex lock;	// buffers, file
+	static std::vector<TimelineBuffer *> buffers;	// never freed
+	static thread_local TimelineBuffer *local;
+
+	static FILE *file;
+	static long written;
+	static bool running;
+	static std::thread flusher;
+	static std::condition_variable wake;
+};
+
+template <typename T> std::atomic<bool> TimelineState<T>::enabled(false);
+template <typename T> std::mutex TimelineState<T>::lock;
+template <typename T> std::vector<TimelineBuffer *> TimelineState<T>::buffers;
+template <typename T> thread_local TimelineBuffer *TimelineState<T>::local = NULL;
+template <typename T> FILE *TimelineState<T>::file = NULL;
+template <typename T> long TimelineState<T>::written = 0;
+template <typename T> bool TimelineState<T>::running = false;
+template <typename T> std::thread TimelineState<T>::flusher;
+template <typename T> std::condition_variable TimelineState<T>::wake;
+
+class Timeline
+{
+public:
+	typedef TimelineState<> State;
+
+	/* How often the buffers are written out */
+	static const int FLUSH_MS = 100;
+
+	/*
+	 * Start writing the trace to path, as a Chrome trace event file, and
+	 * enable tracing. The events are written out by a thread of the
+	 * timeline's own every FLUSH_MS, so the traced threads never wait for
+	 * the disk. Returns false if path can't be written, or a trace is being
+	 * written already.
+	 */
+	static bool start(const char *path)
+	{
+		std::lock_guard<std::mutex> guard(State::lock);
+		if (State::file) return false;
+		State::file = std::fopen(path, "w");
+		if (!State::file) return false;
+
+		// drop what was recorded before
+		for (TimelineBuffer *b : State::buffers) {
+			b->drain([](const TimelineEvent &) { });
+			b->takeDropped();
+			b->named = false;
+		}
+
+		std::fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+				"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+				"\"args\":{\"name\":\"antsniff\"}}", State::file);
+		State::written = 0;
+		State::running = true;
+		State::flusher = std::thread(flushLoop);
+		enable(true);
+		return true;
+	}
+
+	/*
+	 * Disable tracing, write out the rest of the trace and close the file.
+	 * Returns the number of events written, or -1 if writing failed, or no
+	 * trace was being written.
+	 */
+	static long stop(void)
+	{
+		enable(false);
+		std::unique_lock<std::mutex> guard(State::lock);
+		if (!State::file) return -1;
+		State::running = false;
+		State::wake.notify_all();
+		std::thread flusher(std::move(State::flusher));
+		guard.unlock();
+		flusher.join();
+		guard.lock();
+
+		flush();
+		std::fputs("\n]}\n", State::file);
+		bool ok = !std::ferror(State::file);
+		ok = std::fclose(State::file) == 0 && ok;
+		State::file = NULL;
+		return ok ? State::written : -1;
+	}
+
+	/* Pause or resume tracing; the file stays open */
+	static void enable(bool enabled)
+	{
+		State::enabled.store(enabled, std::memory_order_relaxed);
+	}
+
+	static bool enabled(void)
+	{
+		return State::enabled.load(std::memory_order_relaxed);
+	}
+
+	static int64_t now(void)
+	{
+		auto t = std::chrono::steady_clock::now().time_since_epoch();
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(t).count();
+	}
+
+	static void instant(const char *name, const char *category,
+			const char *argName = NULL, uint64_t arg = 0)
+	{
+		TimelineEvent e = { now(), -1, name, category, argName, arg };
+		buffer().push(e);
+	}
+
+	static void complete(const char *name, const char *category, int64_t start,
+			const char *argName = NULL, uint64_t arg = 0)
+	{
+		TimelineEvent e = { start, now() - start, name, category, argName, arg };
+		buffer().push(e);
+	}
+
+private:
+	/* This thread's buffer, registered on first use */
+	static TimelineBuffer &buffer(void)
+	{
+		TimelineBuffer *b = State::local;
+		if (!b) {
+			std::lock_guard<std::mutex> guard(State::lock);
+			b = new TimelineBuffer(uint32_t(State::buffers.size() + 1));
+			State::buffers.push_back(b);
+			State::local = b;
+		}
+		return *b;
+	}
+
+	static void flushLoop(void)
+	{
+		std::unique_lock<std::mutex> guard(State::lock);
+		while (State::running) {
+			State::wake.wait_for(guard, std::chrono::milliseconds(FLUSH_MS));
+			if (State::running) flush();
+		}
+	}
+
+	/* Write out the buffers, with State::lock held */
+	static void flush(void)
+	{
+		FILE *f = State::file;
+		uint64_t dropped = 0;
+
+		for (TimelineBuffer *b : State::buffers) {
+			if (!b->named) {
+				std::fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\","
+						"\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+						b->tid, b->tid);
+				b->named = true;
+			}
+			State::written += long(b->drain([f, b](const TimelineEvent &e)
+			{
+				writeEvent(f, b->tid, e);
+			}));
+			dropped += b->takeDropped();
+		}
+
+		if (dropped > 0) {
+			int64_t ts = now();
+			std::fprintf(f, ",\n{\"name\":\"dropped events\",\"ph\":\"i\","
+					"\"s\":\"g\",\"pid\":1,\"tid\":0,\"ts\":%lld.%03lld,"
+					"\"args\":{\"count\":%llu}}",
+					(long long)(ts / 1000), (long long)(ts % 1000),
+					(unsigned long long)dropped);
+		}
+		std::fflush(f);
+	}
+
+	static void writeEvent(FILE *f, uint32_t tid, const TimelineEvent &e)
+	{
+		// the timestamps are in microseconds
+		std::fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"pid\":1,"
+				"\"tid\":%u,\"ts\":%lld.%03lld", e.name, e.category, tid,
+				(long long)(e.ts / 1000), (long long)(e.ts % 1000));
+		if (e.dur >= 0) {
+			std::fprintf(f, ",\"ph\":\"X\",\"dur\":%lld.%03lld",
+					(long long)(e.dur / 1000), (long long)(e.dur % 1000));
+		} else {
+			std::fputs(",\"ph\":\"i\",\"s\":\"t\"", f);
+		}
+		if (e.argName) {
+			std::fprintf(f, ",\"args\":{\"%s\":%llu}", e.argName,
+					(unsigned long long)e.arg);
+		}
+		std::fputc('}', f);
+	}
+};
+
+/*
+ * A span from construction to destruction, recorded if tracing was enabled
+ * when it started. The name and argument can be set while it's open, e.g.
+ * once the message it covers has been parsed.
+ */
+class TimelineSpan
+{
+public:
+	TimelineSpan(const char *name, const char *category):
+		_name(name),
+		_category(category),
+		_argName(NULL),
+		_arg(0),
+		_start(Timeline::enabled() ? Timeline::now() : -1)
+	{ }
+
+	~TimelineSpan(void)
+	{
+		if (_start >= 0) Timeline::complete(_name, _category, _start,
+				_argName, _arg);
+	}
+
+	void name(const char *name)
+	{
+		_name = name;
+	}
+
+	void arg(const char *name, uint64_t value)
+	{
+		_argName = name;
+		_arg = value;
+	}
+
+private:
+	const char *_name;
+	const char *_category;
+	const char *_argName;
+	uint64_t _arg;
+	int64_t _start;
+};
+
+} // namespace antsniff
@@ -0,0 +1,144 @@
+#include "antsniff/antsniff.h"
+#include "antsniff/antfs.hpp"
+#include "antsniff/shockburst.hpp"
+#include "antsniff/timeline.hpp"
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+/*
+ * C API on top of the header-only decoder and parser. Exceptions must not
+ * cross into C, so every entry point reports failure by its return value.
+ */
+
+struct antsniff_decoder {
+	antsniff::ShockBurstDecoder decoder;
+
+	antsniff_decoder(uint8_t addressLength, uint8_t payloadLength,
+			const antsniff_decoder_params &params):
+		decoder(addressLength, payloadLength, params)
+	{ }
+};
+
+const char *antsniff_version(void)
+{
+	return "libantsniff 1.0";
+}
+
+uint16_t antsniff_crc16(const uint8_t *data, size_t length)
+{
+	return antsniff::crc16(data, length);
+}
+
+antsniff_decoder *antsniff_decoder_new(uint8_t address_length,
+		uint8_t payload_length)
+{
+	antsniff_decoder_params params = antsniff::shockBurstDefaults();
+	return antsniff_decoder_new_params(address_length, payload_length, &params);
+}
+
+void antsniff_decoder_params_init_size(antsniff_decoder_params *params,
+		size_t size)
+{
+	antsniff_decoder_params p = antsniff::shockBurstDefaults();
+	std::memcpy(params, &p, std::min(size, sizeof(p)));
+	params->size = uint32_t(size);
+}
+
+antsniff_decoder *antsniff_decoder_new_params(uint8_t address_length,
+		uint8_t payload_length, const antsniff_decoder_params *params)
+{
+	// the caller's fields over the defaults of those it doesn't know
+	antsniff_decoder_params p = antsniff::shockBurstDefaults();
+	if (params->size < offsetof(antsniff_decoder_params, known_devices) +
+			sizeof(p.known_devices) || params->size > sizeof(p) ||
+			params->size % sizeof(uint32_t) != 0) {
+		return NULL;
+	}
+	std::memcpy(&p, params, params->size);
+
+	try {
+		return new antsniff_decoder(address_length, payload_length, p);
+	} catch (const std::exception &) {
+		return NULL;
+	}
+}
+
+void antsniff_decoder_free(antsniff_decoder *decoder)
+{
+	delete decoder;
+}
+
+size_t antsniff_decoder_feed(antsniff_decoder *decoder, const int16_t *samples,
+		size_t count, antsniff_packet_cb cb, void *ctx)
+{
+	antsniff::TimelineSpan span("feed", "shockburst");
+	span.arg("samples", count);
+	return decoder->decoder.feed(samples, count,
+			[cb, ctx](const antsniff_packet &packet)
+	{
+		if (cb) cb(&packet, ctx);
+	});
+}
+
+uint64_t antsniff_decoder_samples(const antsniff_decoder *decoder)
+{
+	return decoder->decoder.samples();
+}
+
+uint64_t antsniff_decoder_false_preambles(const antsniff_decoder *decoder)
+{
+	return decoder->decoder.falsePreambles();
+}
+
+uint64_t antsniff_decoder_reacquired(const antsniff_decoder *decoder)
+{
+	return decoder->decoder.reacquired();
+}
+
+size_t antsniff_decoder_save(const antsniff_decoder *decoder, uint8_t *buffer,
+		size_t size)
+{
+	return decoder->decoder.saveState(buffer, size);
+}
+
+int antsniff_decoder_restore(antsniff_decoder *decoder, const uint8_t *buffer,
+		size_t size)
+{
+	return decoder->decoder.restoreState(buffer, size) ? 0 : -1;
+}
+
+int antsniff_antfs_parse(const uint8_t *payload, size_t length,
+		antsniff_antfs_message *message)
+{
+	return antsniff::ANTFSParser::parse(payload, length, *message) ? 1 : 0;
+}
+
+int antsniff_timeline_start(const char *path)
+{
+	try {
+		return antsniff::Timeline::start(path) ? 0 : -1;
+	} catch (const std::exception &) {
+		return -1;
+	}
+}
+
+long antsniff_timeline_stop(void)
+{
+	try {
+		return antsniff::Timeline::stop();
+	} catch (const std::exception &) {
+		return -1;
+	}
+}
+
+void antsniff_timeline_enable(int enabled)
+{
+	antsniff::Timeline::enable(enabled != 0);
+}
+
+int antsniff_timeline_enabled(void)
+{
+	return antsniff::Timeline::enabled() ? 1 : 0;
+}
@@ -1,9 +1,16 @@
 #include <Pothos/Framework.hpp>
+#include "antsniff/antfs.hpp"
+#include "antsniff/channelscan.hpp"
+#include "antsniff/timeline.hpp"
+#include "MessageBatch.hpp"
+#include "MessageQueue.hpp"
+#include "LatencyTrace.hpp"
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <stdexcept>
+#include <string>
 #include <vector>
-#include <cmath>
-#include <sstream>
-#include <iomanip>
 
 /***********************************************************************
  * |PothosDoc  ANT-FS Decoder
@@ -17,15 +24,66 @@
  * <h2>Input format</h2>
  *
  * The input port expects messages that contain keyword value pairs that
- * represent ShockBurst packages, and tries to parse the "payload" field as
- * ANT-FS messages. A typical upstream flow involves raw complex baseband
- * samples, the "Freq Demod" and the "ShockBurst Decored" blocks.
+ * represent ShockBurst packages, or batches (Pothos::ObjectVector) of them,
+ * and tries to parse the "payload" field as ANT-FS messages. All queued
+ * messages are decoded in one go. A typical upstream flow involves raw complex
+ * baseband samples, the "Freq Demod" and the "ShockBurst Decored" blocks.
  *
  * <h2>Output format</h2>
  *
  * Each decoded ANT-FS packet results in a dictionary message of
  * type Pothos::ObjectKwargs. The keyword and value pairs correspond with the
- * fields in the ANT-FS packet.
+ * fields in the ANT-FS packet, plus the "address" and "sample" of the
+ * ShockBurst packet it was decoded from. With a maximum batch size above 1,
+ * the packets decoded from the queued input are posted together, as
+ * Pothos::ObjectVector messages of up to that many packets.
+ *
+ * In the "changes only" beacon mode, a client beacon is only posted when it
+ * differs from the previous beacon of the same address (or is its first one).
+ * Unchanged beacons are counted instead, and every summary period (measured
+ * in samples, as they arrive) the count is posted as a message of type
+ * "beacon summary", with the "address", the "sample" of the latest beacon,
+ * and the number of beacons "suppressed" since the previous summary. A
+ * device's pending count is also posted right before its next change, and
+ * when it stops beaconing (for a few summary periods; it is then forgotten,
+ * and its next beacon posted as a first one), when the beacon mode changes
+ * and when the topology stops, so the counts always add up.
+ *
+ * The "rx_time" of the ShockBurst packet is passed on too, and so are the
+ * latency tracing timestamps (see the ShockBurst Decoder), to which the
+ * decoder adds its own "t_antfs_in" and "t_antfs_out". getLatencyStats()
+ * returns the latency percentiles of the posted packets ("antfs"), and of
+ * the frequencyChanged signals ("follow"). With the ShockBurst Decoder's
+ * timeline tracing on, every message dispatched is recorded as a span named
+ * after its type, and every frequencyChanged signal as an event.
+ *
+ * <h2>Overload</h2>
+ *
+ * When packets arrive faster than the decoder handles them, the Overload
+ * Policy bounds its backlog to Max Queue packets: either the oldest packets
+ * are shed, or repeated beacons (identical to a newer queued beacon of the
+ * same device) first, and then the oldest packets. getOverloadStats()
+ * returns the backlog's high water mark, and the packets shed by each rule.
+ * See MessageQueue.hpp.
+ *
+ * <h2>Channel scan</h2>
+ *
+ * In "scan" channel mode, the decoder looks for clients on all channels
+ * (3-80) instead of only the beacon channel, for a single narrowband
+ * receiver: frequencyChanged moves the receiver from channel to channel,
+ * for dwell times worked out from the beacon periods heard on each, and
+ * the channels where beacons were heard are revisited more often. A link
+ * command is followed as in "fixed" mode, until the disconnect command or
+ * a silence of 10 seconds. See antsniff/channelscan.hpp. Connect a
+ * "Periodic Trigger" (e.g. at 20 Hz) to the tick slot, so that quiet
+ * channels are left on time. getScanStats() returns the visits, beacons,
+ * devices, longest beacon period and discovery latency (since activation)
+ * of each channel heard on.
+ *
+ * Link, auth, download, upload and erase commands also produce a message on
+ * the "trigger" port with the "sample" the command was received at, and the
+ * packet type as "reason". This is meant for the "I/Q Recorder" block, to
+ * record the raw samples around these events.
  *
  * |category /Decode
  * |keywords ant antfs ant-fs
@@ -36,19 +94,108 @@
  * |widget SpinBox(minimum=3,maximum=80)
  * |default 50
  *
+ * |param channelMode[Channel Mode] Stay on the beacon channel, or scan all
+ * channels for beacons, starting at the beacon channel.
+ * |option [Fixed] "fixed"
+ * |option [Scan] "scan"
+ * |default "fixed"
+ * |preview valid
+ *
+ * |param scanDwell[Scan Dwell] How long the scan stays on a channel where
+ * no beacons were heard yet.
+ * |default 300.0
+ * |units ms
+ * |preview valid
+ *
+ * |param beaconMode[Beacon Mode] Post every client beacon, or only the
+ * beacons that differ from the previous one of the same device.
+ * |option [All] "all"
+ * |option [Changes Only] "changes"
+ * |default "all"
+ * |preview valid
+ *
+ * |param summaryPeriod[Summary Period] How often the number of suppressed
+ * beacons is posted, per device, in "changes only" mode.
+ * |default 10.0
+ * |units seconds
+ * |preview valid
+ *
+ * |param sampleRate[Sample Rate] The sample rate of the ShockBurst decoder
+ * input, used to measure the summary period.
+ * |default 2e6
+ * |units samples/sec
+ * |preview valid
+ *
+ * |param maxBatch[Max Batch] The maximum number of packets per output
+ * message. 1 disables batching.
+ * |widget SpinBox(minimum=1)
+ * |default 1
+ * |preview valid
+ *
+ * |param overloadPolicy[Overload Policy] What to shed when the backlog is
+ * over Max Queue packets.
+ * |option [None (unbounded)] "none"
+ * |option [Oldest] "oldest"
+ * |option [Repeated Beacons First] "beacons"
+ * |default "none"
+ * |preview valid
+ *
+ * |param maxQueue[Max Queue] The most packets waiting to be decoded.
+ * |widget SpinBox(minimum=1)
+ * |default 1024
+ * |preview valid
+ *
  * |factory /antfs/antfs_decoder()
  * |initializer setBeaconChannel(beaconChannel)
+ * |setter setChannelMode(channelMode)
+ * |setter setScanDwell(scanDwell)
+ * |setter setBeaconMode(beaconMode)
+ * |setter setSummaryPeriod(summaryPeriod)
+ * |setter setSampleRate(sampleRate)
+ * |setter setMaxBatch(maxBatch)
+ * |setter setOverloadPolicy(overloadPolicy)
+ * |setter setMaxQueue(maxQueue)
  **********************************************************************/
 class ANTFSDecoder : public Pothos::Block
 {
 public:
 	Pothos::ObjectKwargs packet;
 
-	ANTFSDecoder(void)
+	ANTFSDecoder(void):
+		_changesOnly(false),
+		_summaryPeriod(10.0),
+		_sampleRate(2e6),
+		_lastSample(0),
+		_nextSweep(0),
+		_scan(false),
+		_workEntry(0)
 	{
 		this->setupInput(0); //unspecified type, handles conversion
 		this->setupOutput(0);
+		this->setupOutput("trigger");
 		this->registerCall(this, POTHOS_FCN_TUPLE(ANTFSDecoder, setBeaconChannel));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ANTFSDecoder, setBeaconMode));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ANTFSDecoder, getBeaconMode));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ANTFSDecoder, setSummaryPeriod));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ANTFSDecoder, getSummaryPeriod));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ANTFSDecoder, setSampleRate));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ANTFSDecoder, getSampleRate));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ANTFSDecoder, getDeviceCount));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ANTFSDecoder, getLatencyStats));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ANTFSDecoder, resetLatencyStats));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ANTFSDecoder, setMaxBatch));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ANTFSDecoder, getMaxBatch));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ANTFSDecoder, setChannelMode));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ANTFSDecoder, getChannelMode));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ANTFSDecoder, setScanDwell));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ANTFSDecoder, getScanDwell));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ANTFSDecoder, getScanStats));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ANTFSDecoder, tick));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ANTFSDecoder, setOverloadPolicy));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ANTFSDecoder, getOverloadPolicy));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ANTFSDecoder, setMaxQueue));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ANTFSDecoder, getMaxQueue));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ANTFSDecoder, getOverloadStats));
 
 		// Send signal about frequency change due to received Link or Diconnect
 		// command. This will tipically be connected to the setFrequency slot of
@@ -63,41 +210,41 @@ public:
 		return new ANTFSDecoder();
 	}
 
+	void activate(void)
+	{
+		if (_scan) this->startScan();
+	}
+
+	void deactivate(void)
+	{
+		this->flushSummaries();
+	}
+
 	void work(void)
 	{
 		auto input = this->input(0);
-		if (not input->hasMessage()) return;
-
-		auto msg = input->popMessage();
-		if (msg.type() == typeid(Pothos::ObjectKwargs)) {
-			auto contents = msg.extract<Pothos::ObjectKwargs>();
-			auto payload = contents["payload"];
-			if (payload.type() == typeid(std::vector<uint8_t>)) {
-				packet.clear();
-
-				std::vector<uint8_t> data = payload.extract<std::vector<uint8_t> >();
-				switch(data[2]) {
-					case 0x43:
-						parseBeacon(data);
-						break;
-					case 0x44:
-						parseCommandReponse(data);
-						break;
-					default:
-						packet["type"] = Pothos::Object("unknown");
-						packet["data"] = Pothos::Object(bytesToHex(data));
-						break;
-				}
-
-				this->output(0)->postMessage(packet);
-			}
-		}
+		_workEntry = traceNow();
+		antsniff::TimelineSpan span("work", "antfs");
+
+		// drain the whole queue, after shedding what doesn't fit
+		_queue.fill(input);
+		_queue.drain([this](const Pothos::ObjectKwargs &contents)
+		{
+			this->decode(contents);
+		});
+		if (_changesOnly) this->sweepSummaries();
+
+		// the input is only latency bounded by upstream, and work() is not
+		// called again until more arrives, so don't hold anything back
+		_batch.flush(this->output(0));
+
+		if (_scan) this->tick();
 	}
 
 	void setBeaconChannel(const uint32_t &beaconChannel)
 	{
 		_beaconChannel = beaconChannel;
-		this->callVoid("frequencyChanged", 2400 + _beaconChannel);
+		this->changeFrequency(2400 + _beaconChannel);
 	}
 
 	uint32_t getBeaconChannel()
@@ -105,289 +252,368 @@ public:
 		return _beaconChannel;
 	}
 
-private:
-	uint32_t _beaconChannel;
+	void setChannelMode(const std::string &channelMode)
+	{
+		bool scan;
+		if (channelMode == "fixed") scan = false;
+		else if (channelMode == "scan") scan = true;
+		else throw std::invalid_argument(
+				"ANTFSDecoder: unknown channel mode " + channelMode);
+
+		if (scan == _scan) return;
+		_scan = scan;
+		if (_scan) this->startScan();
+		else this->changeFrequency(2400 + _beaconChannel);
+	}
 
-	uint16_t makeWord(std::vector<uint8_t>& data, size_t start)
+	std::string getChannelMode(void) const
 	{
-		return data[start + 1] << 8 | data[start];
+		return _scan ? "scan" : "fixed";
 	}
 
-	uint32_t makeDword(std::vector<uint8_t>& data, size_t start)
+	void setScanDwell(const double &scanDwell)
 	{
-		return data[start + 3] << 24 | data[start + 2] << 16 |
-			data[start + 1] << 8 | data[start];
+		_scanner.dwell = int64_t(scanDwell * 1e6);
 	}
 
-	std::string bytesToHex(std::vector<uint8_t>& data)
+	double getScanDwell(void) const
 	{
-		std::ostringstream ss;
-		ss << std::hex << std::setfill('0') << std::uppercase;
-		for (auto &byte : data)
-			ss << std::setw(2) << static_cast<int>(byte) << " ";
+		return _scanner.dwell / 1e6;
+	}
 
-		return ss.str();
+	void setOverloadPolicy(const std::string &overloadPolicy)
+	{
+		_queue.setPolicy(overloadPolicy);
 	}
 
-	void parseCommandReponse(std::vector<uint8_t>& data)
+	std::string getOverloadPolicy(void) const
 	{
-		switch(data[3]) {
-			// ANTFS Commands
-			case 0x02: parseLinkCommand(data); break;
-			case 0x03: parseDisconnectCommand(data); break;
-			case 0x04: parseAuthCommand(data); break;
-			case 0x05: parsePingCommand(data); break;
-			case 0x09: parseDownloadReqCommand1(data); break;
-			case 0x0a: parseUploadReqCommand1(data); break;
-			case 0x0b: parseEraseReqCommand(data); break;
-			case 0x0c: parseUploadDataCommand(data); break;
-			// ANTFS Responses
-			case 0x84: parseAuthResponse(data); break;
-			case 0x89: parseDownloadReqResp2(data); break;
-			case 0x8a: parseUploadReqResp2(data); break;
-			case 0x8b: parseEraseResp2(data); break;
-			case 0x8c: parseUploadDataResp2(data); break;
-			// None of the known commands/responses
-			default:
-				packet["type"] = Pothos::Object("unknown command/response");
-				packet["data"] = Pothos::Object(bytesToHex(data));
-				break;
+		return _queue.policy();
+	}
+
+	void setMaxQueue(const size_t &maxQueue)
+	{
+		_queue.maxQueue = maxQueue;
+	}
+
+	size_t getMaxQueue(void) const
+	{
+		return _queue.maxQueue;
+	}
+
+	Pothos::ObjectKwargs getOverloadStats(void) const
+	{
+		return _queue.stats();
+	}
+
+	/* Leave the scanned channel if its time is up; for a Periodic Trigger */
+	void tick(void)
+	{
+		if (_scan) this->tune(_scanner.tick(scanNow()));
+	}
+
+	/* Per channel scan results, for the channels where beacons were heard */
+	Pothos::ObjectKwargs getScanStats(void) const
+	{
+		Pothos::ObjectKwargs stats;
+		Pothos::ObjectKwargs channels;
+		for (const auto &ch : _scanner.channels()) {
+			if (ch.discovery < 0) continue;
+			Pothos::ObjectKwargs c;
+			c["visits"] = Pothos::Object((unsigned long long)ch.visits);
+			c["dwelled"] = Pothos::Object(ch.dwelled / 1e9);
+			c["beacons"] = Pothos::Object((unsigned long long)ch.beacons);
+			c["devices"] = Pothos::Object(ch.devices.size());
+			c["period"] = Pothos::Object(ch.period / 1e9);
+			c["discovery"] = Pothos::Object(ch.discovery / 1e9);
+			channels[std::to_string(ch.channel)] = Pothos::Object(c);
 		}
+		stats["channels"] = Pothos::Object(channels);
+		stats["channel"] = Pothos::Object(uint32_t(_scanner.channel()));
+		stats["following"] = Pothos::Object(_scanner.following());
+		stats["devices"] = Pothos::Object(_scanner.devices());
+		stats["lastDiscovery"] = Pothos::Object(_scanner.lastDiscovery() / 1e9);
+		return stats;
 	}
 
-	/*
-	 * ANT-FS Beacon
-	 */
-	void parseBeacon(std::vector<uint8_t>& data)
-	{
-		packet["type"] = Pothos::Object("client beaecon");
-
-		uint8_t status1 = data[3];
-		packet["data"] = Pothos::Object(status1 & (1 << 5) ? "true" : "false");
-		packet["upload"] = Pothos::Object(status1 & (1 << 4) ? "true" : "false");
-		packet["pairing"] = Pothos::Object(status1 & (1 << 3) ? "true" : "false");
-
-		std::string temp;
-		switch (status1 & 7) {
-			case 0: temp = "0.5 Hz (65535)"; break;
-			case 1: temp = "1 Hz (32768)"; break;
-			case 2: temp = "2 Hz (16384)"; break;
-			case 3: temp = "4 Hz (8192)"; break;
-			case 4: temp = "8 Hz (4096)"; break;
-			case 7: temp = "match established"; break;
-			default: temp = "reserved";
+	void setBeaconMode(const std::string &beaconMode)
+	{
+		if (beaconMode == "all") _changesOnly = false;
+		else if (beaconMode == "changes") _changesOnly = true;
+		else throw std::invalid_argument(
+				"ANTFSDecoder: unknown beacon mode " + beaconMode);
+		this->flushSummaries();
+	}
+
+	std::string getBeaconMode(void) const
+	{
+		return _changesOnly ? "changes" : "all";
+	}
+
+	void setSummaryPeriod(const double &summaryPeriod)
+	{
+		_summaryPeriod = summaryPeriod;
+	}
+
+	double getSummaryPeriod(void) const
+	{
+		return _summaryPeriod;
+	}
+
+	void setSampleRate(const double &sampleRate)
+	{
+		_sampleRate = sampleRate;
+	}
+
+	double getSampleRate(void) const
+	{
+		return _sampleRate;
+	}
+
+	/* Number of devices whose beacon state is cached */
+	size_t getDeviceCount(void) const
+	{
+		return _beacons.devices();
+	}
+
+	Pothos::ObjectKwargs getLatencyStats(void) const
+	{
+		return _trace.stats();
+	}
+
+	void resetLatencyStats(void)
+	{
+		_trace.reset();
+	}
+
+	void setMaxBatch(const size_t &maxBatch)
+	{
+		_batch.maxBatch = maxBatch;
+	}
+
+	size_t getMaxBatch(void) const
+	{
+		return _batch.maxBatch;
+	}
+
+private:
+	// summary periods a device is kept after its last beacon
+	static const uint64_t IDLE_PERIODS = 3;
+
+	uint32_t _beaconChannel;
+	bool _changesOnly;
+	double _summaryPeriod;	// seconds
+	double _sampleRate;
+	antsniff::BeaconFilter _beacons;
+	uint64_t _lastSample;	// of the latest packet, in "changes only" mode
+	uint64_t _nextSweep;	// sample the beacon filter is swept at next
+	bool _scan;
+	antsniff::ChannelScanner _scanner;
+	MessageQueue _queue;
+	MessageBatcher _batch;
+	int64_t _workEntry;	// ns, host time
+	LatencyTrace _trace;
+
+	void decode(const Pothos::ObjectKwargs &contents)
+	{
+		antsniff::TimelineSpan span("decode", "antfs");
+		auto payload = messageField(contents, "payload");
+		if (payload.type() != typeid(std::vector<uint8_t>)) return;
+
+		auto &data = payload.extract<std::vector<uint8_t> >();
+		if (_scan) this->scan(contents, data);
+		if (_changesOnly) {
+			auto sample = messageField(contents, "sample");
+			if (sample) _lastSample = std::max(_lastSample, sample.convert<uint64_t>());
+		}
+		if (_changesOnly && data.size() >= 10 && data[2] == 0x43 &&
+				!this->beaconChanged(contents, data))
+		{
+			return;
 		}
-		packet["period"] = Pothos::Object(temp);
 
-		switch (data[4] & 0x0f) {
-			case 0:
-				temp = "link";
-				packet["device_type"] = Pothos::Object(makeWord(data, 6));
-				packet["manufacturer"] = Pothos::Object(makeWord(data, 8));
-				break;
-			case 1:
-				temp = "auth";
-				packet["host_serial"] = Pothos::Object(makeDword(data, 6));
-				break;
-			case 2:
-				temp = "transport";
-				packet["host_serial"] = Pothos::Object(makeDword(data, 6));
-				break;
-			case 3: temp = "busy"; break;
-			default: temp = "reserved"; break;
+		antsniff_antfs_message msg;
+		antsniff::ANTFSParser::parse(data.data(), data.size(), msg);
+		span.name(msg.type);
+
+		packet.clear();
+		packet["type"] = Pothos::Object(std::string(msg.type));
+		for (size_t i = 0; i < msg.field_count; ++i) {
+			const antsniff_field &f = msg.fields[i];
+			packet[f.name] = fieldToObject(f);
 		}
-		packet["state"] = Pothos::Object(temp);
-
-		switch (data[5]) {
-			case 0: temp = "pass-through"; break;
-			case 1: temp = "n/a"; break;
-			case 2: temp = "pairing"; break;
-			case 3: temp = "passkey & pairing"; break;
-			default: temp = "reserved"; break;
+
+		packet["address"] = messageField(contents, "address");
+		packet["sample"] = messageField(contents, "sample");
+
+		auto rxTime = messageField(contents, "rx_time");
+		if (rxTime) packet["rx_time"] = rxTime;
+
+		auto origin = messageField(contents, "t_origin");
+		if (origin) {
+			int64_t now = traceNow();
+			packet["t_origin"] = origin;
+			packet["t_decoder_in"] = messageField(contents, "t_decoder_in");
+			packet["t_decoder_out"] = messageField(contents, "t_decoder_out");
+			packet["t_antfs_in"] = Pothos::Object(_workEntry);
+			packet["t_antfs_out"] = Pothos::Object(now);
+			_trace.record("antfs", packet, now);
 		}
-		packet["auth_type"] = Pothos::Object(temp);
-	}
 
-	/*
-	 * ANT-FS Commands
-	 */
-	void parseLinkCommand(std::vector<uint8_t> data)
-	{
-		packet["type"] = Pothos::Object("link command");
-		packet["frequency"] = Pothos::Object(data[4]);
-
-		std::string temp;
-		switch(data[5]) {
-			case 0: temp = "0.5 Hz (65535)"; break;
-			case 1: temp = "1 Hz (32768)"; break;
-			case 2: temp = "2 Hz (16384)"; break;
-			case 3: temp = "4 Hz (8192)"; break;
-			case 4: temp = "8 Hz (4096)"; break;
-			case 7: temp = "match established"; break;
-			default: temp = "reserved";
+		_batch.push(this->output(0), Pothos::Object(packet));
+
+		if (msg.trigger) {
+			Pothos::ObjectKwargs trigger;
+			trigger["sample"] = packet["sample"];
+			trigger["reason"] = packet["type"];
+			this->output("trigger")->postMessage(trigger);
 		}
-		packet["period"] = Pothos::Object(temp);
-
-		packet["host_serial"] = Pothos::Object(makeDword(data, 6));
-
-		// From ANT_File_Share_Technology.pdf: The host may use the Link command
-		// to specify a different channel period or RF frequency for subsequent
-		// interactions.
-		this->callVoid("frequencyChanged", 2400 + data[4]);
-	}
-
-	void parseDisconnectCommand(std::vector<uint8_t> data)
-	{	
-		packet["type"] = Pothos::Object("disconnect command");
-
-		std::string temp;
-		if (data[4] == 0) temp = "return to link";
-		else if (data[4] == 1) temp = "return to broadcast";
-		else if (data[4] <= 127) temp = "reserved";
-		else temp = "device specific";
-		packet["disconnect_type"] = Pothos::Object(temp);
-
-		packet["time_duration"] = Pothos::Object(data[5]);
-		packet["application_duration"] = Pothos::Object(data[6]);
-
-		// Connection state returns to Link layer, thus frequency changes back
-		// to the initial Beacon Channel frequency.
-		this->callVoid("frequencyChanged", 2400 + _beaconChannel);
-	}
-	
-	void parseAuthCommand(std::vector<uint8_t> data)
-	{
-		packet["type"] = Pothos::Object("auth command");
-	
-		std::string temp;
-		switch (data[4]) {
-			case 0: temp = "pass-through"; break;
-			case 1: temp = "request serial"; break;
-			case 2: temp = "request pairing"; break;
-			case 3: temp = "request passkey"; break;
-			default: temp = "EINVAL"; break;
+
+		switch (msg.action) {
+			case ANTSNIFF_ACTION_FOLLOW:
+				if (_scan) this->tune(_scanner.link(msg.link_frequency, scanNow()));
+				else this->changeFrequency(2400 + msg.link_frequency);
+				break;
+			case ANTSNIFF_ACTION_RETURN:
+				if (_scan) this->tune(_scanner.disconnect(scanNow()));
+				else this->changeFrequency(2400 + _beaconChannel);
+				break;
+			default:
+				break;
 		}
-		packet["auth_type"] = Pothos::Object(temp);
 
-		packet["auth_string_length"] = Pothos::Object(data[5]);
-		packet["host_serial"] = Pothos::Object(makeDword(data, 6));
+		if (origin && msg.action != ANTSNIFF_ACTION_NONE) {
+			_trace.record("follow", packet, traceNow());
+		}
 	}
-	
-	void parsePingCommand(std::vector<uint8_t> data)
+
+	void startScan(void)
 	{
-		packet["type"] = Pothos::Object("ping command");
+		this->tune(_scanner.start(uint8_t(_beaconChannel), scanNow()));
 	}
-	
-	//TODO: 2-packet burst
-	void parseDownloadReqCommand1(std::vector<uint8_t> data)
+
+	/* Feed the scanner a packet; beacons may end the channel's dwell time */
+	void scan(const Pothos::ObjectKwargs &contents,
+			const std::vector<uint8_t> &data)
 	{
-		packet["type"] = Pothos::Object("download request command");
-		packet["index"] = Pothos::Object(makeWord(data, 4));
-		packet["offset"] = Pothos::Object(makeDword(data, 6));
+		int64_t now = scanNow();
+		if (data.size() < 10 || data[2] != 0x43) {
+			_scanner.packet(now);
+			return;
+		}
+
+		uint64_t address = messageField(contents, "address").convert<uint64_t>();
+		int64_t period = antsniff::ChannelScanner::beaconPeriod(data[3]);
+		this->tune(_scanner.beacon(address, period, now));
 	}
-	
-	//TODO: 2-packet burst
-	void parseUploadReqCommand1(std::vector<uint8_t> data)
+
+	/* Move the receiver to a channel the scanner returned, if any */
+	void tune(uint8_t channel)
 	{
-		packet["type"] = Pothos::Object("upload request command");
-		packet["index"] = Pothos::Object(makeWord(data, 4));
-		packet["max_size"] = Pothos::Object(makeDword(data, 6));
+		if (channel) this->changeFrequency(2400 + channel);
 	}
-	
-	//TODO: 2+n-packet burst
-	void parseUploadDataCommand(std::vector<uint8_t> data)
+
+	static int64_t scanNow(void)
 	{
-		packet["type"] = Pothos::Object("upload data command");
-		packet["crc_seed"] = Pothos::Object(makeWord(data, 4));
-		packet["offset"] = Pothos::Object(makeDword(data, 6));
+		auto t = std::chrono::steady_clock::now().time_since_epoch();
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(t).count();
 	}
-	
-	void parseEraseReqCommand(std::vector<uint8_t> data)
+
+	void changeFrequency(uint32_t frequency)
 	{
-		packet["type"] = Pothos::Object("erase request command");
-		packet["index"] = Pothos::Object(makeWord(data, 4));
+		if (antsniff::Timeline::enabled()) {
+			antsniff::Timeline::instant("frequencyChanged", "antfs",
+					"frequency", frequency);
+		}
+		this->callVoid("frequencyChanged", frequency);
 	}
-	
+
 	/*
-	 * ANT-FS Responses
+	 * Run a beacon through the filter, posting a summary if one is due.
+	 * Returns false if the beacon itself should not be posted.
 	 */
-	void parseAuthResponse(std::vector<uint8_t> data)
+	bool beaconChanged(const Pothos::ObjectKwargs &contents,
+			const std::vector<uint8_t> &data)
 	{
-		packet["type"] = Pothos::Object("auth response");
+		auto address = messageField(contents, "address");
+		auto sample = messageField(contents, "sample");
+		if (!address || !sample) return true;
 
-		std::string temp;
-		switch (data[4]) {
-			case 0: temp = "response to serial req."; break;
-			case 1: temp = "accept"; break;
-			case 2: temp = "reject"; break;
-			default: temp = "EINVAL";
-		}
-		packet["response"] = Pothos::Object(temp);
-
-		packet["auth_string_length"] = Pothos::Object(data[5]);
-		packet["client_serial"] = Pothos::Object(makeDword(data, 6));
-	}
-	
-	//TODO: 3+n-packet burst
-	void parseDownloadReqResp2(std::vector<uint8_t> data)
-	{
-		packet["type"] = Pothos::Object("download request response");
-
-		std::string temp;
-		switch (data[4]) {
-			case 0: temp = "ANTFS_OK"; break;
-			case 1: temp = "ANTFS_ENOENT"; break;
-			case 2: temp = "ANTFS_EACCESS"; break;
-			case 3: temp = "ANTFS_ENOTREADY"; break;
-			case 4: temp = "ANTFS_EINVAL"; break;
-			case 5: temp = "ANTFS_ECRC"; break;
-			default: temp = "EINVAL";
-		}
-		packet["response"] = Pothos::Object(temp);
+		uint64_t a = address.convert<uint64_t>();
+		uint64_t s = sample.convert<uint64_t>();
+		bool changed = _beacons.changed(a, data.data(), s);
+
+		// flush the count before a change, so it covers the old state
+		uint64_t period = changed ? 0 : uint64_t(_summaryPeriod * _sampleRate);
+		uint32_t suppressed = _beacons.takeSummary(a, s, period);
+		if (suppressed > 0) this->postSummary(a, s, suppressed);
 
-		packet["remaining"] = Pothos::Object(makeDword(data, 6));
+		return changed;
 	}
-	
-	//TODO: 4-packet burst
-	void parseUploadReqResp2(std::vector<uint8_t> data)
-	{
-		packet["type"] = Pothos::Object("upload request response");
 
-		std::string temp;
-		switch (data[4]) {
-			case 0: temp = "ANTFS_OK"; break;
-			case 1: temp = "ANTFS_ENOENT"; break;
-			case 2: temp = "ANTFS_EACCESS"; break;
-			case 3: temp = "ANTFS_ENOSPC"; break;
-			case 4: temp = "ANTFS_EINVAL"; break;
-			case 5: temp = "ANTFS_ENOTREADY"; break;
-			default: temp = "EINVAL";
-		}
-		packet["response"] = Pothos::Object(temp);
+	void postSummary(uint64_t address, uint64_t sample, uint32_t suppressed)
+	{
+		Pothos::ObjectKwargs summary;
+		summary["type"] = Pothos::Object(std::string("beacon summary"));
+		summary["suppressed"] = Pothos::Object(suppressed);
+		summary["address"] = Pothos::Object(address);
+		summary["sample"] = Pothos::Object(sample);
+		_batch.push(this->output(0), Pothos::Object(summary));
+	}
 
-		packet["last_offset"] = Pothos::Object(makeDword(data, 6));
+	/*
+	 * Post the due summaries of devices that have gone quiet, and forget the
+	 * ones quiet for IDLE_PERIODS summary periods; at most once a second (of
+	 * samples), as it goes through all devices
+	 */
+	void sweepSummaries(void)
+	{
+		if (_lastSample < _nextSweep) return;
+		_nextSweep = _lastSample + uint64_t(_sampleRate);
+
+		const uint64_t period = uint64_t(_summaryPeriod * _sampleRate);
+		_beacons.sweep(_lastSample, period, IDLE_PERIODS * period,
+				[this](uint64_t address, uint64_t sample, uint32_t suppressed)
+				{
+					this->postSummary(address, sample, suppressed);
+				});
 	}
 
-	//TODO: 2-packet burst
-	void parseUploadDataResp2(std::vector<uint8_t> data)
+	/* Post every pending count, and start over */
+	void flushSummaries(void)
 	{
-		packet["type"] = Pothos::Object("upload data response");
-		packet["response"] = Pothos::Object(data[4] ? "true" : "false");
+		_beacons.flush([this](uint64_t address, uint64_t sample, uint32_t suppressed)
+		{
+			this->postSummary(address, sample, suppressed);
+		});
+		_batch.flush(this->output(0));
+		_lastSample = _nextSweep = 0;
 	}
 
-	//TODO: 2-packet burst
-	void parseEraseResp2(std::vector<uint8_t> data)
+	static Pothos::Object fieldToObject(const antsniff_field &f)
 	{
-		packet["type"] = Pothos::Object("erase response");
+		switch (f.kind) {
+			case ANTSNIFF_FIELD_U8: return Pothos::Object(uint8_t(f.number));
+			case ANTSNIFF_FIELD_U16: return Pothos::Object(uint16_t(f.number));
+			case ANTSNIFF_FIELD_U32: return Pothos::Object(uint32_t(f.number));
+			case ANTSNIFF_FIELD_STRING:
+				return Pothos::Object(std::string(f.string));
+			case ANTSNIFF_FIELD_BYTES:
+				return Pothos::Object(bytesToHex(f.bytes, f.length));
+		}
+		return Pothos::Object();
+	}
 
-		std::string temp;
-		switch (data[4]) {
-			case 0: temp = "OK"; break;
-			case 1: temp = "FAILED"; break;
-			case 2: temp = "ENOTREADY"; break;
-			default: temp = "EINVAL";
+	static std::string bytesToHex(const uint8_t *data, size_t length)
+	{
+		static const char digits[] = "0123456789ABCDEF";
+		std::string hex(3 * length, ' ');
+		for (size_t i = 0; i < length; ++i) {
+			hex[3 * i] = digits[data[i] >> 4];
+			hex[3 * i + 1] = digits[data[i] & 15];
 		}
-		packet["response"] = Pothos::Object(temp);
+
+		return hex;
 	}
 };
 
@@ -0,0 +1,211 @@
+#include <Pothos/Framework.hpp>
+#include "antsniff/antfsfiles.hpp"
+#include "MessageBatch.hpp"
+#include <memory>
+#include <string>
+
+/***********************************************************************
+ * |PothosDoc  ANT-FS File Extractor
+ *
+ * Extract the files downloaded over ANT-FS.
+ * The extractor block accepts messages (or batches of messages) produced by
+ * the "ShockBurst Decoder" block on input port 0, follows the download
+ * requests and responses in them, and writes the downloaded data to disk:
+ * every device gets a directory named after its address in the output
+ * directory, with its ANT-FS directory (0.directory) and its files
+ * ([index].fit or [index].bin) in it.
+ *
+ * Files are preallocated when their size is first seen, and each block is
+ * written at its offset as it streams in, so resumed downloads and blocks
+ * received out of order end up in place. The CRC of each block is checked
+ * incrementally, without buffering the block; see antfsfiles.hpp for how
+ * blocks are verified. Memory use doesn't depend on the file sizes: each
+ * followed device takes a fixed few kilobytes, and at most Max Transfers
+ * devices are followed at a time.
+ *
+ * <h2>Output format</h2>
+ *
+ * At the end of each download response, a message of type "file block" is
+ * posted with the "address", "index", "path", "offset", "length" and
+ * "file_size", its CRC "status" ("ok", "crc mismatch", "unverified" or
+ * "incomplete"), whether the file is now "complete" and verified, the
+ * number of "retransmissions" skipped, and the "sample" of the response.
+ * Each entry of a downloaded directory is posted as a "directory entry"
+ * message with its "index", "data_type", "identifier", "type_flags",
+ * "flags", "size" and "timestamp".
+ *
+ * |category /Sinks
+ * |keywords ant antfs ant-fs download file fit directory
+ *
+ * |param directory[Directory] Where the extracted files are written.
+ * |widget FileEntry(mode=directory)
+ * |default "antfs"
+ *
+ * |param maxTransfers[Max Transfers] The most devices followed at a time.
+ * |widget SpinBox(minimum=1)
+ * |default 16
+ * |preview valid
+ *
+ * |factory /antfs/file_extractor()
+ * |initializer setDirectory(directory)
+ * |initializer setMaxTransfers(maxTransfers)
+ **********************************************************************/
+class FileExtractor : public Pothos::Block
+{
+public:
+	FileExtractor(void):
+		_directory("antfs"),
+		_maxTransfers(16),
+		_newest(0),
+		_blocks(0),
+		_complete(0)
+	{
+		this->setupInput(0);
+		this->setupOutput(0);
+
+		this->registerCall(this, POTHOS_FCN_TUPLE(FileExtractor, setDirectory));
+		this->registerCall(this, POTHOS_FCN_TUPLE(FileExtractor, getDirectory));
+		this->registerCall(this, POTHOS_FCN_TUPLE(FileExtractor, setMaxTransfers));
+		this->registerCall(this, POTHOS_FCN_TUPLE(FileExtractor, getMaxTransfers));
+		this->registerCall(this, POTHOS_FCN_TUPLE(FileExtractor, getStats));
+	}
+
+	static Block *make(void)
+	{
+		return new FileExtractor();
+	}
+
+	void activate(void)
+	{
+		_extractor.reset(new antsniff::ANTFSExtractor(_directory, _maxTransfers));
+		_newest = 0;
+	}
+
+	void deactivate(void)
+	{
+		_extractor->flush([this](const antsniff::ANTFSFileBlock &b)
+		{
+			this->postBlock(b);
+		});
+		_extractor.reset();
+	}
+
+	void work(void)
+	{
+		auto input = this->input(0);
+
+		while (input->hasMessage()) {
+			auto msg = input->popMessage();
+			forEachMessage(msg, [this](const Pothos::ObjectKwargs &contents)
+			{
+				this->extract(contents);
+			});
+		}
+
+		// end the downloads that stopped for good
+		_extractor->expire(_newest, [this](const antsniff::ANTFSFileBlock &b)
+		{
+			this->postBlock(b);
+		});
+	}
+
+	void setDirectory(const std::string &directory)
+	{
+		_directory = directory;
+	}
+
+	std::string getDirectory(void) const
+	{
+		return _directory;
+	}
+
+	void setMaxTransfers(const size_t &maxTransfers)
+	{
+		_maxTransfers = maxTransfers;
+	}
+
+	size_t getMaxTransfers(void) const
+	{
+		return _maxTransfers;
+	}
+
+	Pothos::ObjectKwargs getStats(void) const
+	{
+		Pothos::ObjectKwargs stats;
+		stats["transfers"] = Pothos::Object(_extractor ? _extractor->transfers() : 0);
+		stats["blocks"] = Pothos::Object(_blocks);
+		stats["completeFiles"] = Pothos::Object(_complete);
+		if (_extractor) {
+			stats["bytesWritten"] = Pothos::Object(_extractor->bytesWritten());
+			stats["writeErrors"] = Pothos::Object(_extractor->writeErrors());
+		}
+		return stats;
+	}
+
+private:
+	std::string _directory;
+	size_t _maxTransfers;
+	std::unique_ptr<antsniff::ANTFSExtractor> _extractor;
+	uint64_t _newest;	// the latest sample seen
+	unsigned long long _blocks;
+	unsigned long long _complete;
+
+	void extract(const Pothos::ObjectKwargs &contents)
+	{
+		auto payload = messageField(contents, "payload");
+		if (payload.type() != typeid(std::vector<uint8_t>)) return;
+		auto &data = payload.extract<std::vector<uint8_t> >();
+
+		uint64_t address = messageField(contents, "address").convert<uint64_t>();
+		uint64_t sample = messageField(contents, "sample").convert<uint64_t>();
+		if (sample > _newest) _newest = sample;
+
+		_extractor->feed(address, data.data(), data.size(), sample,
+			[this](const antsniff::ANTFSFileBlock &b)
+			{
+				this->postBlock(b);
+			},
+			[this](const antsniff::ANTFSDirectoryEntry &e)
+			{
+				this->postEntry(e);
+			});
+	}
+
+	void postBlock(const antsniff::ANTFSFileBlock &b)
+	{
+		++_blocks;
+		if (b.complete) ++_complete;
+
+		Pothos::ObjectKwargs msg;
+		msg["type"] = Pothos::Object(std::string("file block"));
+		msg["address"] = Pothos::Object(b.address);
+		msg["index"] = Pothos::Object(b.index);
+		msg["path"] = Pothos::Object(std::string(b.path));
+		msg["offset"] = Pothos::Object(b.offset);
+		msg["length"] = Pothos::Object(b.length);
+		msg["file_size"] = Pothos::Object(b.fileSize);
+		msg["status"] = Pothos::Object(std::string(b.status));
+		msg["complete"] = Pothos::Object(b.complete);
+		msg["retransmissions"] = Pothos::Object(b.retransmissions);
+		msg["sample"] = Pothos::Object(b.sample);
+		this->output(0)->postMessage(msg);
+	}
+
+	void postEntry(const antsniff::ANTFSDirectoryEntry &e)
+	{
+		Pothos::ObjectKwargs msg;
+		msg["type"] = Pothos::Object(std::string("directory entry"));
+		msg["address"] = Pothos::Object(e.address);
+		msg["index"] = Pothos::Object(e.index);
+		msg["data_type"] = Pothos::Object(e.dataType);
+		msg["identifier"] = Pothos::Object(e.identifier);
+		msg["type_flags"] = Pothos::Object(e.typeFlags);
+		msg["flags"] = Pothos::Object(e.flags);
+		msg["size"] = Pothos::Object(e.size);
+		msg["timestamp"] = Pothos::Object(e.timestamp);
+		this->output(0)->postMessage(msg);
+	}
+};
+
+static Pothos::BlockRegistry registerFileExtractor(
+	"/antfs/file_extractor", &FileExtractor::make);
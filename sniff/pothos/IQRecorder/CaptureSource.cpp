@@ -0,0 +1,322 @@
+#include <Pothos/Framework.hpp>
+#include "antsniff/capture.h"
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+/***********************************************************************
+ * |PothosDoc  Capture Source
+ *
+ * Replay a recorded capture, faster than real time.
+ * The source block streams a headerless capture file (e.g. a recording of
+ * the "I/Q Recorder" block, or of rtl_sdr) on output port 0, as if it came
+ * from the SDR source, so a topology can be run against the same signal
+ * over and over, and a one hour capture takes minutes to reprocess.
+ *
+ * <h2>Output format</h2>
+ *
+ * By default the samples are posted as they are in the file, straight from
+ * a memory mapping of it, without copying them; I/Q captures then go through
+ * the "Freq Demod" block, like the SDR source's samples do. With Demodulate
+ * on, the source demodulates I/Q captures itself (see fmdemod.h), and posts
+ * int16 samples the "ShockBurst Decoder" block takes directly.
+ *
+ * The first buffer carries the same "rxTime" and "rxRate" labels the SDR
+ * source posts, with the time the capture was recorded at: its modification
+ * time minus its duration, unless Start Time says otherwise. So the decoders
+ * downstream stamp packets with their original receive times.
+ *
+ * <h2>Speed</h2>
+ *
+ * With Speed 0 the capture is replayed as fast as the topology can take it,
+ * which makes the replay throughput (see getStats()) a benchmark of the
+ * whole chain. Otherwise it is paced to that multiple of real time. At the
+ * end of the capture the "finished" signal is emitted with the stats, or the
+ * replay starts over if Repeat is on, for soak testing.
+ *
+ * |category /Sources
+ * |keywords capture replay file iq rtl_sdr benchmark soak
+ *
+ * |param format[Format] The sample format of the capture file.
+ * |option [s16 (demodulated)] "s16"
+ * |option [cs16 (complex int16)] "cs16"
+ * |option [cs8 (complex int8)] "cs8"
+ * |option [cu8 (complex uint8)] "cu8"
+ * |option [cf32 (complex float32)] "cf32"
+ * |default "cs16"
+ * |preview enable
+ *
+ * |param demodulate[Demodulate] Frequency demodulate I/Q captures, and post
+ * int16 samples for the ShockBurst Decoder.
+ * |option [Off] false
+ * |option [On] true
+ * |default false
+ * |preview enable
+ *
+ * |param path[File Path] The capture file.
+ * |widget FileEntry(mode=open)
+ * |default ""
+ *
+ * |param sampleRate[Sample Rate] The sample rate the capture was recorded at.
+ * |default 2e6
+ * |units samples/sec
+ *
+ * |param speed[Speed] The multiple of real time to replay at, 0 for as fast
+ * as possible.
+ * |default 0.0
+ * |preview valid
+ *
+ * |param startTime[Start Time] When the first sample was recorded, in
+ * seconds since the epoch. 0 takes it from the file's modification time.
+ * |default 0.0
+ * |units seconds
+ * |preview valid
+ *
+ * |param repeat[Repeat] Start over at the end of the capture.
+ * |option [Off] false
+ * |option [On] true
+ * |default false
+ * |preview valid
+ *
+ * |factory /iqrecorder/capture_source(format, demodulate)
+ * |initializer setPath(path)
+ * |initializer setSampleRate(sampleRate)
+ * |initializer setStartTime(startTime)
+ * |setter setSpeed(speed)
+ * |setter setRepeat(repeat)
+ **********************************************************************/
+class CaptureSource : public Pothos::Block
+{
+public:
+	CaptureSource(const std::string &format, const bool demodulate):
+		_format(capture_format(format.c_str())),
+		_demodulate(demodulate && _format != CAPTURE_S16),
+		_sampleRate(2e6),
+		_speed(0.0),
+		_startTime(0.0),
+		_repeat(false),
+		_pos(0),
+		_samples(0),
+		_passes(0),
+		_first(0),
+		_last(0),
+		_finished(false)
+	{
+		if (_format == CAPTURE_UNKNOWN) {
+			throw std::invalid_argument("CaptureSource: unknown format " + format);
+		}
+
+		this->setupOutput(0, this->outputType());
+
+		this->registerCall(this, POTHOS_FCN_TUPLE(CaptureSource, setPath));
+		this->registerCall(this, POTHOS_FCN_TUPLE(CaptureSource, getPath));
+		this->registerCall(this, POTHOS_FCN_TUPLE(CaptureSource, setSampleRate));
+		this->registerCall(this, POTHOS_FCN_TUPLE(CaptureSource, getSampleRate));
+		this->registerCall(this, POTHOS_FCN_TUPLE(CaptureSource, setSpeed));
+		this->registerCall(this, POTHOS_FCN_TUPLE(CaptureSource, getSpeed));
+		this->registerCall(this, POTHOS_FCN_TUPLE(CaptureSource, setStartTime));
+		this->registerCall(this, POTHOS_FCN_TUPLE(CaptureSource, getStartTime));
+		this->registerCall(this, POTHOS_FCN_TUPLE(CaptureSource, setRepeat));
+		this->registerCall(this, POTHOS_FCN_TUPLE(CaptureSource, getRepeat));
+		this->registerCall(this, POTHOS_FCN_TUPLE(CaptureSource, getStats));
+		this->registerSignal("finished");
+	}
+
+	static Block *make(const std::string &format, const bool demodulate)
+	{
+		return new CaptureSource(format, demodulate);
+	}
+
+	void activate(void)
+	{
+		if (_path.empty()) return;
+
+		// shared with the buffers posted from the mapping, which may outlive us
+		std::shared_ptr<CaptureFile> capture(new CaptureFile, [](CaptureFile *c)
+		{
+			capture_close(c);
+			delete c;
+		});
+		if (capture_open(capture.get(), _path.c_str(), _format) < 0) {
+			throw std::runtime_error("CaptureSource: cannot open " + _path);
+		}
+		_capture = capture;
+
+		_pos = 0;
+		_samples = 0;
+		_passes = 0;
+		_finished = false;
+		_first = _last = this->now();
+	}
+
+	void deactivate(void)
+	{
+		_capture.reset();
+	}
+
+	void work(void)
+	{
+		if (!_capture || _finished) return;
+		auto outPort = this->output(0);
+
+		if (_pos == _capture->samples) {
+			if (!_repeat || _capture->samples == 0) {
+				_finished = true;
+				this->callVoid("finished", this->getStats());
+				return;
+			}
+			_pos = 0;
+			++_passes;
+		}
+
+		// never more than 50 ms ahead of the wall clock when paced
+		uint64_t count = _capture->samples - _pos;
+		if (_speed > 0.0) {
+			uint64_t due = uint64_t((this->now() - _first) * 1e-9 *
+					_sampleRate * _speed + _sampleRate * _speed * 0.05);
+			if (due <= _samples) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+				return;
+			}
+			count = std::min<uint64_t>(count, due - _samples);
+		}
+
+		if (_samples == 0) {
+			long long start = _startTime > 0.0 ? (long long)(_startTime * 1e9) :
+				(long long)capture_start_time(_capture.get(), _sampleRate);
+			outPort->postLabel(Pothos::Label("rxTime", start, 0));
+			outPort->postLabel(Pothos::Label("rxRate", _sampleRate, 0));
+		}
+
+		if (_demodulate) {
+			auto &outBuff = outPort->buffer();
+			count = std::min<uint64_t>(count, outBuff.elements());
+			capture_demod(_capture.get(), _pos, size_t(count),
+					outBuff.as<int16_t *>());
+			capture_release(_capture.get(), _pos, count);
+			outPort->produce(size_t(count));
+		} else {
+			// hand out the mapping itself, a megabyte at a time
+			count = std::min<uint64_t>(count, (1 << 20) / _capture->elem_size);
+			Pothos::SharedBuffer shared(size_t(capture_at(_capture.get(), _pos)),
+					size_t(count * _capture->elem_size), _capture);
+			Pothos::BufferChunk chunk(shared);
+			chunk.dtype = outPort->dtype();
+			outPort->postBuffer(chunk);
+		}
+
+		_pos += count;
+		_samples += count;
+		_last = this->now();
+	}
+
+	void setPath(const std::string &path)
+	{
+		_path = path;
+	}
+
+	std::string getPath(void) const
+	{
+		return _path;
+	}
+
+	void setSampleRate(const double &sampleRate)
+	{
+		_sampleRate = sampleRate;
+	}
+
+	double getSampleRate(void) const
+	{
+		return _sampleRate;
+	}
+
+	void setSpeed(const double &speed)
+	{
+		// restart the pacing from here
+		_speed = speed;
+		_first = this->now() - int64_t(_samples / (_sampleRate *
+					(speed > 0.0 ? speed : 1.0)) * 1e9);
+	}
+
+	double getSpeed(void) const
+	{
+		return _speed;
+	}
+
+	void setStartTime(const double &startTime)
+	{
+		_startTime = startTime;
+	}
+
+	double getStartTime(void) const
+	{
+		return _startTime;
+	}
+
+	void setRepeat(const bool &repeat)
+	{
+		_repeat = repeat;
+	}
+
+	bool getRepeat(void) const
+	{
+		return _repeat;
+	}
+
+	/* Samples replayed so far, and how fast */
+	Pothos::ObjectKwargs getStats(void) const
+	{
+		double seconds = (_last - _first) * 1e-9;
+		double signal = _samples / _sampleRate;
+		Pothos::ObjectKwargs stats;
+		stats["samples"] = Pothos::Object((unsigned long long)_samples);
+		stats["passes"] = Pothos::Object((unsigned long long)_passes);
+		stats["seconds"] = Pothos::Object(seconds);
+		stats["signalSeconds"] = Pothos::Object(signal);
+		stats["msps"] = Pothos::Object(seconds > 0.0 ? _samples / seconds / 1e6 : 0.0);
+		stats["speedup"] = Pothos::Object(seconds > 0.0 ? signal / seconds : 0.0);
+		return stats;
+	}
+
+private:
+	CaptureFormat _format;
+	bool _demodulate;
+	std::string _path;
+	double _sampleRate;
+	double _speed;
+	double _startTime;	// s
+	bool _repeat;
+
+	std::shared_ptr<CaptureFile> _capture;
+	uint64_t _pos;	// next sample of the file
+	uint64_t _samples;	// posted since activation
+	uint64_t _passes;
+	int64_t _first;	// ns, when the replay started
+	int64_t _last;	// ns, when the last buffer was posted
+	bool _finished;
+
+	Pothos::DType outputType(void) const
+	{
+		if (_demodulate) return Pothos::DType(typeid(int16_t));
+
+		switch (_format) {
+			case CAPTURE_CS16: return Pothos::DType("complex_int16");
+			case CAPTURE_CS8: return Pothos::DType("complex_int8");
+			case CAPTURE_CU8: return Pothos::DType("complex_uint8");
+			case CAPTURE_CF32: return Pothos::DType("complex_float32");
+			default: return Pothos::DType("int16");
+		}
+	}
+
+	int64_t now(void) const
+	{
+		auto t = std::chrono::steady_clock::now().time_since_epoch();
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(t).count();
+	}
+};
+
+static Pothos::BlockRegistry registerCaptureSource(
+	"/iqrecorder/capture_source", &CaptureSource::make);
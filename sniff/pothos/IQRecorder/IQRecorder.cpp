@@ -0,0 +1,498 @@
+#include <Pothos/Framework.hpp>
+#include "antsniff/iqring.hpp"
+#include "ThreadPlacement.hpp"
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+
+/***********************************************************************
+ * |PothosDoc  I/Q Recorder
+ *
+ * Record raw samples around interesting events.
+ * The recorder block keeps the last few seconds of the sample stream on input
+ * port 0 in a preallocated ring buffer. When a message arrives on the
+ * "trigger" port, the window from the pre-roll before the trigger to the
+ * post-roll after it is written to a file in the background, so the
+ * recording never stalls the decoding chain.
+ *
+ * <h2>Input format</h2>
+ *
+ * Port 0 expects the raw sample stream, typically the output of the SDR
+ * source (in parallel with the "Freq Demod" block).
+ *
+ * The "trigger" port expects messages with a "sample" field, e.g. the
+ * "trigger" output of the "ANT-FS Decoder" block. The sample index is
+ * relative to the start of the stream, which is the same for the raw and the
+ * demodulated samples, as the "Freq Demod" block doesn't resample. A message
+ * that is just a number is used as the sample index itself. Overlapping
+ * windows are merged into one recording.
+ *
+ * <h2>Output format</h2>
+ *
+ * Each recording is written to the output directory as raw samples of the
+ * input data type, named iq_[first sample]_[reason].[data type].
+ * If the ring wraps while a recording is being written, it is written again
+ * from the oldest sample left (getTruncated() counts those), and a recording
+ * that fails to write is removed (getIoErrors() counts those), so every file
+ * left holds only valid samples.
+ *
+ * <h2>Real time operation</h2>
+ *
+ * The thread that copies samples into the ring and the I/O thread that
+ * writes recordings can be pinned to separate cores, so a slow disk never
+ * competes with the decoding chain for a CPU. The ring is allocated from the
+ * sample thread's cores, on their NUMA node. getThreadStats() returns where
+ * both threads run.
+ *
+ * |category /Sinks
+ * |keywords iq record capture trigger ring
+ *
+ * |param dtype[Data Type] The data type of the input samples.
+ * |widget DTypeChooser(int8=1,int16=1,float=1,cint=1,cfloat=1)
+ * |default "complex_int16"
+ * |preview disable
+ *
+ * |param directory[Directory] The directory recordings are written to.
+ * |widget FileEntry(mode=directory)
+ * |default "."
+ *
+ * |param sampleRate[Sample Rate] The sample rate of the input stream.
+ * |default 2e6
+ * |units samples/sec
+ *
+ * |param duration[Ring Duration] How much of the stream the ring buffer holds.
+ * Pre-roll can't be longer than this.
+ * |default 10.0
+ * |units seconds
+ *
+ * |param preRoll[Pre-roll] How much to record before the trigger.
+ * |default 1.0
+ * |units seconds
+ *
+ * |param postRoll[Post-roll] How much to record after the trigger.
+ * |default 1.0
+ * |units seconds
+ *
+ * |param hugePages[Huge Pages] Back the ring buffer with huge pages if the
+ * system has any reserved.
+ * |option [Off] false
+ * |option [On] true
+ * |default false
+ * |preview valid
+ *
+ * |param cpus[CPUs] Copy samples into the ring on a thread of its own, on
+ * these CPUs only, e.g. "2" or "2-3". Empty leaves it on the topology's
+ * thread pool.
+ * |default ""
+ * |preview valid
+ *
+ * |param priority[RT Priority] Real time priority of the sample thread
+ * (1-99), or 0 for normal scheduling.
+ * |widget SpinBox(minimum=0,maximum=99)
+ * |default 0
+ * |preview valid
+ *
+ * |param ioCpus[I/O CPUs] Write recordings on these CPUs only.
+ * |default ""
+ * |preview valid
+ *
+ * |factory /iqrecorder/iq_recorder(dtype)
+ * |initializer setDirectory(directory)
+ * |initializer setSampleRate(sampleRate)
+ * |initializer setDuration(duration)
+ * |initializer setHugePages(hugePages)
+ * |setter setPreRoll(preRoll)
+ * |setter setPostRoll(postRoll)
+ * |initializer setCpus(cpus)
+ * |initializer setPriority(priority)
+ * |initializer setIoCpus(ioCpus)
+ **********************************************************************/
+class IQRecorder : public Pothos::Block
+{
+public:
+	IQRecorder(const Pothos::DType &dtype):
+		_elemSize(dtype.size()),
+		_dtypeName(dtype.name()),
+		_directory("."),
+		_sampleRate(2e6),
+		_duration(10.0),
+		_preRoll(1.0),
+		_postRoll(1.0),
+		_hugePages(false),
+		_running(false),
+		_recordings(0),
+		_truncated(0),
+		_ioErrors(0)
+	{
+		this->setupInput(0, dtype);
+		this->setupInput("trigger");
+
+		this->registerCall(this, POTHOS_FCN_TUPLE(IQRecorder, setDirectory));
+		this->registerCall(this, POTHOS_FCN_TUPLE(IQRecorder, getDirectory));
+		this->registerCall(this, POTHOS_FCN_TUPLE(IQRecorder, setSampleRate));
+		this->registerCall(this, POTHOS_FCN_TUPLE(IQRecorder, getSampleRate));
+		this->registerCall(this, POTHOS_FCN_TUPLE(IQRecorder, setDuration));
+		this->registerCall(this, POTHOS_FCN_TUPLE(IQRecorder, getDuration));
+		this->registerCall(this, POTHOS_FCN_TUPLE(IQRecorder, setPreRoll));
+		this->registerCall(this, POTHOS_FCN_TUPLE(IQRecorder, getPreRoll));
+		this->registerCall(this, POTHOS_FCN_TUPLE(IQRecorder, setPostRoll));
+		this->registerCall(this, POTHOS_FCN_TUPLE(IQRecorder, getPostRoll));
+		this->registerCall(this, POTHOS_FCN_TUPLE(IQRecorder, setHugePages));
+		this->registerCall(this, POTHOS_FCN_TUPLE(IQRecorder, getHugePages));
+		this->registerCall(this, POTHOS_FCN_TUPLE(IQRecorder, getRecordings));
+		this->registerCall(this, POTHOS_FCN_TUPLE(IQRecorder, getTruncated));
+		this->registerCall(this, POTHOS_FCN_TUPLE(IQRecorder, getIoErrors));
+		this->registerCall(this, POTHOS_FCN_TUPLE(IQRecorder, setCpus));
+		this->registerCall(this, POTHOS_FCN_TUPLE(IQRecorder, getCpus));
+		this->registerCall(this, POTHOS_FCN_TUPLE(IQRecorder, setPriority));
+		this->registerCall(this, POTHOS_FCN_TUPLE(IQRecorder, getPriority));
+		this->registerCall(this, POTHOS_FCN_TUPLE(IQRecorder, setIoCpus));
+		this->registerCall(this, POTHOS_FCN_TUPLE(IQRecorder, getIoCpus));
+		this->registerCall(this, POTHOS_FCN_TUPLE(IQRecorder, getThreadStats));
+	}
+
+	static Block *make(const Pothos::DType &dtype)
+	{
+		return new IQRecorder(dtype);
+	}
+
+	void activate(void)
+	{
+		// allocate (and fault in) the whole ring before samples start flowing
+		_placement.allocate([this]()
+		{
+			_ring.reset(new antsniff::IQRing(_elemSize,
+						uint64_t(_duration * _sampleRate), _hugePages));
+		});
+		_ioPlacement.reapply();
+		_running = true;
+		_writer = std::thread(&IQRecorder::writerLoop, this);
+	}
+
+	void deactivate(void)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_running = false;
+		}
+		_cond.notify_one();
+		_writer.join();
+		_ring.reset();
+	}
+
+	void work(void)
+	{
+		_placement.observe();
+
+		auto trigger = this->input("trigger");
+		while (trigger->hasMessage()) {
+			this->handleTrigger(trigger->popMessage());
+		}
+
+		auto inPort = this->input(0);
+		auto &inBuff = inPort->buffer();
+		auto N = inBuff.elements();
+		if (N == 0) return;
+
+		_ring->push(inBuff.as<const void *>(), N);
+		inPort->consume(N);
+	}
+
+	void setDirectory(const std::string &directory)
+	{
+		_directory = directory;
+	}
+
+	std::string getDirectory(void) const
+	{
+		return _directory;
+	}
+
+	void setSampleRate(const double &sampleRate)
+	{
+		_sampleRate = sampleRate;
+	}
+
+	double getSampleRate(void) const
+	{
+		return _sampleRate;
+	}
+
+	void setDuration(const double &duration)
+	{
+		_duration = duration;
+	}
+
+	double getDuration(void) const
+	{
+		return _duration;
+	}
+
+	void setPreRoll(const double &preRoll)
+	{
+		_preRoll = preRoll;
+	}
+
+	double getPreRoll(void) const
+	{
+		return _preRoll;
+	}
+
+	void setPostRoll(const double &postRoll)
+	{
+		_postRoll = postRoll;
+	}
+
+	double getPostRoll(void) const
+	{
+		return _postRoll;
+	}
+
+	void setHugePages(const bool &hugePages)
+	{
+		_hugePages = hugePages;
+	}
+
+	bool getHugePages(void) const
+	{
+		return _hugePages;
+	}
+
+	unsigned long long getRecordings(void) const
+	{
+		return _recordings;
+	}
+
+	/* Recordings that lost (part of) their pre-roll to the ring wrapping */
+	unsigned long long getTruncated(void) const
+	{
+		return _truncated;
+	}
+
+	/* Recordings that could not be written (and were removed) */
+	unsigned long long getIoErrors(void) const
+	{
+		return _ioErrors;
+	}
+
+	void setCpus(const std::string &cpus)
+	{
+		_placement.setCpus(cpus);
+		_placement.place(*this);
+	}
+
+	std::string getCpus(void) const
+	{
+		return _placement.cpus();
+	}
+
+	void setPriority(const int &priority)
+	{
+		_placement.setPriority(priority);
+		_placement.place(*this);
+	}
+
+	int getPriority(void) const
+	{
+		return _placement.priority();
+	}
+
+	void setIoCpus(const std::string &cpus)
+	{
+		_ioPlacement.setCpus(cpus);
+	}
+
+	std::string getIoCpus(void) const
+	{
+		return _ioPlacement.cpus();
+	}
+
+	/* Where the sample ("dsp") and the I/O ("io") threads run */
+	Pothos::ObjectKwargs getThreadStats(void) const
+	{
+		Pothos::ObjectKwargs stats;
+		stats["dsp"] = Pothos::Object(_placement.stats());
+		stats["io"] = Pothos::Object(_ioPlacement.stats());
+		return stats;
+	}
+
+private:
+	struct Recording
+	{
+		uint64_t start;
+		uint64_t end;
+		std::string reason;
+	};
+
+	// times a lapped recording is written again before it is given up on
+	static const int MAX_ATTEMPTS = 3;
+
+	size_t _elemSize;
+	std::string _dtypeName;
+	std::string _directory;
+	double _sampleRate;
+	double _duration;
+	double _preRoll;
+	double _postRoll;
+	bool _hugePages;
+
+	std::unique_ptr<antsniff::IQRing> _ring;
+	std::thread _writer;
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	std::deque<Recording> _pending;
+	bool _running;
+
+	std::atomic<unsigned long long> _recordings;
+	std::atomic<unsigned long long> _truncated;
+	std::atomic<unsigned long long> _ioErrors;
+
+	ThreadPlacement _placement;
+	ThreadPlacement _ioPlacement;	// only touched by the I/O thread once running
+
+	void handleTrigger(const Pothos::Object &msg)
+	{
+		uint64_t sample;
+		std::string reason = "trigger";
+
+		if (msg.type() == typeid(Pothos::ObjectKwargs)) {
+			auto contents = msg.extract<Pothos::ObjectKwargs>();
+			auto it = contents.find("sample");
+			if (it == contents.end()) return;
+			sample = it->second.convert<uint64_t>();
+			it = contents.find("reason");
+			if (it != contents.end()) reason = it->second.convert<std::string>();
+		} else {
+			sample = msg.convert<uint64_t>();
+		}
+
+		uint64_t pre = uint64_t(_preRoll * _sampleRate);
+		Recording rec;
+		rec.start = sample > pre ? sample - pre : 0;
+		rec.end = sample + uint64_t(_postRoll * _sampleRate);
+		rec.reason = reason;
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (!_pending.empty() && _pending.back().end >= rec.start) {
+				_pending.back().end = std::max(_pending.back().end, rec.end);
+			} else {
+				_pending.push_back(rec);
+			}
+		}
+		_cond.notify_one();
+	}
+
+	/*
+	 * I/O thread: waits until the post-roll of the oldest pending recording is
+	 * in the ring, then writes it straight from the ring to disk.
+	 */
+	void writerLoop(void)
+	{
+		_ioPlacement.apply();
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		while (_running || !_pending.empty()) {
+			if (_pending.empty()) {
+				_cond.wait(lock);
+				continue;
+			}
+
+			// the DSP thread never signals progress, so poll for the post-roll
+			if (_running && _ring->written() < _pending.front().end) {
+				_cond.wait_for(lock, std::chrono::milliseconds(10));
+				continue;
+			}
+
+			Recording rec = _pending.front();
+			_pending.pop_front();
+			lock.unlock();
+			this->writeRecording(rec);
+			lock.lock();
+		}
+	}
+
+	/*
+	 * Write [rec.start, rec.end) to a file from the ring. If the ring wraps
+	 * under the copy, the head of the file is garbage: it is written again
+	 * from the oldest sample still valid, so only clean recordings are kept.
+	 */
+	void writeRecording(Recording &rec)
+	{
+		std::string reason(rec.reason);
+		for (auto &c : reason) {
+			if (!isalnum(c)) c = '-';
+		}
+
+		bool truncated = false;
+		for (int attempt = 0; attempt < MAX_ATTEMPTS; ++attempt) {
+			if (rec.start < _ring->oldest()) {
+				rec.start = _ring->oldest();
+				truncated = true;
+			}
+			if (rec.start >= rec.end) break;
+
+			char name[64];
+			std::snprintf(name, sizeof(name), "iq_%llu_", (unsigned long long)rec.start);
+			std::string path = _directory + "/" + name + reason + "." + _dtypeName;
+
+			uint64_t valid;
+			if (!this->writeFile(path, rec, valid)) {
+				unlink(path.c_str());
+				++_ioErrors;
+				return;
+			}
+			if (valid <= rec.start) {
+				if (truncated) ++_truncated;
+				++_recordings;
+				return;
+			}
+
+			// lapped while writing
+			unlink(path.c_str());
+			rec.start = valid;
+			truncated = true;
+		}
+
+		// the disk can't keep up with the ring: nothing clean to keep
+		++_truncated;
+	}
+
+	/* Returns false on an I/O error, and in valid the first sample intact */
+	bool writeFile(const std::string &path, const Recording &rec, uint64_t &valid)
+	{
+		int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) return false;
+
+		bool ok = true;
+		auto elemSize = _ring->elemSize();
+		valid = _ring->read(rec.start, rec.end,
+				[fd, elemSize, &ok](const uint8_t *p, size_t n)
+				{
+					size_t bytes = n * elemSize;
+					while (ok && bytes > 0) {
+						ssize_t r = ::write(fd, p, bytes);
+						if (r <= 0) ok = false;
+						else {
+							p += r;
+							bytes -= r;
+						}
+					}
+				});
+		if (close(fd) < 0) ok = false;
+
+		return ok;
+	}
+};
+
+static Pothos::BlockRegistry registerIQRecorder(
+	"/iqrecorder/iq_recorder", &IQRecorder::make);
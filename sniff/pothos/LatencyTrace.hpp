@@ -0,0 +1,69 @@
+#pragma once
+#include <Pothos/Framework.hpp>
+#include "antsniff/latency.hpp"
+#include <chrono>
+#include <map>
+#include <string>
+
+/*
+ * Latency tracing through the decoder blocks.
+ *
+ * With tracing enabled in the ShockBurst Decoder, every packet carries
+ * "t_origin": the host time (system clock, ns) its latency is measured from.
+ * Each block then stamps its entry and exit ("t_<stage>_in", "t_<stage>_out")
+ * into the messages it posts, and records how long after t_origin a packet
+ * reached and left it in per-stage histograms. The blocks export these as
+ * getLatencyStats() (percentiles in microseconds), so queueing between the
+ * blocks shows up as the gap between one stage's "out" and the next one's
+ * "in".
+ */
+inline int64_t traceNow(void)
+{
+	auto now = std::chrono::system_clock::now().time_since_epoch();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+class LatencyTrace
+{
+public:
+	/* Record now - t_origin of a packet under name, if it's traced */
+	void record(const std::string &name, const Pothos::ObjectKwargs &packet,
+			int64_t now)
+	{
+		auto it = packet.find("t_origin");
+		if (it == packet.end()) return;
+		_stages[name].record(now - it->second.convert<int64_t>());
+	}
+
+	void record(const std::string &name, int64_t latency)
+	{
+		_stages[name].record(latency);
+	}
+
+	/* Per stage count, mean, max and percentiles, in microseconds */
+	Pothos::ObjectKwargs stats(void) const
+	{
+		Pothos::ObjectKwargs all;
+		for (auto &stage : _stages) {
+			const antsniff::LatencyHistogram &h = stage.second;
+			Pothos::ObjectKwargs s;
+			s["count"] = Pothos::Object(h.count());
+			s["mean"] = Pothos::Object(h.mean() / 1e3);
+			s["p50"] = Pothos::Object(h.percentile(50.0) / 1e3);
+			s["p90"] = Pothos::Object(h.percentile(90.0) / 1e3);
+			s["p99"] = Pothos::Object(h.percentile(99.0) / 1e3);
+			s["p999"] = Pothos::Object(h.percentile(99.9) / 1e3);
+			s["max"] = Pothos::Object(h.max() / 1e3);
+			all[stage.first] = Pothos::Object(s);
+		}
+		return all;
+	}
+
+	void reset(void)
+	{
+		_stages.clear();
+	}
+
+private:
+	std::map<std::string, antsniff::LatencyHistogram> _stages;
+};
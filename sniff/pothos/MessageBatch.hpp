@@ -0,0 +1,84 @@
+#pragma once
+#include <Pothos/Framework.hpp>
+#include <chrono>
+#include <string>
+
+/*
+ * Batched message transfer between the decoder blocks.
+ *
+ * Posting a message costs a full scheduler round trip downstream, so instead
+ * of one message per packet, a MessageBatcher collects packets and posts them
+ * as one Pothos::ObjectVector when either maxBatch packets are waiting, or the
+ * oldest one has waited maxLatency milliseconds. With maxBatch <= 1 every
+ * packet is posted on its own, as a plain message, like before.
+ *
+ * Receivers use forEachMessage() to handle both forms.
+ */
+class MessageBatcher
+{
+public:
+	size_t maxBatch;
+	double maxLatency; // milliseconds
+
+	MessageBatcher(void):
+		maxBatch(1),
+		maxLatency(0.0)
+	{ }
+
+	void push(Pothos::OutputPort *port, const Pothos::Object &msg)
+	{
+		if (maxBatch <= 1) {
+			port->postMessage(msg);
+			return;
+		}
+
+		if (_batch.empty()) _oldest = std::chrono::steady_clock::now();
+		_batch.push_back(msg);
+		if (_batch.size() >= maxBatch) this->flush(port);
+	}
+
+	/* Post the batch if its oldest packet is due; call at the end of work() */
+	void poll(Pothos::OutputPort *port)
+	{
+		if (_batch.empty()) return;
+
+		std::chrono::duration<double, std::milli> age =
+			std::chrono::steady_clock::now() - _oldest;
+		if (age.count() >= maxLatency) this->flush(port);
+	}
+
+	void flush(Pothos::OutputPort *port)
+	{
+		if (_batch.empty()) return;
+
+		port->postMessage(_batch);
+		_batch.clear();
+	}
+
+private:
+	Pothos::ObjectVector _batch;
+	std::chrono::steady_clock::time_point _oldest;
+};
+
+/* Call fn(kwargs) for a single message, or for each message of a batch */
+template <typename Fn>
+void forEachMessage(const Pothos::Object &msg, Fn fn)
+{
+	if (msg.type() == typeid(Pothos::ObjectKwargs)) {
+		fn(msg.extract<Pothos::ObjectKwargs>());
+	} else if (msg.type() == typeid(Pothos::ObjectVector)) {
+		for (auto &item : msg.extract<Pothos::ObjectVector>()) {
+			if (item.type() == typeid(Pothos::ObjectKwargs)) {
+				fn(item.extract<Pothos::ObjectKwargs>());
+			}
+		}
+	}
+}
+
+/* Look up a field of a packet, or a null object if it's missing */
+inline Pothos::Object messageField(const Pothos::ObjectKwargs &kwargs,
+		const std::string &key)
+{
+	auto it = kwargs.find(key);
+	return it == kwargs.end() ? Pothos::Object() : it->second;
+}
@@ -0,0 +1,152 @@
+#pragma once
+#include <Pothos/Framework.hpp>
+#include "MessageBatch.hpp"
+#include <algorithm>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+/*
+ * Bounded message queue, for shedding load between the decoder blocks.
+ *
+ * Pothos message queues are unbounded, so when the packets arrive faster
+ * than a block handles them, its backlog (and every packet's latency) grows
+ * without limit. A MessageQueue takes everything queued on an input port
+ * (unpacking batches), and if more than maxQueue packets are waiting, sheds
+ * the excess by policy:
+ *
+ *   "oldest"   the oldest packets go first
+ *   "beacons"  repeated beacons go first: a beacon identical to a newer
+ *              queued beacon of the same device carries no news; then the
+ *              oldest packets
+ *   "none"     nothing is shed, the queue is unbounded
+ *
+ * Everything shed is counted, see stats().
+ */
+class MessageQueue
+{
+public:
+	size_t maxQueue;
+
+	MessageQueue(void):
+		maxQueue(1024),
+		_shed(false),
+		_beaconsFirst(false),
+		_highWater(0),
+		_shedOldest(0),
+		_shedBeacons(0)
+	{ }
+
+	void setPolicy(const std::string &policy)
+	{
+		if (policy != "none" && policy != "oldest" && policy != "beacons") {
+			throw std::invalid_argument("MessageQueue: unknown policy " + policy);
+		}
+		_shed = policy != "none";
+		_beaconsFirst = policy == "beacons";
+	}
+
+	std::string policy(void) const
+	{
+		if (!_shed) return "none";
+		return _beaconsFirst ? "beacons" : "oldest";
+	}
+
+	/* Take everything queued on port, and shed down to maxQueue packets */
+	void fill(Pothos::InputPort *port)
+	{
+		while (port->hasMessage()) {
+			auto msg = port->popMessage();
+			if (msg.type() == typeid(Pothos::ObjectVector)) {
+				for (auto &item : msg.extract<Pothos::ObjectVector>()) {
+					_queue.push_back(item);
+				}
+			} else {
+				_queue.push_back(msg);
+			}
+		}
+
+		_highWater = std::max(_highWater, _queue.size());
+		if (!_shed || _queue.size() <= maxQueue) return;
+
+		if (_beaconsFirst) this->shedBeacons();
+		while (_queue.size() > maxQueue) {
+			_queue.pop_front();
+			++_shedOldest;
+		}
+	}
+
+	/* Call fn(kwargs) for each queued packet, oldest first, emptying it */
+	template <typename Fn>
+	void drain(Fn fn)
+	{
+		while (!_queue.empty()) {
+			Pothos::Object msg = _queue.front();
+			_queue.pop_front();
+			if (msg.type() == typeid(Pothos::ObjectKwargs)) {
+				fn(msg.extract<Pothos::ObjectKwargs>());
+			}
+		}
+	}
+
+	Pothos::ObjectKwargs stats(void) const
+	{
+		Pothos::ObjectKwargs stats;
+		stats["queued"] = Pothos::Object(_queue.size());
+		stats["highWater"] = Pothos::Object(_highWater);
+		stats["shedOldest"] = Pothos::Object(_shedOldest);
+		stats["shedBeacons"] = Pothos::Object(_shedBeacons);
+		return stats;
+	}
+
+private:
+	std::deque<Pothos::Object> _queue;
+	bool _shed;
+	bool _beaconsFirst;
+	size_t _highWater;
+	unsigned long long _shedOldest;
+	unsigned long long _shedBeacons;
+
+	/* The address and payload of a beacon, or an empty key */
+	static std::string beaconKey(const Pothos::Object &msg)
+	{
+		if (msg.type() != typeid(Pothos::ObjectKwargs)) return std::string();
+		auto &kwargs = msg.extract<Pothos::ObjectKwargs>();
+
+		auto payload = messageField(kwargs, "payload");
+		if (payload.type() != typeid(std::vector<uint8_t>)) return std::string();
+		auto &data = payload.extract<std::vector<uint8_t> >();
+		if (data.size() < 10 || data[2] != 0x43) return std::string();
+
+		uint64_t address = messageField(kwargs, "address").convert<uint64_t>();
+		std::string key(reinterpret_cast<const char *>(&address), sizeof(address));
+		key.append(data.begin() + 3, data.end());
+		return key;
+	}
+
+	/* Drop repeated beacons, oldest first, until the queue fits */
+	void shedBeacons(void)
+	{
+		// a beacon is a repeat if a newer one is the same
+		std::vector<bool> repeat(_queue.size(), false);
+		std::unordered_set<std::string> newer;
+		for (size_t i = _queue.size(); i-- > 0;) {
+			std::string key = beaconKey(_queue[i]);
+			if (!key.empty()) repeat[i] = !newer.insert(key).second;
+		}
+
+		std::deque<Pothos::Object> kept;
+		size_t excess = _queue.size() - maxQueue;
+		for (size_t i = 0; i < _queue.size(); ++i) {
+			if (excess > 0 && repeat[i]) {
+				--excess;
+				++_shedBeacons;
+				continue;
+			}
+			kept.push_back(_queue[i]);
+		}
+		_queue.swap(kept);
+	}
+};
@@ -0,0 +1,201 @@
+#include <Pothos/Framework.hpp>
+#include "MessageBatch.hpp"
+#include "LatencyTrace.hpp"
+#include "antsniff/packetlog.h"
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/***********************************************************************
+ * |PothosDoc  Packet Log Sink
+ *
+ * Write ShockBurst packets to a binary packet log.
+ * The sink block accepts messages (or batches of messages) produced by the
+ * "ShockBurst Decoder" block on input port 0, and appends them to a compact, length-prefixed binary log with
+ * a sparse sample/address index next to it (path + ".idx").
+ *
+ * The log is the same format "shockburst -w" writes, and can be queried with
+ * the "antlog" tool without parsing any text.
+ *
+ * |category /Sinks
+ * |keywords shockburst log record file
+ *
+ * |param path[File Path] The path of the packet log. Sample indices restart
+ * with every run, so an existing log is replaced.
+ * |widget FileEntry(mode=save)
+ * |default ""
+ *
+ * |param channel[Channel] The RF channel the packets were received on. The
+ * real frequency is this value plus 2.4 GHz.
+ * |widget SpinBox(minimum=0,maximum=127)
+ * |default 50
+ *
+ * |param addressLength[Address Length] The length of the address field in bytes
+ * (3-5), as configured in the ShockBurst Decoder.
+ * |option [3] 3
+ * |option [4] 4
+ * |option [5] 5
+ * |default 5
+ *
+ * |param sampleRate[Sample Rate] The sample rate of the decoder input, stored
+ * in the log header to convert sample indices to time.
+ * |default 2e6
+ * |units samples/sec
+ *
+ * |factory /shockburst/packet_log_sink()
+ * |initializer setPath(path)
+ * |initializer setChannel(channel)
+ * |initializer setAddressLength(addressLength)
+ * |initializer setSampleRate(sampleRate)
+ **********************************************************************/
+class PacketLogSink : public Pothos::Block
+{
+public:
+	PacketLogSink(void):
+		_channel(50),
+		_addressLength(5),
+		_sampleRate(2e6)
+	{
+		this->setupInput(0);
+
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketLogSink, setPath));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketLogSink, getPath));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketLogSink, setChannel));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketLogSink, getChannel));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketLogSink, setAddressLength));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketLogSink, getAddressLength));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketLogSink, setSampleRate));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketLogSink, getSampleRate));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketLogSink, getLatencyStats));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketLogSink, resetLatencyStats));
+
+		_log.log = nullptr;
+	}
+
+	~PacketLogSink(void)
+	{
+		plog_close(&_log);
+	}
+
+	static Block *make(void)
+	{
+		return new PacketLogSink();
+	}
+
+	void activate(void)
+	{
+		if (_path.empty()) return;
+
+		auto now = std::chrono::system_clock::now().time_since_epoch();
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now);
+		if (plog_open(&_log, _path.c_str(), uint32_t(_sampleRate),
+					uint64_t(ns.count()), 0) < 0)
+		{
+			throw std::runtime_error("PacketLogSink: cannot open " + _path);
+		}
+	}
+
+	void deactivate(void)
+	{
+		plog_close(&_log);
+	}
+
+	void work(void)
+	{
+		auto input = this->input(0);
+		const int64_t now = traceNow();
+
+		// a sink never has a reason to leave messages queued
+		while (input->hasMessage()) {
+			auto msg = input->popMessage();
+			if (!_log.log) continue;
+
+			forEachMessage(msg, [this, now](const Pothos::ObjectKwargs &contents)
+			{
+				_trace.record("sink", contents, now);
+				auto payload = messageField(contents, "payload");
+				if (payload.type() != typeid(std::vector<uint8_t>)) return;
+				auto &data = payload.extract<std::vector<uint8_t> >();
+
+				PacketLogRecord rec;
+				rec.sample = messageField(contents, "sample").convert<uint64_t>();
+				rec.address = messageField(contents, "address").convert<uint64_t>();
+				rec.crc = messageField(contents, "crc").convert<uint16_t>();
+				rec.channel = _channel;
+				rec.address_length = _addressLength;
+				rec.payload_length = uint8_t(data.size());
+				rec.payload = data.data();
+				plog_write(&_log, &rec);
+			});
+		}
+	}
+
+	void setPath(const std::string &path)
+	{
+		_path = path;
+
+		// reopen if the path changes while running
+		if (_log.log) {
+			plog_close(&_log);
+			this->activate();
+		}
+	}
+
+	std::string getPath(void) const
+	{
+		return _path;
+	}
+
+	void setChannel(const uint8_t &channel)
+	{
+		_channel = channel;
+	}
+
+	uint8_t getChannel(void) const
+	{
+		return _channel;
+	}
+
+	void setAddressLength(const uint8_t &addressLength)
+	{
+		_addressLength = addressLength;
+	}
+
+	uint8_t getAddressLength(void) const
+	{
+		return _addressLength;
+	}
+
+	void setSampleRate(const double &sampleRate)
+	{
+		_sampleRate = sampleRate;
+	}
+
+	double getSampleRate(void) const
+	{
+		return _sampleRate;
+	}
+
+	/* Latency of the traced packets on arrival (see LatencyTrace.hpp) */
+	Pothos::ObjectKwargs getLatencyStats(void) const
+	{
+		return _trace.stats();
+	}
+
+	void resetLatencyStats(void)
+	{
+		_trace.reset();
+	}
+
+private:
+	std::string _path;
+	uint8_t _channel;
+	uint8_t _addressLength;
+	double _sampleRate;
+	PacketLogWriter _log;
+	LatencyTrace _trace;
+};
+
+static Pothos::BlockRegistry registerPacketLogSink(
+	"/shockburst/packet_log_sink", &PacketLogSink::make);
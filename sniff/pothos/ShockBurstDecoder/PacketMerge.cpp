@@ -0,0 +1,267 @@
+#include <Pothos/Framework.hpp>
+#include "MessageBatch.hpp"
+#include "antsniff/dedup.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+/***********************************************************************
+ * |PothosDoc  Packet Merge
+ *
+ * Merge the packets of several receivers.
+ * The merge block accepts messages (or batches of messages) produced by one
+ * "ShockBurst Decoder" block per receiver, on input ports 0 to N-1, and
+ * produces a single stream of unique packets on output port 0.
+ *
+ * <h2>Alignment</h2>
+ *
+ * The "sample" index of each packet is moved onto a common clock by adding
+ * the sample offset of its input: the offsets are the differences between
+ * the first samples of the receivers, e.g. [0, -1200, 350]. Missing offsets
+ * are 0.
+ *
+ * <h2>Deduplication</h2>
+ *
+ * Packets with the same address, payload and CRC within the dedupe window of
+ * each other are copies of the same frame. Only the copy with the highest
+ * slicer "margin" is kept; it is posted with the aligned "sample" of the
+ * earliest copy, the "receiver" input it came from, and the number of
+ * "copies" received. Frames are held for the window plus the reorder delay
+ * (on the common clock), which must cover how far the receivers' decoders
+ * may run ahead of each other, and are posted when newer packets arrive or
+ * the flow stops.
+ *
+ * |category /Decode
+ * |keywords shockburst merge dedupe diversity receiver
+ *
+ * |param numInputs[Num Inputs] The number of receivers.
+ * |widget SpinBox(minimum=1)
+ * |default 2
+ * |preview disable
+ *
+ * |param sampleOffsets[Sample Offsets] The offset of each input's sample
+ * clock, in samples.
+ * |default []
+ *
+ * |param sampleRate[Sample Rate] The sample rate of the decoder inputs.
+ * |default 2e6
+ * |units samples/sec
+ *
+ * |param window[Dedupe Window] Copies of a frame are at most this far apart.
+ * |default 1.0
+ * |units ms
+ *
+ * |param delay[Reorder Delay] How long a frame is held for late copies.
+ * |default 50.0
+ * |units ms
+ *
+ * |param capacity[Capacity] The maximum number of frames held.
+ * |widget SpinBox(minimum=16)
+ * |default 4096
+ * |preview valid
+ *
+ * |param maxBatch[Max Batch] The maximum number of packets per output
+ * message. 1 disables batching.
+ * |widget SpinBox(minimum=1)
+ * |default 1
+ * |preview valid
+ *
+ * |factory /shockburst/packet_merge(numInputs)
+ * |setter setSampleOffsets(sampleOffsets)
+ * |initializer setSampleRate(sampleRate)
+ * |initializer setWindow(window)
+ * |initializer setDelay(delay)
+ * |initializer setCapacity(capacity)
+ * |setter setMaxBatch(maxBatch)
+ **********************************************************************/
+class PacketMerge : public Pothos::Block
+{
+public:
+	PacketMerge(const size_t numInputs):
+		_sampleRate(2e6),
+		_window(1.0),
+		_delay(50.0),
+		_capacity(4096),
+		_unique(0)
+	{
+		for (size_t i = 0; i < numInputs; i++) this->setupInput(i);
+		this->setupOutput(0);
+
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketMerge, setSampleOffsets));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketMerge, getSampleOffsets));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketMerge, setSampleRate));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketMerge, getSampleRate));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketMerge, setWindow));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketMerge, getWindow));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketMerge, setDelay));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketMerge, getDelay));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketMerge, setCapacity));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketMerge, getCapacity));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketMerge, setMaxBatch));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketMerge, getMaxBatch));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketMerge, getUniquePackets));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PacketMerge, getDuplicatePackets));
+	}
+
+	static Block *make(const size_t numInputs)
+	{
+		return new PacketMerge(numInputs);
+	}
+
+	void activate(void)
+	{
+		_dedup.reset(new Deduper(_capacity,
+					uint64_t(_window * _sampleRate / 1000.0),
+					uint64_t(_delay * _sampleRate / 1000.0)));
+		_unique = 0;
+	}
+
+	void deactivate(void)
+	{
+		auto outPort = this->output(0);
+		_dedup->flush([this, outPort](Pothos::ObjectKwargs &packet,
+					uint64_t sample, uint32_t copies)
+		{
+			this->emit(outPort, packet, sample, copies);
+		});
+		_batch.flush(outPort);
+	}
+
+	void work(void)
+	{
+		auto outPort = this->output(0);
+		auto emit = [this, outPort](Pothos::ObjectKwargs &packet,
+				uint64_t sample, uint32_t copies)
+		{
+			this->emit(outPort, packet, sample, copies);
+		};
+
+		for (auto input : this->inputs()) {
+			const size_t index = input->index();
+			const int64_t offset = index < _sampleOffsets.size() ?
+				_sampleOffsets[index] : 0;
+
+			while (input->hasMessage()) {
+				auto msg = input->popMessage();
+				forEachMessage(msg, [&](const Pothos::ObjectKwargs &contents)
+				{
+					auto payload = messageField(contents, "payload");
+					if (payload.type() != typeid(std::vector<uint8_t>)) return;
+					auto &data = payload.extract<std::vector<uint8_t> >();
+
+					auto sample = messageField(contents, "sample");
+					auto margin = messageField(contents, "margin");
+					int64_t aligned = int64_t(sample.convert<uint64_t>()) + offset;
+
+					uint64_t key = antsniff::frameKey(
+						messageField(contents, "address").convert<uint64_t>(),
+						data.data(), data.size(),
+						messageField(contents, "crc").convert<uint16_t>());
+
+					Pothos::ObjectKwargs packet(contents);
+					packet["receiver"] = Pothos::Object(index);
+					_dedup->offer(key, uint64_t(aligned < 0 ? 0 : aligned),
+						margin ? margin.convert<int32_t>() : 0,
+						std::move(packet), emit);
+				});
+			}
+		}
+
+		// work() only runs when packets arrive, so don't hold a batch back
+		_batch.flush(outPort);
+	}
+
+	void setSampleOffsets(const std::vector<int64_t> &sampleOffsets)
+	{
+		_sampleOffsets = sampleOffsets;
+	}
+
+	std::vector<int64_t> getSampleOffsets(void) const
+	{
+		return _sampleOffsets;
+	}
+
+	void setSampleRate(const double &sampleRate)
+	{
+		_sampleRate = sampleRate;
+	}
+
+	double getSampleRate(void) const
+	{
+		return _sampleRate;
+	}
+
+	void setWindow(const double &window)
+	{
+		_window = window;
+	}
+
+	double getWindow(void) const
+	{
+		return _window;
+	}
+
+	void setDelay(const double &delay)
+	{
+		_delay = delay;
+	}
+
+	double getDelay(void) const
+	{
+		return _delay;
+	}
+
+	void setCapacity(const size_t &capacity)
+	{
+		_capacity = capacity;
+	}
+
+	size_t getCapacity(void) const
+	{
+		return _capacity;
+	}
+
+	void setMaxBatch(const size_t &maxBatch)
+	{
+		_batch.maxBatch = maxBatch;
+	}
+
+	size_t getMaxBatch(void) const
+	{
+		return _batch.maxBatch;
+	}
+
+	uint64_t getUniquePackets(void) const
+	{
+		return _unique;
+	}
+
+	uint64_t getDuplicatePackets(void) const
+	{
+		return _dedup ? _dedup->duplicates() : 0;
+	}
+
+private:
+	typedef antsniff::FrameDeduper<Pothos::ObjectKwargs> Deduper;
+
+	std::vector<int64_t> _sampleOffsets;
+	double _sampleRate;
+	double _window;	// ms
+	double _delay;	// ms
+	size_t _capacity;
+	uint64_t _unique;
+	std::unique_ptr<Deduper> _dedup;
+	MessageBatcher _batch;
+
+	void emit(Pothos::OutputPort *port, Pothos::ObjectKwargs &packet,
+			uint64_t sample, uint32_t copies)
+	{
+		packet["sample"] = Pothos::Object(sample);
+		packet["copies"] = Pothos::Object(copies);
+		_batch.push(port, Pothos::Object(std::move(packet)));
+		++_unique;
+	}
+};
+
+static Pothos::BlockRegistry registerPacketMerge(
+	"/shockburst/packet_merge", &PacketMerge::make);
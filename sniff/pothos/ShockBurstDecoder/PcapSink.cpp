@@ -0,0 +1,247 @@
+#include <Pothos/Framework.hpp>
+#include "MessageBatch.hpp"
+#include "LatencyTrace.hpp"
+#include "antsniff/pcapng.h"
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/***********************************************************************
+ * |PothosDoc  PCAPNG Sink
+ *
+ * Write ShockBurst packets to PCAPNG files.
+ * The sink block accepts messages (or batches of messages) produced by the
+ * "ShockBurst Decoder" block on input port 0, and writes them to a PCAPNG file that can be opened in
+ * Wireshark (with the antsniff.lua dissector) or any other pcap tool.
+ *
+ * Each packet carries a pseudo header with the channel, the slicer threshold
+ * and the sample index it was found at; see pcapng.h for the format. Packets
+ * are batched into large writes, and the file can be rotated by size or time,
+ * in which case the files are named path.0, path.1, ...
+ *
+ * |category /Sinks
+ * |keywords shockburst pcap pcapng wireshark file
+ *
+ * |param path[File Path] The path of the PCAPNG file.
+ * |widget FileEntry(mode=save)
+ * |default ""
+ *
+ * |param channel[Channel] The RF channel the packets were received on. The
+ * real frequency is this value plus 2.4 GHz.
+ * |widget SpinBox(minimum=0,maximum=127)
+ * |default 50
+ *
+ * |param addressLength[Address Length] The length of the address field in bytes
+ * (3-5), as configured in the ShockBurst Decoder.
+ * |option [3] 3
+ * |option [4] 4
+ * |option [5] 5
+ * |default 5
+ *
+ * |param sampleRate[Sample Rate] The sample rate of the decoder input, used to
+ * convert sample indices to packet timestamps.
+ * |default 2e6
+ * |units samples/sec
+ *
+ * |param rotateSize[Rotate Size] Start a new file after this many MiB
+ * (0: never).
+ * |default 0
+ * |units MiB
+ * |preview valid
+ *
+ * |param rotateTime[Rotate Time] Start a new file after this many seconds
+ * (0: never).
+ * |default 0
+ * |units seconds
+ * |preview valid
+ *
+ * |factory /shockburst/pcap_sink()
+ * |initializer setPath(path)
+ * |initializer setChannel(channel)
+ * |initializer setAddressLength(addressLength)
+ * |initializer setSampleRate(sampleRate)
+ * |initializer setRotateSize(rotateSize)
+ * |initializer setRotateTime(rotateTime)
+ **********************************************************************/
+class PcapSink : public Pothos::Block
+{
+public:
+	PcapSink(void):
+		_channel(50),
+		_addressLength(5),
+		_sampleRate(2e6),
+		_rotateSize(0),
+		_rotateTime(0)
+	{
+		this->setupInput(0);
+
+		this->registerCall(this, POTHOS_FCN_TUPLE(PcapSink, setPath));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PcapSink, getPath));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PcapSink, setChannel));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PcapSink, getChannel));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PcapSink, setAddressLength));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PcapSink, getAddressLength));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PcapSink, setSampleRate));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PcapSink, getSampleRate));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PcapSink, setRotateSize));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PcapSink, getRotateSize));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PcapSink, setRotateTime));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PcapSink, getRotateTime));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PcapSink, getLatencyStats));
+		this->registerCall(this, POTHOS_FCN_TUPLE(PcapSink, resetLatencyStats));
+
+		_pcap.fd = -1;
+		_pcap.buf = nullptr;
+	}
+
+	~PcapSink(void)
+	{
+		pcapng_close(&_pcap);
+	}
+
+	static Block *make(void)
+	{
+		return new PcapSink();
+	}
+
+	void activate(void)
+	{
+		if (_path.empty()) return;
+
+		auto now = std::chrono::system_clock::now().time_since_epoch();
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now);
+		if (pcapng_open(&_pcap, _path.c_str(), uint32_t(_sampleRate),
+					uint64_t(ns.count()), _rotateSize << 20, _rotateTime) < 0)
+		{
+			throw std::runtime_error("PcapSink: cannot open " + _path);
+		}
+	}
+
+	void deactivate(void)
+	{
+		pcapng_close(&_pcap);
+	}
+
+	void work(void)
+	{
+		auto input = this->input(0);
+		const int64_t now = traceNow();
+
+		// a sink never has a reason to leave messages queued
+		while (input->hasMessage()) {
+			auto msg = input->popMessage();
+			if (_pcap.fd < 0) continue;
+
+			forEachMessage(msg, [this, now](const Pothos::ObjectKwargs &contents)
+			{
+				_trace.record("sink", contents, now);
+				auto payload = messageField(contents, "payload");
+				if (payload.type() != typeid(std::vector<uint8_t>)) return;
+				auto &data = payload.extract<std::vector<uint8_t> >();
+
+				PcapngPacket pkt;
+				pkt.sample = messageField(contents, "sample").convert<uint64_t>();
+				pkt.address = messageField(contents, "address").convert<uint64_t>();
+				pkt.threshold = messageField(contents, "threshold").convert<int32_t>();
+				pkt.crc = messageField(contents, "crc").convert<uint16_t>();
+				pkt.channel = _channel;
+				pkt.address_length = _addressLength;
+				pkt.payload_length = uint8_t(data.size());
+				pkt.payload = data.data();
+				pcapng_write(&_pcap, &pkt);
+			});
+		}
+		pcapng_poll(&_pcap);
+	}
+
+	void setPath(const std::string &path)
+	{
+		_path = path;
+
+		// reopen if the path changes while running
+		if (_pcap.fd >= 0) {
+			pcapng_close(&_pcap);
+			this->activate();
+		}
+	}
+
+	std::string getPath(void) const
+	{
+		return _path;
+	}
+
+	void setChannel(const uint8_t &channel)
+	{
+		_channel = channel;
+	}
+
+	uint8_t getChannel(void) const
+	{
+		return _channel;
+	}
+
+	void setAddressLength(const uint8_t &addressLength)
+	{
+		_addressLength = addressLength;
+	}
+
+	uint8_t getAddressLength(void) const
+	{
+		return _addressLength;
+	}
+
+	void setSampleRate(const double &sampleRate)
+	{
+		_sampleRate = sampleRate;
+	}
+
+	double getSampleRate(void) const
+	{
+		return _sampleRate;
+	}
+
+	void setRotateSize(const unsigned long long &rotateSize)
+	{
+		_rotateSize = rotateSize;
+	}
+
+	unsigned long long getRotateSize(void) const
+	{
+		return _rotateSize;
+	}
+
+	void setRotateTime(const unsigned long long &rotateTime)
+	{
+		_rotateTime = rotateTime;
+	}
+
+	unsigned long long getRotateTime(void) const
+	{
+		return _rotateTime;
+	}
+
+	/* Latency of the traced packets on arrival (see LatencyTrace.hpp) */
+	Pothos::ObjectKwargs getLatencyStats(void) const
+	{
+		return _trace.stats();
+	}
+
+	void resetLatencyStats(void)
+	{
+		_trace.reset();
+	}
+
+private:
+	std::string _path;
+	uint8_t _channel;
+	uint8_t _addressLength;
+	double _sampleRate;
+	unsigned long long _rotateSize;
+	unsigned long long _rotateTime;
+	PcapngWriter _pcap;
+	LatencyTrace _trace;
+};
+
+static Pothos::BlockRegistry registerPcapSink(
+	"/shockburst/pcap_sink", &PcapSink::make);
@@ -0,0 +1,228 @@
+#include <Pothos/Framework.hpp>
+#include "MessageBatch.hpp"
+#include "LatencyTrace.hpp"
+#include "antsniff/shmring.h"
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/***********************************************************************
+ * |PothosDoc  Shared Memory Sink
+ *
+ * Publish ShockBurst packets to a shared memory feed.
+ * The sink block accepts messages (or batches of messages) produced by the
+ * "ShockBurst Decoder" block on input port 0, and writes them as fixed size
+ * records into a POSIX shared memory ring, the same feed shockburst -m
+ * publishes. Local consumers map the ring and read the packets without any
+ * syscalls or copies through the kernel; see shmring.h for the format and the
+ * reader functions, and antsniff's antshm tool for an example.
+ *
+ * The sink never waits for the readers: a reader that falls more than a ring
+ * behind loses the oldest packets, and only that reader notices.
+ *
+ * |category /Sinks
+ * |keywords shockburst shared memory shm ring feed
+ *
+ * |param name[Name] The name of the shared memory object, starting with a
+ * slash.
+ * |default "/antsniff"
+ *
+ * |param capacity[Capacity] The number of packets the ring holds (rounded up
+ * to a power of two).
+ * |widget SpinBox(minimum=1024)
+ * |default 65536
+ * |preview valid
+ *
+ * |param channel[Channel] The RF channel the packets were received on. The
+ * real frequency is this value plus 2.4 GHz.
+ * |widget SpinBox(minimum=0,maximum=127)
+ * |default 50
+ *
+ * |param addressLength[Address Length] The length of the address field in bytes
+ * (3-5), as configured in the ShockBurst Decoder.
+ * |option [3] 3
+ * |option [4] 4
+ * |option [5] 5
+ * |default 5
+ *
+ * |param sampleRate[Sample Rate] The sample rate of the decoder input, used to
+ * convert sample indices to packet timestamps.
+ * |default 2e6
+ * |units samples/sec
+ *
+ * |factory /shockburst/shm_sink()
+ * |initializer setName(name)
+ * |initializer setCapacity(capacity)
+ * |initializer setChannel(channel)
+ * |initializer setAddressLength(addressLength)
+ * |initializer setSampleRate(sampleRate)
+ **********************************************************************/
+class ShmSink : public Pothos::Block
+{
+public:
+	ShmSink(void):
+		_name("/antsniff"),
+		_capacity(65536),
+		_channel(50),
+		_addressLength(5),
+		_sampleRate(2e6)
+	{
+		this->setupInput(0);
+
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShmSink, setName));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShmSink, getName));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShmSink, setCapacity));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShmSink, getCapacity));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShmSink, setChannel));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShmSink, getChannel));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShmSink, setAddressLength));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShmSink, getAddressLength));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShmSink, setSampleRate));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShmSink, getSampleRate));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShmSink, getLatencyStats));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShmSink, resetLatencyStats));
+
+		_shm.header = nullptr;
+	}
+
+	~ShmSink(void)
+	{
+		shmring_close(&_shm);
+	}
+
+	static Block *make(void)
+	{
+		return new ShmSink();
+	}
+
+	void activate(void)
+	{
+		if (_name.empty()) return;
+
+		auto now = std::chrono::system_clock::now().time_since_epoch();
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now);
+		if (shmring_open(&_shm, _name.c_str(), _capacity,
+					uint32_t(_sampleRate), uint64_t(ns.count())) < 0)
+		{
+			throw std::runtime_error("ShmSink: cannot create " + _name);
+		}
+	}
+
+	void deactivate(void)
+	{
+		shmring_close(&_shm);
+	}
+
+	void work(void)
+	{
+		auto input = this->input(0);
+		const int64_t now = traceNow();
+
+		// a sink never has a reason to leave messages queued
+		while (input->hasMessage()) {
+			auto msg = input->popMessage();
+			if (!_shm.header) continue;
+
+			forEachMessage(msg, [this, now](const Pothos::ObjectKwargs &contents)
+			{
+				_trace.record("sink", contents, now);
+				auto payload = messageField(contents, "payload");
+				if (payload.type() != typeid(std::vector<uint8_t>)) return;
+				auto &data = payload.extract<std::vector<uint8_t> >();
+				auto margin = messageField(contents, "margin");
+
+				ShmRingPacket pkt;
+				pkt.sample = messageField(contents, "sample").convert<uint64_t>();
+				pkt.address = messageField(contents, "address").convert<uint64_t>();
+				pkt.threshold = messageField(contents, "threshold").convert<int32_t>();
+				pkt.margin = margin ? margin.convert<int32_t>() : 0;
+				pkt.crc = messageField(contents, "crc").convert<uint16_t>();
+				pkt.channel = _channel;
+				pkt.address_length = _addressLength;
+				pkt.payload_length = uint8_t(data.size());
+				pkt.payload = data.data();
+				shmring_write(&_shm, &pkt);
+			});
+		}
+	}
+
+	void setName(const std::string &name)
+	{
+		_name = name;
+
+		// recreate if the name changes while running
+		if (_shm.header) {
+			shmring_close(&_shm);
+			this->activate();
+		}
+	}
+
+	std::string getName(void) const
+	{
+		return _name;
+	}
+
+	void setCapacity(const unsigned long long &capacity)
+	{
+		_capacity = capacity;
+	}
+
+	unsigned long long getCapacity(void) const
+	{
+		return _capacity;
+	}
+
+	void setChannel(const uint8_t &channel)
+	{
+		_channel = channel;
+	}
+
+	uint8_t getChannel(void) const
+	{
+		return _channel;
+	}
+
+	void setAddressLength(const uint8_t &addressLength)
+	{
+		_addressLength = addressLength;
+	}
+
+	uint8_t getAddressLength(void) const
+	{
+		return _addressLength;
+	}
+
+	void setSampleRate(const double &sampleRate)
+	{
+		_sampleRate = sampleRate;
+	}
+
+	double getSampleRate(void) const
+	{
+		return _sampleRate;
+	}
+
+	/* Latency of the traced packets on arrival (see LatencyTrace.hpp) */
+	Pothos::ObjectKwargs getLatencyStats(void) const
+	{
+		return _trace.stats();
+	}
+
+	void resetLatencyStats(void)
+	{
+		_trace.reset();
+	}
+
+private:
+	std::string _name;
+	unsigned long long _capacity;
+	uint8_t _channel;
+	uint8_t _addressLength;
+	double _sampleRate;
+	ShmRingWriter _shm;
+	LatencyTrace _trace;
+};
+
+static Pothos::BlockRegistry registerShmSink(
+	"/shockburst/shm_sink", &ShmSink::make);
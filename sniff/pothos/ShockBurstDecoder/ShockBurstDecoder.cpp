@@ -1,7 +1,17 @@
 #include <Pothos/Framework.hpp>
-#include "ShockBurstUtils.hpp"
+#include "antsniff/capture.h"
+#include "antsniff/shockburst.hpp"
+#include "antsniff/timeline.hpp"
+#include "MessageBatch.hpp"
+#include "LatencyTrace.hpp"
+#include "ThreadPlacement.hpp"
+#include <algorithm>
 #include <iostream>
 #include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 /***********************************************************************
  * |PothosDoc  ShockBurst Decoder
@@ -18,10 +28,89 @@
  * the input sample rate should be 2 Msps. A typical upstream flow involves raw
  * complex baseband samples and the "Freq Demod" block.
  *
+ * int8, int16 and float32 samples are decoded as they are, without a
+ * conversion copy, by a decoder made for the type of the first input buffer
+ * (see BasicShockBurstDecoder): 8 bit samples, e.g. demodulated from an
+ * RTL-SDR, take a quarter of the memory bandwidth of floats. Other types
+ * are converted to int16, or float32 for floating point types. Packets
+ * report their threshold and margin in int16 units whatever the input type.
+ *
+ * Raw complex baseband samples (complex_int8, complex_uint8, complex_int16
+ * or complex_float32) are frequency demodulated by the decoder itself, so
+ * the "Freq Demod" block can be left out (see ant-sdr-fused.pth): the I/Q
+ * samples are demodulated (see fmdemod.h) a tile at a time into a small
+ * int16 buffer that stays in the L1 cache, and decoded from there, instead
+ * of going through a full rate buffer and a scheduler round trip between
+ * the two blocks. The packets are the same as from a capture of the same
+ * samples replayed through shockburst -i, and the same as from the "Freq
+ * Demod" block up to the rounding of the demodulated samples. Other complex
+ * types are converted to complex_float32.
+ *
  * <h2>Output format</h2>
  *
  * Each decoded packet results in a message of type ShockBurst that contains the
- * address, payload and CRC fields of a ShockBurst packet.
+ * address, payload and CRC fields of a ShockBurst packet, the sample index
+ * and slicer threshold it was decoded at, and its "margin": the mean distance
+ * of its symbols from the threshold, which the "Packet Merge" block uses to
+ * pick the best copy of a frame.
+ *
+ * With a maximum batch size above 1, packets are posted in batches of type
+ * Pothos::ObjectVector instead: a batch is posted when it is full, or when
+ * its oldest packet has waited for the maximum latency. This saves a
+ * scheduler round trip per packet during bursts, while bounding the latency
+ * of single packets when the traffic is low.
+ *
+ * <h2>Timing</h2>
+ *
+ * If the input stream carries "rxTime" labels (as the SDR source posts
+ * them), packets also carry "rx_time": the time of their last sample, on
+ * the receiver's clock, in nanoseconds. The sample rate comes from "rxRate"
+ * labels, or the Sample Rate parameter.
+ *
+ * With latency tracing enabled, packets carry the timestamps described in
+ * LatencyTrace.hpp, and the decoder and the blocks downstream record
+ * latency percentiles per stage, which getLatencyStats() returns. The
+ * latency is measured from "t_origin": the packet's rx_time if the receiver
+ * clock is host time (e.g. the SDR source's time was set from the host), or
+ * otherwise the time the decoder started on the samples the packet was
+ * found in.
+ *
+ * With a Timeline File set, a timeline of the decoders is written to it
+ * while the topology runs, as a Chrome trace event file for chrome://tracing
+ * or the Perfetto UI (see antsniff/timeline.hpp): a span for every work()
+ * call and an event for every packet and CRC failure of this decoder, and a
+ * span for every message the ANT-FS Decoder dispatches, and an event for
+ * its frequencyChanged signals. Timeline Tracing pauses and resumes it at
+ * run time. Tracing is process wide, and costs next to nothing while off.
+ *
+ * <h2>Known devices</h2>
+ *
+ * With Known Devices set, the decoder learns the DC level (the frequency
+ * offset, where the slicer threshold belongs) of that many devices heard most
+ * recently, and when a preamble fails the CRC check, slices it again at the
+ * level of the 4 most recent ones, so weak packets of devices heard before
+ * are recovered more often (see antsniff/devicecache.hpp). It is off by default,
+ * as it changes the packets found. getDeviceStats() returns the known
+ * devices, and how many packets were reacquired that way.
+ *
+ * <h2>Overload</h2>
+ *
+ * With a Max Backlog set, a decoder that has fallen behind its input by
+ * more than that many samples, and has found no packet for the Idle Time,
+ * passes over the oldest of the waiting samples without decoding them, so
+ * an idle channel catches up at once instead of stalling the SDR. A busy
+ * decoder never sheds samples. getOverloadStats() counts the samples shed.
+ *
+ * <h2>Real time operation</h2>
+ *
+ * At high sample rates the decoder can get a thread of its own, pinned to
+ * dedicated cores (ideally on the NUMA node of the SDR, and away from the
+ * SDR source's thread) and run with a real time priority, so it is never
+ * preempted by the rest of the system. The decoder's buffers are then
+ * allocated from those cores, on their NUMA node. getThreadStats() returns where the
+ * thread runs, and how many overflows the rxTime labels revealed: gaps in
+ * the receiver time, where the SDR dropped samples because the chain
+ * didn't keep up.
  *
  * |category /Decode
  * |keywords shockburst
@@ -44,15 +133,119 @@
  * |option [CRC16] 2
  * |default 2
  *
+ * |param maxBatch[Max Batch] The maximum number of packets per message. 1
+ * disables batching.
+ * |widget SpinBox(minimum=1)
+ * |default 1
+ * |preview valid
+ *
+ * |param maxLatency[Max Latency] The longest time a packet may wait for its
+ * batch to fill up.
+ * |default 5.0
+ * |units ms
+ * |preview valid
+ *
+ * |param sampleRate[Sample Rate] The input sample rate, if there are no
+ * "rxRate" labels.
+ * |default 2e6
+ * |units samples/sec
+ * |preview valid
+ *
+ * |param latencyTracing[Latency Tracing] Stamp packets, and record latency
+ * percentiles.
+ * |option [Off] false
+ * |option [On] true
+ * |default false
+ * |preview valid
+ *
+ * |param hostTime[Host Time Labels] Whether "rxTime" labels are host time,
+ * so the latency can be measured from the packet's last sample.
+ * |option [No] false
+ * |option [Yes] true
+ * |default false
+ * |preview valid
+ *
+ * |param timelineFile[Timeline File] Where the timeline of the decoders is
+ * written. Empty disables timeline tracing.
+ * |widget FileEntry(mode=save)
+ * |default ""
+ * |preview valid
+ *
+ * |param timelineTracing[Timeline Tracing] Pause or resume the timeline.
+ * |option [Paused] false
+ * |option [On] true
+ * |default true
+ * |preview valid
+ *
+ * |param maxBacklog[Max Backlog] The most input samples an idle decoder
+ * lets wait, 0 for no limit.
+ * |default 0
+ * |units samples
+ * |preview valid
+ *
+ * |param idleTime[Idle Time] How long without a packet makes the decoder
+ * idle.
+ * |default 1.0
+ * |units seconds
+ * |preview valid
+ *
+ * |param knownDevices[Known Devices] How many devices the decoder learns
+ * the slicer levels of, for CRC failure recovery, 0 (the default) for none.
+ * |widget SpinBox(minimum=0,maximum=256)
+ * |default 0
+ * |preview valid
+ *
+ * |param cpus[CPUs] Run the decoder on a thread of its own, on these CPUs
+ * only, e.g. "2" or "2-3". Empty leaves it on the topology's thread pool.
+ * |default ""
+ * |preview valid
+ *
+ * |param priority[RT Priority] Real time priority of the decoder's own thread
+ * (1-99), or 0 for normal scheduling. Needs CAP_SYS_NICE or an rtprio limit.
+ * |widget SpinBox(minimum=0,maximum=99)
+ * |default 0
+ * |preview valid
+ *
  * |factory /shockburst/shockburst_decoder()
  * |initializer setAddressLength(addressLength)
  * |initializer setPayloadLength(payloadLength)
  * |initializer setCRCLength(crcLength)
+ * |setter setMaxBatch(maxBatch)
+ * |setter setMaxLatency(maxLatency)
+ * |setter setSampleRate(sampleRate)
+ * |setter setLatencyTracing(latencyTracing)
+ * |setter setHostTime(hostTime)
+ * |initializer setTimelineFile(timelineFile)
+ * |setter setTimelineTracing(timelineTracing)
+ * |setter setMaxBacklog(maxBacklog)
+ * |setter setIdleTime(idleTime)
+ * |initializer setKnownDevices(knownDevices)
+ * |initializer setCpus(cpus)
+ * |initializer setPriority(priority)
  **********************************************************************/
 class ShockBurstDecoder : public Pothos::Block
 {
 public:
-	ShockBurstDecoder(void)
+	ShockBurstDecoder(void):
+		_sampleType(SAMPLE_INT16),
+		_iqFormat(CAPTURE_UNKNOWN),
+		_sampleRate(2e6),
+		_latencyTracing(false),
+		_hostTime(false),
+		_haveRxTime(false),
+		_rxTimeSample(0),
+		_rxTime(0),
+		_workEntry(0),
+		_timelineTracing(true),
+		_timeline(false),
+		_maxBacklog(0),
+		_idleTime(1.0),
+		_knownDevices(0),
+		_lastPacket(0),
+		_shedSamples(0),
+		_shedCalls(0),
+		_overflows(0),
+		_lostSamples(0)
 	{
 		this->setupInput(0); //unspecified type, handles conversion
 		this->setupOutput(0);
@@ -63,62 +256,315 @@ public:
 		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, getPayloadLength));
 		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, setCRCLength));
 		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, getCRCLength));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, setMaxBatch));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, getMaxBatch));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, setMaxLatency));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, getMaxLatency));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, setSampleRate));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, getSampleRate));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, setLatencyTracing));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, getLatencyTracing));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, setHostTime));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, getHostTime));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, getLatencyStats));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, resetLatencyStats));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, setTimelineTracing));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, getTimelineTracing));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, setTimelineFile));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, getTimelineFile));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, setMaxBacklog));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, getMaxBacklog));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, setIdleTime));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, getIdleTime));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, getOverloadStats));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, setKnownDevices));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, getKnownDevices));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, getDeviceStats));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, setCpus));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, getCpus));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, setPriority));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, getPriority));
+		this->registerCall(this, POTHOS_FCN_TUPLE(ShockBurstDecoder, getThreadStats));
 		
 		this->setAddressLength(5);
 		this->setPayloadLength(10);
 		this->setCRCLength(2);
+		this->setMaxBatch(1);
+		this->setMaxLatency(5.0);
+	}
 
-		_decoder = new ShockBurstUtilsDecoder(_addressLength, _payloadLength);
+	static Block *make(void)
+	{
+		return new ShockBurstDecoder();
 	}
 
-	~ShockBurstDecoder(void)
+	void activate(void)
 	{
-		delete _decoder;
+		// made in work(), once the input's sample type is known
+		_decoder.reset();
+		_haveRxTime = false;
+		_lastPacket = 0;
+
+		if (!_timelineFile.empty()) {
+			if (!antsniff::Timeline::start(_timelineFile.c_str())) {
+				throw std::runtime_error("ShockBurstDecoder: cannot write " +
+						_timelineFile);
+			}
+			antsniff::Timeline::enable(_timelineTracing);
+			_timeline = true;
+		}
 	}
 
-	static Block *make(void)
+	void deactivate(void)
 	{
-		return new ShockBurstDecoder();
+		_batch.flush(this->output(0));
+		if (_timeline) antsniff::Timeline::stop();
+		_timeline = false;
 	}
 
 	void work(void)
 	{
+		auto outPort = this->output(0);
 		auto inPort = this->input(0);
 		auto inBuff = inPort->buffer();
 		auto N = inBuff.elements();
-		if (N == 0) return; //nothing available
+		_placement.observe();
+		if (N == 0) {
+			_batch.poll(outPort);
+			return; //nothing available
+		}
+
+		antsniff::TimelineSpan span("work", "decoder");
+		span.arg("samples", N);
+		if (_latencyTracing) _workEntry = traceNow();
 
-		//floating point support
-		if (inBuff.dtype.isFloat())
+		// made here, on the (pinned) decoder thread, so it's local to it
+		SampleType sampleType = sampleTypeOf(inBuff.dtype);
+		if (!_decoder)
 		{
-			auto float32Buff = inBuff.convert(typeid(float));
-			auto in = float32Buff.as<const float *>();
-			const float gain = (1 << 15)/M_PI;
-			for (size_t i = 0; i < N; i++)
+			this->makeDecoder(sampleType, inBuff.dtype);
+		}
+		else if (sampleType != _sampleType)
+		{
+			throw std::runtime_error("ShockBurstDecoder: input type changed");
+		}
+
+		//receiver time of the samples, as posted by the SDR source
+		for (const auto &label : inPort->labels())
+		{
+			if (label.index >= N) continue;
+			if (label.id == "rxTime")
+			{
+				long long rxTime = label.data.convert<long long>();
+				uint64_t sample = _decoder->samples() + label.index;
+				if (_haveRxTime) this->checkOverflow(rxTime, sample);
+				_rxTime = rxTime;
+				_rxTimeSample = sample;
+				_haveRxTime = true;
+			}
+			else if (label.id == "rxRate")
 			{
-				if (_decoder->feedOne(uint16_t(in[i]*gain)))
-				{
-					this->output(0)->postMessage(_decoder->packetData);
-				}
+				_sampleRate = label.data.convert<double>();
 			}
 		}
 
-		//fixed point support
-		else
+		size_t shed = this->idleShed(N);
+
+		switch (_sampleType)
 		{
-			auto int16Buff = inBuff.convert(typeid(int16_t));
-			auto in = int16Buff.as<const uint16_t *>();
-			for (size_t i = 0; i < N; i++)
+		case SAMPLE_INT8:
+			this->decode(inBuff.as<const int8_t *>(), N, shed);
+			break;
+
+		case SAMPLE_INT16:
+			if (inBuff.dtype == Pothos::DType(typeid(int16_t)))
+			{
+				this->decode(inBuff.as<const int16_t *>(), N, shed);
+			}
+			else
+			{
+				auto int16Buff = inBuff.convert(typeid(int16_t));
+				this->decode(int16Buff.as<const int16_t *>(), N, shed);
+			}
+			break;
+
+		case SAMPLE_IQ:
+			this->demodulate(inBuff, N, shed);
+			break;
+
+		case SAMPLE_FLOAT:
+			if (inBuff.dtype == Pothos::DType(typeid(float)))
 			{
-				if (_decoder->feedOne(in[i]))
-				{
-					this->output(0)->postMessage(_decoder->packetData);
-				}
+				this->decode(inBuff.as<const float *>(), N, shed);
 			}
+			else
+			{
+				auto float32Buff = inBuff.convert(typeid(float));
+				this->decode(float32Buff.as<const float *>(), N, shed);
+			}
+			break;
 		}
 
 		//consume all input elements
 		inPort->consume(inPort->elements());
+
+		_batch.poll(outPort);
+	}
+
+	void setSampleRate(const double &sampleRate)
+	{
+		_sampleRate = sampleRate;
+	}
+
+	double getSampleRate(void) const
+	{
+		return _sampleRate;
+	}
+
+	void setLatencyTracing(const bool &latencyTracing)
+	{
+		_latencyTracing = latencyTracing;
+	}
+
+	bool getLatencyTracing(void) const
+	{
+		return _latencyTracing;
+	}
+
+	void setHostTime(const bool &hostTime)
+	{
+		_hostTime = hostTime;
+	}
+
+	bool getHostTime(void) const
+	{
+		return _hostTime;
+	}
+
+	Pothos::ObjectKwargs getLatencyStats(void) const
+	{
+		return _trace.stats();
+	}
+
+	void resetLatencyStats(void)
+	{
+		_trace.reset();
+	}
+
+	void setTimelineTracing(const bool &timelineTracing)
+	{
+		_timelineTracing = timelineTracing;
+		if (_timeline) antsniff::Timeline::enable(timelineTracing);
+	}
+
+	bool getTimelineTracing(void) const
+	{
+		return _timelineTracing;
+	}
+
+	void setTimelineFile(const std::string &timelineFile)
+	{
+		_timelineFile = timelineFile;
+	}
+
+	std::string getTimelineFile(void) const
+	{
+		return _timelineFile;
+	}
+
+	void setMaxBacklog(const size_t &maxBacklog)
+	{
+		_maxBacklog = maxBacklog;
+	}
+
+	size_t getMaxBacklog(void) const
+	{
+		return _maxBacklog;
+	}
+
+	void setIdleTime(const double &idleTime)
+	{
+		_idleTime = idleTime;
+	}
+
+	double getIdleTime(void) const
+	{
+		return _idleTime;
+	}
+
+	/* The samples passed over while idle, and how many times */
+	Pothos::ObjectKwargs getOverloadStats(void) const
+	{
+		Pothos::ObjectKwargs stats;
+		stats["shedSamples"] = Pothos::Object(_shedSamples);
+		stats["shedCalls"] = Pothos::Object(_shedCalls);
+		return stats;
+	}
+
+	void setKnownDevices(const size_t &knownDevices)
+	{
+		if (knownDevices > 256)
+		{
+			throw std::invalid_argument("ShockBurstDecoder: at most 256 known devices");
+		}
+		_knownDevices = knownDevices;
+	}
+
+	size_t getKnownDevices(void) const
+	{
+		return _knownDevices;
+	}
+
+	Pothos::ObjectKwargs getDeviceStats(void) const
+	{
+		Pothos::ObjectKwargs stats;
+		Pothos::ObjectVector devices;
+		if (_decoder)
+		{
+			const antsniff::DeviceCache &cache = _decoder->devices();
+			for (size_t i = 0; i < cache.size(); ++i)
+			{
+				Pothos::ObjectKwargs device;
+				device["address"] = Pothos::Object(cache[i].address);
+				device["level"] = Pothos::Object(cache[i].level);
+				device["packets"] = Pothos::Object(cache[i].packets);
+				devices.push_back(Pothos::Object(device));
+			}
+		}
+		stats["devices"] = Pothos::Object(devices);
+		stats["reacquired"] = Pothos::Object(_decoder ? _decoder->reacquired() : 0);
+		return stats;
+	}
+
+	void setCpus(const std::string &cpus)
+	{
+		_placement.setCpus(cpus);
+		_placement.place(*this);
+	}
+
+	std::string getCpus(void) const
+	{
+		return _placement.cpus();
+	}
+
+	void setPriority(const int &priority)
+	{
+		_placement.setPriority(priority);
+		_placement.place(*this);
+	}
+
+	int getPriority(void) const
+	{
+		return _placement.priority();
+	}
+
+	/* Where the decoder thread runs, and the overflows seen upstream */
+	Pothos::ObjectKwargs getThreadStats(void) const
+	{
+		auto stats = _placement.stats();
+		stats["overflows"] = Pothos::Object(_overflows);
+		stats["lostSamples"] = Pothos::Object(_lostSamples);
+		return stats;
 	}
 
 	void setAddressLength(const uint8_t &addressLength)
@@ -151,11 +597,239 @@ public:
 		return _crcLength;
 	}
 
+	void setMaxBatch(const size_t &maxBatch)
+	{
+		_batch.maxBatch = maxBatch;
+	}
+
+	size_t getMaxBatch(void) const
+	{
+		return _batch.maxBatch;
+	}
+
+	void setMaxLatency(const double &maxLatency)
+	{
+		_batch.maxLatency = maxLatency;
+	}
+
+	double getMaxLatency(void) const
+	{
+		return _batch.maxLatency;
+	}
+
 private:
 	uint8_t _addressLength;
 	uint8_t _payloadLength;
 	uint8_t _crcLength;
-	ShockBurstUtilsDecoder *_decoder;
+	enum SampleType
+	{
+		SAMPLE_INT8,
+		SAMPLE_INT16,
+		SAMPLE_FLOAT,
+		SAMPLE_IQ
+	};
+
+	// demodulated samples, at most: small enough for L1 along with the I/Q
+	static const size_t TILE_SIZE = 2048;
+
+	SampleType _sampleType;
+	CaptureFormat _iqFormat;	// CAPTURE_UNKNOWN: converted to cf32
+	FmDemod _demod;
+	int16_t _tile[TILE_SIZE];
+	std::unique_ptr<antsniff::ShockBurstDecoderBase> _decoder;
+	MessageBatcher _batch;
+
+	double _sampleRate;
+	bool _latencyTracing;
+	bool _hostTime;
+	bool _haveRxTime;
+	uint64_t _rxTimeSample;	// the input sample the last rxTime label was on
+	long long _rxTime;	// ns
+	int64_t _workEntry;	// ns, host time
+	LatencyTrace _trace;
+	std::string _timelineFile;
+	bool _timelineTracing;
+	bool _timeline;	// writing the timeline file
+
+	size_t _maxBacklog;	// samples
+	double _idleTime;	// seconds
+	size_t _knownDevices;
+	uint64_t _lastPacket;	// the sample the last packet was found at
+	unsigned long long _shedSamples;
+	unsigned long long _shedCalls;
+
+	ThreadPlacement _placement;
+	unsigned long long _overflows;
+	unsigned long long _lostSamples;
+
+	/* The decoder type for dtype; the types without one are converted */
+	static SampleType sampleTypeOf(const Pothos::DType &dtype)
+	{
+		if (dtype.isComplex()) return SAMPLE_IQ;
+		if (dtype.isFloat()) return SAMPLE_FLOAT;
+		if (dtype.isInteger() && dtype.isSigned() && dtype.elemSize() == 1)
+		{
+			return SAMPLE_INT8;
+		}
+		return SAMPLE_INT16;
+	}
+
+	void makeDecoder(SampleType sampleType, const Pothos::DType &dtype)
+	{
+		antsniff_decoder_params params = antsniff::shockBurstDefaults();
+		params.known_devices = uint32_t(_knownDevices);
+
+		// the ring is first touched from the configured CPUs, on their node
+		_sampleType = sampleType;
+		_placement.allocate([&]()
+		{
+			switch (sampleType)
+			{
+			case SAMPLE_INT8:
+				_decoder.reset(new antsniff::BasicShockBurstDecoder<int8_t>(
+							_addressLength, _payloadLength, params));
+				break;
+			case SAMPLE_IQ:
+				_iqFormat = capture_format(dtype.name().c_str());
+				fmdemod_init(&_demod);
+				// fall through: I/Q is demodulated to int16
+			case SAMPLE_INT16:
+				_decoder.reset(new antsniff::BasicShockBurstDecoder<int16_t>(
+							_addressLength, _payloadLength, params));
+				break;
+			case SAMPLE_FLOAT:
+				_decoder.reset(new antsniff::BasicShockBurstDecoder<float>(
+							_addressLength, _payloadLength, params));
+				break;
+			}
+		});
+	}
+
+	/* The number of the oldest of N waiting samples to pass over */
+	size_t idleShed(size_t N)
+	{
+		if (_maxBacklog == 0 || N <= _maxBacklog) return 0;
+		if (_decoder->samples() - _lastPacket < _idleTime * _sampleRate) return 0;
+
+		++_shedCalls;
+		_shedSamples += N - _maxBacklog;
+		return N - _maxBacklog;
+	}
+
+	/* Decode N samples of the decoder's type, passing over the first shed */
+	template <typename T>
+	void decode(const T *in, size_t N, size_t shed)
+	{
+		auto outPort = this->output(0);
+		auto decoder = static_cast<antsniff::BasicShockBurstDecoder<T> *>(
+				_decoder.get());
+		decoder->skip(shed);
+		decoder->feed(in + shed, N - shed, [this, outPort](const antsniff_packet &p)
+		{
+			_lastPacket = p.sample;
+			_batch.push(outPort, this->packetMessage());
+		});
+	}
+
+	/*
+	 * Demodulate and decode N I/Q samples, passing over the first shed, a
+	 * tile at a time.
+	 */
+	void demodulate(const Pothos::BufferChunk &inBuff, size_t N, size_t shed)
+	{
+		auto outPort = this->output(0);
+		auto decoder = static_cast<antsniff::ShockBurstDecoder *>(_decoder.get());
+
+		CaptureFormat format = _iqFormat;
+		Pothos::BufferChunk buff = inBuff;
+		if (format == CAPTURE_UNKNOWN || format == CAPTURE_S16)
+		{
+			buff = inBuff.convert(Pothos::DType("complex_float32"));
+			format = CAPTURE_CF32;
+		}
+		const uint8_t *in = buff.as<const uint8_t *>();
+		const size_t elemSize = capture_elem_size(format);
+
+		decoder->skip(shed);
+		for (size_t pos = shed; pos < N; pos += TILE_SIZE)
+		{
+			const size_t n = std::min(TILE_SIZE, N - pos);
+			const uint8_t *iq = in + pos * elemSize;
+			switch (format)
+			{
+			case CAPTURE_CS16:
+				fmdemod_cs16(&_demod, (const int16_t *)iq, n, _tile);
+				break;
+			case CAPTURE_CS8:
+				fmdemod_cs8(&_demod, (const int8_t *)iq, n, _tile);
+				break;
+			case CAPTURE_CU8:
+				fmdemod_cu8(&_demod, iq, n, _tile);
+				break;
+			default:
+				fmdemod_cf32(&_demod, (const float *)iq, n, _tile);
+				break;
+			}
+
+			decoder->feed(_tile, n, [this, outPort](const antsniff_packet &p)
+			{
+				_lastPacket = p.sample;
+				_batch.push(outPort, this->packetMessage());
+			});
+		}
+	}
+
+	/* A jump in the receiver time means the SDR dropped samples */
+	void checkOverflow(long long rxTime, uint64_t sample)
+	{
+		double expected = _rxTime + (sample - _rxTimeSample) * 1e9 / _sampleRate;
+		long long lost = std::llround((rxTime - expected) * _sampleRate / 1e9);
+		if (lost < 1) return;
+		++_overflows;
+		_lostSamples += lost;
+	}
+
+	/* The last packet found, as a ShockBurst message */
+	Pothos::Object packetMessage(void)
+	{
+		const antsniff_packet &p = _decoder->packet();
+		Pothos::ObjectKwargs packetData;
+
+		packetData["address"] = Pothos::Object(p.address);
+		packetData["crc"] = Pothos::Object(p.crc);
+		packetData["payload"] = Pothos::Object(std::vector<uint8_t>(
+					p.payload, p.payload + p.payload_length));
+
+		// absolute index of the input sample the packet was found at
+		packetData["sample"] = Pothos::Object(p.sample);
+
+		// slicer level the packet was decoded with
+		packetData["threshold"] = Pothos::Object(p.threshold);
+
+		// mean distance of the symbols from the threshold, a signal metric
+		packetData["margin"] = Pothos::Object(p.margin);
+
+		// receiver time of the last sample of the packet
+		long long rxTime = 0;
+		if (_haveRxTime)
+		{
+			int64_t delta = int64_t(_decoder->packetEnd() - 1 - _rxTimeSample);
+			rxTime = _rxTime + (long long)(delta * 1e9 / _sampleRate);
+			packetData["rx_time"] = Pothos::Object(rxTime);
+		}
+
+		if (_latencyTracing)
+		{
+			int64_t origin = _hostTime && _haveRxTime ? rxTime : _workEntry;
+			int64_t now = traceNow();
+			packetData["t_origin"] = Pothos::Object(origin);
+			packetData["t_decoder_in"] = Pothos::Object(_workEntry);
+			packetData["t_decoder_out"] = Pothos::Object(now);
+			_trace.record("decoder", now - origin);
+		}
+
+		return Pothos::Object(packetData);
+	}
 };
 
 static Pothos::BlockRegistry registerShockBurstDecoder(
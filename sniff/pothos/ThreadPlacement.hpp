@@ -0,0 +1,170 @@
+#pragma once
+#include <Pothos/Framework.hpp>
+#include "antsniff/rtthread.h"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+ * CPU affinity and real time priority of a block's thread.
+ *
+ * Pothos runs work() on any thread of the topology's shared thread pool, so
+ * pinning whichever thread calls it would leave that thread pinned while it
+ * runs other blocks, and not hold for the next call. Instead, place() gives
+ * a placed block a thread pool of its own, of one thread, which Pothos pins
+ * to the configured CPUs (see rtthread.h for the syntax) and runs with real
+ * time scheduling if a priority is set (1-99, mapped onto the thread pool's
+ * 0-1 priority).
+ *
+ * Threads a block starts itself (e.g. the I/Q recorder's I/O thread) place
+ * themselves with apply() instead. Failures (e.g. no permission for
+ * SCHED_FIFO) are reported once, and leave the thread as it was.
+ *
+ * Buffers allocated inside allocate() are first touched from the configured
+ * CPUs, so they end up on the same NUMA node as the thread using them.
+ */
+class ThreadPlacement
+{
+public:
+	ThreadPlacement(void):
+		_priority(0),
+		_realtime(false),
+		_changed(false),
+		_pooled(false),
+		_tid(0),
+		_cpu(-1)
+	{ }
+
+	void setCpus(const std::string &cpus)
+	{
+		cpu_set_t set;
+		if (!cpus.empty() && rtthread_parse_cpus(cpus.c_str(), &set) < 0) {
+			throw std::invalid_argument("invalid CPU list: " + cpus);
+		}
+		_cpus = cpus;
+		_changed = true;
+	}
+
+	const std::string &cpus(void) const
+	{
+		return _cpus;
+	}
+
+	void setPriority(int priority)
+	{
+		if (priority < 0 || priority > 99) {
+			throw std::invalid_argument("priority must be 0-99");
+		}
+		_priority = priority;
+		_changed = true;
+	}
+
+	int priority(void) const
+	{
+		return _priority;
+	}
+
+	/*
+	 * Give block a thread pool of its own, placed as configured; a block that
+	 * was never placed stays on the topology's pool
+	 */
+	void place(Pothos::Block &block)
+	{
+		if (_cpus.empty() && _priority == 0 && !_pooled) return;
+		_pooled = true;
+
+		Pothos::ThreadPoolArgs args(1);
+		cpu_set_t set;
+		if (!_cpus.empty() && rtthread_parse_cpus(_cpus.c_str(), &set) == 0) {
+			args.affinityMode = "CPU";
+			for (size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+				if (CPU_ISSET(cpu, &set)) args.affinity.push_back(cpu);
+			}
+		}
+		args.priority = _priority / 99.0;
+		block.setThreadPool(Pothos::ThreadPool(args));
+	}
+
+	/* Note the thread running the block, for stats(); from work() */
+	void observe(void)
+	{
+		if (_tid == 0) _tid = long(syscall(SYS_gettid));
+		_cpu = sched_getcpu();
+	}
+
+	/* Place the thread again on the next apply(), e.g. after a restart */
+	void reapply(void)
+	{
+		_changed = !_cpus.empty() || _priority > 0;
+	}
+
+	/*
+	 * Place the calling thread, a thread of the block's own, if anything
+	 * changed since the last call
+	 */
+	void apply(void)
+	{
+		if (!_changed) return;
+		_changed = false;
+
+		_tid = long(syscall(SYS_gettid));
+		_error.clear();
+		if (!_cpus.empty() && rtthread_pin(_cpus.c_str()) < 0) {
+			this->fail("cannot run on CPUs " + _cpus, errno);
+		}
+
+		// leave the thread pool's priority alone unless asked for SCHED_FIFO
+		if (_priority > 0 || _realtime) {
+			if (rtthread_set_priority(_priority) < 0) {
+				this->fail("cannot set priority " + std::to_string(_priority), errno);
+			} else {
+				_realtime = _priority > 0;
+			}
+		}
+		_cpu = sched_getcpu();
+	}
+
+	/* Call fn with the calling thread temporarily on the configured CPUs */
+	template <typename Fn>
+	void allocate(Fn fn)
+	{
+		cpu_set_t old;
+		bool pinned = !_cpus.empty() && rtthread_get_affinity(&old) == 0 &&
+			rtthread_pin(_cpus.c_str()) == 0;
+		fn();
+		if (pinned) rtthread_set_affinity(&old);
+	}
+
+	/* Where the thread runs, for the blocks' getThreadStats() */
+	Pothos::ObjectKwargs stats(void) const
+	{
+		Pothos::ObjectKwargs s;
+		s["cpus"] = Pothos::Object(_cpus);
+		s["priority"] = Pothos::Object(_priority);
+		s["tid"] = Pothos::Object(_tid);
+		s["cpu"] = Pothos::Object(_cpu);
+		if (!_error.empty()) s["error"] = Pothos::Object(_error);
+		return s;
+	}
+
+private:
+	std::string _cpus;
+	int _priority;
+	bool _realtime;
+	bool _changed;
+	bool _pooled;
+	long _tid;
+	int _cpu;
+	std::string _error;
+
+	void fail(const std::string &what, int error)
+	{
+		if (!_error.empty()) _error += "; ";
+		_error += what + ": " + std::strerror(error);
+		std::cerr << "ThreadPlacement: " << _error << std::endl;
+	}
+};
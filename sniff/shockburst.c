@@ -28,12 +28,13 @@ Steve Markgraf, RTL-SDR Library - https://github.com/steve-m/librtlsdr
 NRF24-BTLE-Decoder - https://github.com/omriiluz/NRF24-BTLE-Decoder
 */
 
+#define _GNU_SOURCE	// for the thread affinity calls and st_mtim
+
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
 #include <time.h>
 #include <sys/time.h>
-#include <math.h>
 #include <stdbool.h>
 #include <inttypes.h>
 #if defined(WIN32)
@@ -42,179 +43,611 @@ NRF24-BTLE-Decoder - https://github.com/omriiluz/NRF24-BTLE-Decoder
 #endif /* defined(WIN32) */
 #include <stdlib.h> // For exit function
 #include <unistd.h>    /* for getopt */
+#include <signal.h>
 
-#include "packets.h"
+#include "antsniff/antsniff.h"
+#include "antsniff/jsonl.h"
+#include "antsniff/packetlog.h"
+#if !defined(WIN32)
+	#include "antsniff/capture.h"
+	#include "antsniff/checkpoint.h"
+	#include "antsniff/pcapng.h"
+	#include "antsniff/shmring.h"
+#endif /* !defined(WIN32) */
+#if defined(__linux__)
+	#include "antsniff/rtthread.h"
+#endif /* defined(__linux__) */
 
-/* Global variables */
-int32_t g_threshold; // Quantization threshold
-int g_srate; // sample rate downconvert ratio
-const char g_json_fmt[] = "{\"sample\": %"PRId32", \"threshold\": %"PRId32", "
-						"\"address\": \"0x%08"PRIX64"\", \"payload\": %s}\n";
+#define ADDRESS_LENGTH 5	// valid range: 3-5
+#define PAYLOAD_LENGTH 10	// valid range: 1-32
 
-/* Ring Buffer */
-#define RB_SIZE 1000
+/* Samples read from standard input at a time */
+#define CHUNK_SIZE 8192
 
-int rb_head = -1;
-int16_t *rb_buf;
+/* Samples decoded at a time when replaying a capture */
+#define REPLAY_CHUNK_SIZE 65536
 
-/* Init Ring Buffer */
-void RB_init(void)
-{
-	rb_buf = (int16_t *)malloc(RB_SIZE * 2);
-}
+#define SAMPLE_RATE 2000000
 
-/* increment Ring Buffer Head */
-void RB_inc(void)
-{
-	rb_head++;
-	rb_head=(rb_head) % RB_SIZE;
-}
-/* Access Ring Buffer location l */
-#define RB(l) rb_buf[(rb_head+(l))%RB_SIZE]
-/* end Ring Buffer */
+/* Global variables */
+bool g_quiet = false; // don't print packets to stdout
+bool g_json = false; // print packets as JSON Lines
+JsonlWriter g_jsonl; // JSON Lines output buffer (if g_json)
+uint8_t g_channel = 50; // RF channel the samples were captured on
+PacketLogWriter g_log; // binary packet log (if g_log.log is not NULL)
+#if !defined(WIN32)
+PcapngWriter g_pcap = { .fd = -1 }; // PCAPNG export (if g_pcap.fd is not -1)
+ShmRingWriter g_shm; // shared memory feed (if g_shm.header is not NULL)
+#endif /* !defined(WIN32) */
+
+#if !defined(WIN32)
+CaptureFile g_capture; // the recorded capture, when replaying one
+const char *g_checkpoint = NULL; // checkpoint file (if not NULL)
+uint64_t g_checkpoint_interval = 60 * SAMPLE_RATE; // samples between them
+uint64_t g_next_checkpoint; // sample count the next checkpoint is due at
+#endif /* !defined(WIN32) */
+
+#if !defined(WIN32)
+volatile sig_atomic_t g_stop = 0; // set by SIGINT/SIGTERM
 
 /*
- * Quantize sample at location l by checking whether it's over the threshold.
- * Important - takes into account the sample rate downconversion ratio!
+ * SIGINT and SIGTERM stop the decoding loop, so that the outputs are flushed
+ * and closed (and a final checkpoint written) instead of losing whatever is
+ * still in their buffers. A second signal kills the program as usual.
  */
-static inline bool Quantize(int16_t l)
+void Stop(int sig)
 {
-	return RB(l * g_srate) > g_threshold;
+	(void)sig;
+	g_stop = 1;
 }
-#define Q(l) Quantize(l)
 
-/* Extract quantization threshold from preamble sequence */
-int32_t ExtractThreshold(void)
+/* SIGUSR1 switches timeline tracing on and off */
+void ToggleTimeline(int sig)
 {
-	int32_t threshold = 0;
-	int c;
-	for (c = 0; c < 8 * g_srate; c++) {
-		threshold += (int32_t)RB(c);
-	}
-
-	return (int32_t)threshold / (8 * g_srate);
+	(void)sig;
+	antsniff_timeline_enable(!antsniff_timeline_enabled());
 }
+#endif /* !defined(WIN32) */
 
-/* Identify preamble sequence */
-bool DetectPreamble(void)
+/* Called by the decoder for every packet with a valid CRC */
+void HandlePacket(const antsniff_packet *packet, void *ctx)
 {
-	int transitions = 0;
-	int c;
+	int i;
+	(void)ctx;
+
+	if (g_log.log) {
+		PacketLogRecord rec;
+		rec.sample = packet->sample;
+		rec.address = packet->address;
+		rec.crc = packet->crc;
+		rec.channel = g_channel;
+		rec.address_length = packet->address_length;
+		rec.payload_length = packet->payload_length;
+		rec.payload = packet->payload;
+		plog_write(&g_log, &rec);
+	}
 
-	// preamble sequence is based on the 9th symbol (either 0x55 or 0xAA)
-	if (Q(9)) {
-		for (c = 0; c < 8; c++) {
-			transitions += Q(c) > Q(c + 1);
-		}
+	#if !defined(WIN32)
+	if (g_pcap.fd >= 0) {
+		PcapngPacket pkt;
+		pkt.sample = packet->sample;
+		pkt.address = packet->address;
+		pkt.threshold = packet->threshold;
+		pkt.crc = packet->crc;
+		pkt.channel = g_channel;
+		pkt.address_length = packet->address_length;
+		pkt.payload_length = packet->payload_length;
+		pkt.payload = packet->payload;
+		pcapng_write(&g_pcap, &pkt);
+	}
+
+	if (g_shm.header) {
+		ShmRingPacket pkt;
+		pkt.sample = packet->sample;
+		pkt.address = packet->address;
+		pkt.threshold = packet->threshold;
+		pkt.margin = packet->margin;
+		pkt.crc = packet->crc;
+		pkt.channel = g_channel;
+		pkt.address_length = packet->address_length;
+		pkt.payload_length = packet->payload_length;
+		pkt.payload = packet->payload;
+		shmring_write(&g_shm, &pkt);
+	}
+	#endif /* !defined(WIN32) */
+
+	if (g_quiet) return;
+
+	if (g_json) {
+		antsniff_antfs_message msg;
+		int is_antfs = antsniff_antfs_parse(packet->payload,
+				packet->payload_length, &msg);
+		jsonl_packet(&g_jsonl, packet, g_channel, is_antfs ? &msg : NULL);
 	} else {
-		for (c = 0; c < 8; c++) {
-			transitions += Q(c) < Q(c + 1);
+		for (i = packet->address_length - 1; i >= 0; --i) {
+			printf("%02X ", (unsigned)(packet->address >> i * 8) & 0xff);
+		}
+		for (i = 0; i < packet->payload_length; ++i) {
+			printf("%02X ", packet->payload[i]);
 		}
+		printf("\n");
+		fflush(stdout);
 	}
+}
 
-	return transitions == 4 && abs(g_threshold) < 15500;
+#if !defined(WIN32)
+/* Whether fd is a regular file, and if so, its size */
+bool RegularFile(int fd, uint64_t *size)
+{
+	struct stat st;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) return false;
+	*size = (uint64_t)st.st_size;
+	return true;
 }
 
-/* Extract byte from ring buffer starting location l */
-static inline uint8_t ExtractByte(int l)
+/* The input's format and size, as recorded in checkpoints */
+void InputOf(bool replay, uint32_t *format, uint64_t *size)
 {
-	uint8_t byte = 0;
-	int c;
-	for (c = 0; c < 8; c++) {
-		byte |= Q(l + c) << (7 - c);
+	if (replay) {
+		*format = g_capture.format;
+		*size = g_capture.size;
+	} else {
+		*format = 0;
+		if (!RegularFile(STDIN_FILENO, size)) *size = 0;
 	}
-
-	return byte;
 }
 
-/* Extract count bytes from ring buffer starting location l into buffer*/
-static inline void ExtractBytes(int l, uint8_t* buffer, int count)
+/*
+ * Write a checkpoint of the job if one is due, after flushing the outputs, so
+ * that they have everything found up to it.
+ */
+void WriteCheckpoint(antsniff_decoder *decoder, bool replay, bool force)
 {
-	int t;
-	for (t = 0; t < count; t++) {
-		buffer[t] = ExtractByte(l + t * 8);
+	static Checkpoint c;
+	uint64_t samples = antsniff_decoder_samples(decoder);
+	uint64_t size;
+	size_t state_size;
+
+	if (!g_checkpoint || (!force && samples < g_next_checkpoint)) return;
+	g_next_checkpoint = samples + g_checkpoint_interval;
+
+	checkpoint_init(&c);
+	c.header.samples = samples;
+	InputOf(replay, &c.header.format, &c.header.input_size);
+	if (replay) c.header.demod = g_capture.demod;
+	state_size = antsniff_decoder_save(decoder, c.state, sizeof(c.state));
+	c.header.state_size = (uint32_t)state_size;
+
+	if (g_json && g_jsonl.used) jsonl_flush(&g_jsonl);
+	fflush(stdout);
+	if (RegularFile(STDOUT_FILENO, &size)) c.header.output = size;
+	if (g_log.log) {
+		plog_position(&g_log, &c.header.log);
+		c.header.has_log = 1;
+	}
+
+	if (state_size > sizeof(c.state) || checkpoint_write(g_checkpoint, &c) < 0) {
+		fprintf(stderr, "Could not write checkpoint %s\n", g_checkpoint);
 	}
 }
 
 /*
-bool DecodePacket(int32_t sample, int srate)
+ * Resume the job from the checkpoint: restore the decoder and the demodulator,
+ * cut the outputs back to where they were, and move on the input to where
+ * the job was. Returns 0, or -1 if the job can't be resumed.
+ */
+int ResumeCheckpoint(antsniff_decoder *decoder, bool replay)
 {
-	int i;
-	g_srate = srate;
-	g_threshold = ExtractThreshold();
-
-	if (DetectPreamble()) {
-		uint8_t tmp_buf[ADDRESS_LENGTH + PAYLOAD_LENGTH + 2];
-		ExtractBytes(8, tmp_buf, sizeof(tmp_buf));
-		ShockBurstPacket sbp;
-		if (sbp_from_bytes(tmp_buf, &sbp)) {
-			char payload[256];
-			if (!ant_from_sbp(&sbp, payload, 256)) {
-				for (i = 0; i < PAYLOAD_LENGTH; ++i) {
-					sprintf(payload + 2 * i, "%02X", sbp.payload[i]);
-				}
-			}
-
-			printf(g_json_fmt, sample, g_threshold, sbp.address, payload);
+	static Checkpoint c;
+	static int16_t discard[CHUNK_SIZE];
+	uint32_t format;
+	uint64_t input_size, size, skip;
+
+	if (checkpoint_read(g_checkpoint, &c) < 0) {
+		fprintf(stderr, "Could not read checkpoint %s\n", g_checkpoint);
+		return -1;
+	}
+	// a pipe's size is unknown, so it matches any
+	InputOf(replay, &format, &input_size);
+	if (c.header.format != format || (c.header.input_size != input_size &&
+				c.header.input_size != 0 && input_size != 0) ||
+			antsniff_decoder_restore(decoder, c.state,
+				c.header.state_size) < 0) {
+		fprintf(stderr, "Checkpoint %s is of another input or decoder\n",
+				g_checkpoint);
+		return -1;
+	}
+	if (replay) g_capture.demod = c.header.demod;
+
+	if (c.header.output != CHECKPOINT_NO_OFFSET &&
+			RegularFile(STDOUT_FILENO, &size)) {
+		if (size < c.header.output || ftruncate(STDOUT_FILENO,
+					(off_t)c.header.output) < 0) {
+			fprintf(stderr, "Standard output is shorter than at the checkpoint "
+					"(append to it with >>)\n");
+			return -1;
+		}
+		lseek(STDOUT_FILENO, (off_t)c.header.output, SEEK_SET);
+	}
+	if (g_log.log && (!c.header.has_log ||
+				plog_rewind(&g_log, &c.header.log) < 0)) {
+		fprintf(stderr, "The packet log is not the one of the checkpoint\n");
+		return -1;
+	}
 
-			return true;
+	// standard input is read on from the checkpoint, or past it if it's a pipe
+	if (!replay && lseek(STDIN_FILENO, (off_t)(c.header.samples *
+					sizeof(int16_t)), SEEK_SET) < 0) {
+		for (skip = c.header.samples; skip > 0;) {
+			size_t count = skip < CHUNK_SIZE ? (size_t)skip : CHUNK_SIZE;
+			if (fread(discard, sizeof(discard[0]), count, stdin) != count) {
+				fprintf(stderr, "The input ends before the checkpoint\n");
+				return -1;
+			}
+			skip -= count;
 		}
 	}
 
-	return false;
+	g_next_checkpoint = c.header.samples + g_checkpoint_interval;
+	fprintf(stderr, "Resuming from sample %" PRIu64 "\n", c.header.samples);
+	return 0;
 }
-*/
 
-bool DecodePacket(int32_t sample, int srate)
+uint64_t MonotonicNs(void)
 {
-	int i;
-	g_srate = srate;
-	g_threshold = ExtractThreshold();
-
-	if (DetectPreamble()) {
-		uint8_t tmp_buf[ADDRESS_LENGTH + PAYLOAD_LENGTH + 2];
-		ExtractBytes(8, tmp_buf, sizeof(tmp_buf));
-		if (is_sbp(tmp_buf)) {
-			for (i = 0; i < ADDRESS_LENGTH + PAYLOAD_LENGTH; ++i) {
-				printf("%02X ", tmp_buf[i]);
-			}
-			printf("\n");
-			fflush(stdout);
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Decode the whole capture, as fast as possible (speed 0) or paced to speed
+ * times real time, and report the throughput, which is that of the decoder
+ * and the outputs, as the samples come straight from the page cache.
+ */
+void Replay(antsniff_decoder *decoder, double speed)
+{
+	static int16_t demod[REPLAY_CHUNK_SIZE];
+	uint64_t first = MonotonicNs(), elapsed;
+	uint64_t resumed = antsniff_decoder_samples(decoder);
+	uint64_t pos = resumed;
+	double seconds;
+
+	while (pos < g_capture.samples && !g_stop) {
+		size_t count = REPLAY_CHUNK_SIZE;
+		if (count > g_capture.samples - pos) {
+			count = (size_t)(g_capture.samples - pos);
+		}
 
-			return true;
+		// demodulated captures are decoded in place, I/Q ones via demod[]
+		if (g_capture.format == CAPTURE_S16) {
+			antsniff_decoder_feed(decoder, (const int16_t *)capture_at(
+						&g_capture, pos), count, HandlePacket, NULL);
+		} else {
+			capture_demod(&g_capture, pos, count, demod);
+			antsniff_decoder_feed(decoder, demod, count, HandlePacket, NULL);
+		}
+		if (g_json && g_jsonl.used) jsonl_flush(&g_jsonl);
+		pcapng_poll(&g_pcap);
+		capture_release(&g_capture, pos, count);
+		pos += count;
+		WriteCheckpoint(decoder, true, false);
+
+		if (speed > 0.0) {
+			uint64_t due = first + (uint64_t)((pos - resumed) * 1e9 /
+					(SAMPLE_RATE * speed));
+			uint64_t now = MonotonicNs();
+			if (due > now) {
+				struct timespec ts;
+				ts.tv_sec = (time_t)((due - now) / 1000000000ULL);
+				ts.tv_nsec = (long)((due - now) % 1000000000ULL);
+				nanosleep(&ts, NULL);
+			}
 		}
 	}
 
-	return false;
+	elapsed = MonotonicNs() - first;
+	seconds = elapsed > 0 ? elapsed / 1e9 : 1e-9;
+	pos -= resumed;
+	fprintf(stderr, "Replayed %" PRIu64 " samples (%.1f s) in %.3f s: "
+			"%.1f Msps, %.1fx real time\n", pos, (double)pos / SAMPLE_RATE,
+			seconds, pos / seconds / 1e6, pos / seconds / SAMPLE_RATE);
+}
+#endif /* !defined(WIN32) */
+
+void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-q | -j] [-c channel] [-w logfile] "
+			"[-p pcapfile [-r MiB] [-t seconds]] [-m shmname [-n records]]\n"
+			"       [-a cpus] [-P priority] [-i capture [-f format] [-x speed] "
+			"[-T start]]\n"
+			"       [-e tracefile] [-k checkpoint [-K seconds] [-R]] [-d devices]\n"
+			"  -q          don't print packets to standard output\n"
+			"  -j          print packets (and ANT-FS fields) as JSON Lines\n"
+			"  -c channel  RF channel recorded in the packet log (default: 50)\n"
+			"  -w logfile  write packets to a binary packet log (see antlog)\n"
+			"  -p pcapfile write packets to a PCAPNG file\n"
+			"  -r MiB      rotate the PCAPNG file after this many MiB\n"
+			"  -t seconds  rotate the PCAPNG file after this many seconds\n"
+			"  -m shmname  publish packets to a shared memory feed (see antshm)\n"
+			"  -n records  size of the shared memory feed (default: 65536)\n"
+			"  -a cpus     run on these CPUs only, e.g. 2 or 2-3 (Linux only)\n"
+			"  -P priority run with SCHED_FIFO real time priority (1-99)\n"
+			"  -i capture  decode a recorded capture instead of standard input\n"
+			"  -f format   capture format: s16, cs16, cs8, cu8 or cf32 (default: by "
+			"extension)\n"
+			"  -x speed    replay at this multiple of real time (default: 0, as "
+			"fast as possible)\n"
+			"  -T start    time of the capture's first sample, in seconds since "
+			"the epoch\n"
+			"              (default: modification time minus duration)\n"
+			"  -e tracefile write a timeline of the decoder to this Chrome trace "
+			"file\n"
+			"              (SIGUSR1 pauses and resumes tracing)\n"
+			"  -k checkpoint write checkpoints of the job to this file\n"
+			"  -K seconds  of input between checkpoints (default: 60)\n"
+			"  -R          resume the job from the checkpoint; standard output "
+			"(appended\n"
+			"              to with >>) and the packet log are cut back to it "
+			"(not with -p\n"
+			"              or -m)\n"
+			"  -d devices  learn the levels of this many devices, and slice packets "
+			"that fail\n"
+			"              the CRC check again at those of the 4 heard last "
+			"(default: 0, off)\n",
+			name);
 }
 
 int main (int argc, char** argv)
 {
-	int16_t cursamp;
-	int32_t samples = 0;
-	int skip;
+	static int16_t samples[CHUNK_SIZE];
+	size_t count;
+	antsniff_decoder *decoder;
+	antsniff_decoder_params params;
 	int opt;
 	bool optfail = false;
-	int srate = 2;
+	const char *logfile = NULL;
+	const char *pcapfile = NULL;
+	uint64_t rotate_bytes = 0, rotate_seconds = 0;
+	const char *shmname = NULL;
+	uint64_t shm_records = 65536;
+	const char *cpus = NULL;
+	int priority = 0;
+	int pipe_size = -1;
+	uint64_t reads = 0, pipe_full = 0;
+	const char *capture = NULL;
+	const char *format = NULL;
+	double speed = 0.0, start = 0.0;
+	const char *tracefile = NULL;
+	long traced;
+	const char *checkpoint = NULL;
+	double checkpoint_seconds = 60.0;
+	bool resume = false;
+	uint64_t start_time;
+	struct timeval tv;
+	#if !defined(WIN32)
+	struct sigaction stop;
+	#endif /* !defined(WIN32) */
 	#if defined(WIN32)
 		_setmode(_fileno(stdin), _O_BINARY);
 	#endif /* defined(WIN32) */
 
-	RB_init();
-	g_threshold = 0;
+	antsniff_decoder_params_init(&params);
+	while ((opt = getopt(argc, argv, "qjc:w:p:r:t:m:n:a:P:i:f:x:T:e:k:K:Rd:")) != -1) {
+		switch (opt) {
+			case 'q': g_quiet = true; break;
+			case 'j': g_json = true; break;
+			case 'c': g_channel = (uint8_t)atoi(optarg); break;
+			case 'w': logfile = optarg; break;
+			case 'p': pcapfile = optarg; break;
+			case 'r': rotate_bytes = strtoull(optarg, NULL, 0) << 20; break;
+			case 't': rotate_seconds = strtoull(optarg, NULL, 0); break;
+			case 'm': shmname = optarg; break;
+			case 'n': shm_records = strtoull(optarg, NULL, 0); break;
+			case 'a': cpus = optarg; break;
+			case 'P': priority = atoi(optarg); break;
+			case 'i': capture = optarg; break;
+			case 'f': format = optarg; break;
+			case 'x': speed = atof(optarg); break;
+			case 'T': start = atof(optarg); break;
+			case 'e': tracefile = optarg; break;
+			case 'k': checkpoint = optarg; break;
+			case 'K': checkpoint_seconds = atof(optarg); break;
+			case 'R': resume = true; break;
+			case 'd': params.known_devices = (uint32_t)atoi(optarg); break;
+			default: optfail = true; break;
+		}
+	}
+	if (optfail || (resume && !checkpoint) || checkpoint_seconds <= 0.0 ||
+			params.known_devices > 256) {
+		usage(argv[0]);
+		return 1;
+	}
+	// the PCAPNG file and the shared memory feed would start over
+	if (resume && (pcapfile || shmname)) {
+		fprintf(stderr, "-R can't resume a PCAPNG file (-p) or a shared memory "
+				"feed (-m)\n");
+		return 1;
+	}
 
-	skip = 1000;
+	// before anything is allocated, so all buffers are local to these CPUs
+	if (cpus || priority > 0) {
+		#if defined(__linux__)
+		if (cpus && rtthread_pin(cpus) < 0) {
+			fprintf(stderr, "Could not run on CPUs %s: %s\n", cpus,
+					strerror(errno));
+			return 1;
+		}
+		if (priority > 0 && rtthread_set_priority(priority) < 0) {
+			fprintf(stderr, "Could not set real time priority %d: %s\n",
+					priority, strerror(errno));
+			return 1;
+		}
+		pipe_size = rtthread_pipe_size(STDIN_FILENO);
+		#else
+		fprintf(stderr, "CPU affinity and priority are only supported on Linux\n");
+		return 1;
+		#endif /* defined(__linux__) */
+	}
 
-	while(!feof(stdin)) {
-		cursamp  = (int16_t) ( fgetc(stdin) | fgetc(stdin) << 8);
-		RB_inc();
-		RB(0) = (int)cursamp;
-		if (--skip < 1) {
-			if (DecodePacket(++samples, srate)) {
-				skip=20;
-			}
+	gettimeofday(&tv, NULL);
+	start_time = (uint64_t)tv.tv_sec * 1000000000ULL +
+		(uint64_t)tv.tv_usec * 1000ULL;
+
+	#if !defined(WIN32)
+	if (capture) {
+		CaptureFormat f = format ? capture_format(format) : CAPTURE_UNKNOWN;
+		if (format && f == CAPTURE_UNKNOWN) {
+			fprintf(stderr, "Unknown capture format %s\n", format);
+			return 1;
+		}
+		if (capture_open(&g_capture, capture, f) < 0) {
+			fprintf(stderr, "Could not open capture %s (unknown format?)\n",
+					capture);
+			return 1;
+		}
+
+		// packets are stamped with the time they were received at
+		start_time = start > 0.0 ? (uint64_t)(start * 1e9) :
+			capture_start_time(&g_capture, SAMPLE_RATE);
+	}
+	#else
+	if (capture) {
+		fprintf(stderr, "Replaying captures is not supported on Windows\n");
+		return 1;
+	}
+	#endif /* !defined(WIN32) */
+
+	if (logfile) {
+		if (plog_open(&g_log, logfile, SAMPLE_RATE, start_time, resume) < 0) {
+			fprintf(stderr, "Could not open packet log %s\n", logfile);
+			return 1;
+		}
+	}
+	if (pcapfile) {
+		#if !defined(WIN32)
+		if (pcapng_open(&g_pcap, pcapfile, SAMPLE_RATE, start_time,
+					rotate_bytes, rotate_seconds) < 0) {
+			fprintf(stderr, "Could not open PCAPNG file %s\n", pcapfile);
+			return 1;
 		}
+		#else
+		fprintf(stderr, "PCAPNG export is not supported on Windows\n");
+		return 1;
+		#endif /* !defined(WIN32) */
 	}
+	if (shmname) {
+		#if !defined(WIN32)
+		if (shmring_open(&g_shm, shmname, shm_records, SAMPLE_RATE,
+					start_time) < 0) {
+			fprintf(stderr, "Could not create shared memory feed %s\n",
+					shmname);
+			return 1;
+		}
+		#else
+		fprintf(stderr, "The shared memory feed is not supported on Windows\n");
+		return 1;
+		#endif /* !defined(WIN32) */
+	}
+
+	if (g_json && jsonl_open(&g_jsonl, STDOUT_FILENO) < 0) {
+		fprintf(stderr, "Could not allocate the JSON Lines buffer\n");
+		return 1;
+	}
+
+	decoder = antsniff_decoder_new_params(ADDRESS_LENGTH, PAYLOAD_LENGTH,
+			&params);
+	if (!decoder) {
+		fprintf(stderr, "Could not create decoder\n");
+		return 1;
+	}
+
+	if (checkpoint) {
+		#if !defined(WIN32)
+		g_checkpoint = checkpoint;
+		g_checkpoint_interval = (uint64_t)(checkpoint_seconds * SAMPLE_RATE);
+		g_next_checkpoint = g_checkpoint_interval;
+		if (resume && ResumeCheckpoint(decoder, capture != NULL) < 0) {
+			return 1;
+		}
+		#else
+		fprintf(stderr, "Checkpoints are not supported on Windows\n");
+		return 1;
+		#endif /* !defined(WIN32) */
+	}
+
+	if (tracefile) {
+		if (antsniff_timeline_start(tracefile) < 0) {
+			fprintf(stderr, "Could not write timeline %s\n", tracefile);
+			return 1;
+		}
+		#if !defined(WIN32)
+		signal(SIGUSR1, ToggleTimeline);
+		#endif /* !defined(WIN32) */
+	}
+
+	#if !defined(WIN32)
+	// no SA_RESTART, so that a read blocked on a quiet pipe returns
+	memset(&stop, 0, sizeof(stop));
+	stop.sa_handler = Stop;
+	stop.sa_flags = SA_RESETHAND;
+	sigemptyset(&stop.sa_mask);
+	sigaction(SIGINT, &stop, NULL);
+	sigaction(SIGTERM, &stop, NULL);
+
+	if (capture) {
+		Replay(decoder, speed);
+		WriteCheckpoint(decoder, true, true);
+		capture_close(&g_capture);
+	}
+	#endif /* !defined(WIN32) */
+
+	// samples are little endian signed 16 bit, like the host's
+	while (!capture) {
+		#if defined(__linux__)
+		// a full pipe means the capture tool is blocked, and dropping samples
+		if (pipe_size > 0) {
+			++reads;
+			if (rtthread_pipe_full(STDIN_FILENO, pipe_size)) ++pipe_full;
+		}
+		#endif /* defined(__linux__) */
+
+		count = fread(samples, sizeof(samples[0]), CHUNK_SIZE, stdin);
+		if (count == 0) break;
+		antsniff_decoder_feed(decoder, samples, count, HandlePacket, NULL);
+		if (g_json && g_jsonl.used) jsonl_flush(&g_jsonl);
+		#if !defined(WIN32)
+		pcapng_poll(&g_pcap);
+		WriteCheckpoint(decoder, false, false);
+		if (g_stop) break;
+		#endif /* !defined(WIN32) */
+	}
+	#if !defined(WIN32)
+	if (!capture) WriteCheckpoint(decoder, false, true);
+	#endif /* !defined(WIN32) */
+
+	if (pipe_full) {
+		fprintf(stderr, "Input pipe overflowed on %" PRIu64 " of %" PRIu64
+				" reads\n", pipe_full, reads);
+	}
+
+	if (tracefile) {
+		traced = antsniff_timeline_stop();
+		if (traced < 0) {
+			fprintf(stderr, "Could not write timeline %s\n", tracefile);
+		} else {
+			fprintf(stderr, "Wrote %ld timeline events to %s\n", traced,
+					tracefile);
+		}
+	}
+
+	antsniff_decoder_free(decoder);
+	if (g_json) jsonl_close(&g_jsonl);
+	plog_close(&g_log);
+	#if !defined(WIN32)
+	pcapng_close(&g_pcap);
+	shmring_close(&g_shm);
+	#endif /* !defined(WIN32) */
 
 	return 0;
 }